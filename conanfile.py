@@ -16,4 +16,5 @@ class RoRServer(ConanFile):
         self.requires("jsoncpp/1.9.5")
         self.requires("openssl/3.3.2", override=True)
         self.requires("socketw/3.11.0@anotherfoxguy/stable")
-        self.requires("libcurl/8.10.1")
\ No newline at end of file
+        self.requires("libcurl/8.10.1")
+        self.requires("zstd/1.5.6")
\ No newline at end of file
@@ -0,0 +1,611 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   bench.cpp
+/// @brief  Microbenchmarks of the relay hot path, results are printed as JSON.
+///
+/// Clients are attached through SinkTransport, which swallows everything that is
+/// sent and blocks receivers until disconnected, so no network is involved.
+
+#include "broadcaster.h"
+#include "cluster.h"
+#include "config.h"
+#include "logger.h"
+#include "messaging.h"
+#include "rornet.h"
+#include "sequencer.h"
+#include "spamfilter.h"
+#include "transport.h"
+#include "UnicodeStrings.h"
+#include "json/json.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock BenchClock;
+
+/// Connection to a client that never sends anything and reads infinitely fast.
+class SinkTransport : public Transport {
+public:
+    bool SendAll(const char *buf, int len) override {
+        m_bytes_sent += len;
+        return true;
+    }
+
+    bool RecvAll(char *buf, int len) override {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_is_reading = true;
+        m_cond.wait(lock, [this] { return m_is_disconnected; });
+        return false;
+    }
+
+    void SetTimeout(unsigned int sec) override {}
+
+    std::string GetPeerAddress() override { return "127.0.0.1"; }
+
+    bool Disconnect() override {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_is_disconnected = true;
+        }
+        m_cond.notify_all();
+        return true;
+    }
+
+    std::string GetLastError() override { return "connection closed"; }
+
+    uint64_t GetBytesSent() const { return m_bytes_sent; }
+
+    bool IsReading() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_is_reading;
+    }
+
+private:
+    std::atomic<uint64_t>    m_bytes_sent{0};
+    std::mutex               m_mutex;
+    std::condition_variable  m_cond;
+    bool                     m_is_reading = false;
+    bool                     m_is_disconnected = false;
+};
+
+struct BenchOptions {
+    std::string filter;
+    std::string output_file;
+    int         min_time_ms = 300;
+    bool        check = false;
+};
+
+static BenchOptions                s_options;
+static Json::Value                 s_results(Json::arrayValue);
+static Sequencer                   s_sequencer;
+static std::vector<SinkTransport*> s_sequencer_transports;
+
+/// Runs `op` in batches of `batch_size` until `min_time_ms` is spent in it;
+/// `setup` runs before every batch and is not timed. Records ns per operation.
+static void RunBenchmark(const std::string &name, const Json::Value &params, int batch_size,
+                         std::function<void()> setup, std::function<void(int)> op) {
+    if (!s_options.filter.empty() && name.find(s_options.filter) == std::string::npos) {
+        return;
+    }
+
+    std::vector<double> samples; // ns per op, one per batch
+    BenchClock::duration total(0);
+    const auto min_time = std::chrono::milliseconds(s_options.min_time_ms);
+    uint64_t iterations = 0;
+    while (total < min_time || samples.size() < 5) {
+        setup();
+        const auto start = BenchClock::now();
+        for (int i = 0; i < batch_size; i++) {
+            op(i);
+        }
+        const auto elapsed = BenchClock::now() - start;
+        total += elapsed;
+        iterations += batch_size;
+        samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / batch_size);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    Json::Value result(Json::objectValue);
+    result["name"] = name;
+    result["params"] = params;
+    result["iterations"] = (Json::UInt64) iterations;
+    result["ns_per_op_median"] = samples[samples.size() / 2];
+    result["ns_per_op_min"] = samples.front();
+    result["ns_per_op_p90"] = samples[(samples.size() * 9) / 10];
+    result["ops_per_sec"] = 1.0e9 / samples[samples.size() / 2];
+    s_results.append(result);
+
+    Logger::Log(LOG_INFO, "%-28s %-40s %10.1f ns/op", name.c_str(),
+                Json::FastWriter().write(params).c_str(), samples[samples.size() / 2]);
+}
+
+// ---------------------------------------------------------------------------
+// Broadcaster::QueueMessage
+
+static void BenchBroadcasterQueue() {
+    const int depths[] = {0, 10, 100, Broadcaster::QUEUE_HARD_LIMIT};
+    const double ratios[] = {0.0, 0.5, 1.0};
+    const int num_streams = 64; // distinct uid/stream pairs that are queued by the measured calls
+    char payload[512];
+    memset(payload, 0x5A, sizeof(payload));
+
+    for (int depth : depths) {
+        for (double ratio : ratios) {
+            std::unique_ptr<Broadcaster> broadcaster;
+            Json::Value params(Json::objectValue);
+            params["queue_depth"] = depth;
+            params["discardable_ratio"] = ratio;
+            params["payload"] = (int) sizeof(payload);
+
+            // every n-th message is non-discardable
+            const int period = 100;
+            const int num_discardable = (int) (ratio * period);
+            auto type_of = [=](int i) {
+                return (i % period) < num_discardable ? RoRnet::MSG2_STREAM_DATA_DISCARDABLE : RoRnet::MSG2_STREAM_DATA;
+            };
+
+            RunBenchmark("broadcaster_queue_message", params, 64,
+                         [&]() {
+                             // The broadcaster thread is not started, the queue only grows.
+                             // Distinct senders, so discardable entries do not replace each other.
+                             broadcaster.reset(new Broadcaster(&s_sequencer));
+                             for (int i = 0; i < depth; i++) {
+                                 broadcaster->QueueMessage(type_of(i), 1 + i, 10, sizeof(payload),
+                                                           payload);
+                             }
+                         },
+                         [&](int i) {
+                             broadcaster->QueueMessage(type_of(i), 1 + (i * 7) % num_streams, 10, sizeof(payload),
+                                                       payload);
+                         });
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Sequencer::queueMessage fan-out
+
+static void AddSequencerClients(size_t count) {
+    while (s_sequencer_transports.size() < count) {
+        RoRnet::UserInfo user;
+        memset(&user, 0, sizeof(RoRnet::UserInfo));
+        snprintf(user.username, RORNET_MAX_USERNAME_LEN, "bench-%d", (int) s_sequencer_transports.size());
+        user.authstatus = RoRnet::AUTH_BOT; // bots do not count against the slot limit
+        SinkTransport *transport = new SinkTransport();
+        s_sequencer.createClient(transport, user);
+        s_sequencer_transports.push_back(transport);
+    }
+
+    // Wait until all receivers are up, only then are the clients fed with data
+    for (SinkTransport *transport : s_sequencer_transports) {
+        while (!transport->IsReading()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); // let the join messages drain
+}
+
+static uint64_t GetSequencerBytesSent() {
+    uint64_t sum = 0;
+    for (SinkTransport *transport : s_sequencer_transports) {
+        sum += transport->GetBytesSent();
+    }
+    return sum;
+}
+
+static void BenchSequencerFanout() {
+    const size_t client_counts[] = {8, 32, 64, 128};
+    const int sender_uid = 1; // the first client created
+    const unsigned int streamid = 10;
+    char payload[512];
+    memset(payload, 0x5A, sizeof(payload));
+
+    if (!s_options.filter.empty() && std::string("sequencer_fanout_delivered").find(s_options.filter) == std::string::npos) {
+        return;
+    }
+
+    for (size_t num_clients : client_counts) {
+        AddSequencerClients(num_clients);
+        if (num_clients == client_counts[0]) {
+            RoRnet::StreamRegister reg;
+            memset(&reg, 0, sizeof(RoRnet::StreamRegister));
+            reg.type = STREAM_REG_TYPE_VEHICLE;
+            reg.origin_sourceid = sender_uid;
+            reg.origin_streamid = streamid;
+            strncpy(reg.name, "bench.truck", sizeof(reg.name) - 1);
+            s_sequencer.queueMessage(sender_uid, RoRnet::MSG2_STREAM_REGISTER, streamid, (char *) &reg,
+                                     sizeof(RoRnet::StreamRegister));
+            s_sequencer.queueMessage(sender_uid, RoRnet::MSG2_STREAM_DATA, streamid, payload, sizeof(payload));
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+
+        Json::Value params(Json::objectValue);
+        params["clients"] = (Json::UInt64) num_clients;
+        params["payload"] = (int) sizeof(payload);
+
+        // Every batch starts once the previous one was written to all recipients,
+        // otherwise the queues would grow without bounds
+        const int batch_size = 32;
+        const uint64_t frame_size = sizeof(RoRnet::Header) + sizeof(payload);
+        const uint64_t batch_bytes = batch_size * (num_clients - 1) * frame_size;
+        uint64_t target = 0;
+        auto wait_for_previous_batch = [&]() {
+            while (GetSequencerBytesSent() < target) {
+                std::this_thread::yield();
+            }
+            target = GetSequencerBytesSent() + batch_bytes;
+        };
+
+        // Only the sequencer, broadcasters drain in the background
+        RunBenchmark("sequencer_fanout", params, batch_size,
+                     wait_for_previous_batch,
+                     [&](int) {
+                         s_sequencer.queueMessage(sender_uid, RoRnet::MSG2_STREAM_DATA, streamid, payload,
+                                                  sizeof(payload));
+                     });
+
+        // Until everything was written to the transports of all recipients
+        RunBenchmark("sequencer_fanout_delivered", params, batch_size,
+                     wait_for_previous_batch,
+                     [&](int i) {
+                         s_sequencer.queueMessage(sender_uid, RoRnet::MSG2_STREAM_DATA, streamid, payload,
+                                                  sizeof(payload));
+                         if (i == batch_size - 1) {
+                             while (GetSequencerBytesSent() < target) {
+                                 std::this_thread::yield();
+                             }
+                         }
+                     });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Messaging::SWSendMessage
+
+static void BenchSendMessage() {
+    const unsigned int sizes[] = {0, 64, 512, 4096, 8000};
+    static char payload[RORNET_MAX_MESSAGE_LENGTH];
+    memset(payload, 0x5A, sizeof(payload));
+    SinkTransport transport;
+
+    for (unsigned int size : sizes) {
+        Json::Value params(Json::objectValue);
+        params["payload"] = size;
+        RunBenchmark("messaging_send_message", params, 1000,
+                     []() {},
+                     [&](int) {
+                         Messaging::SWSendMessage(&transport, RoRnet::MSG2_STREAM_DATA, 1, 10, size, payload);
+                     });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Str::SanitizeUtf8
+
+static void BenchSanitizeUtf8() {
+    struct Input {
+        const char *label;
+        std::string text;
+    };
+    std::string chat_ascii;
+    std::string chat_utf8;
+    std::string chat_invalid;
+    while (chat_ascii.size() < 200) {
+        chat_ascii += "anyone up for a convoy to the harbour? ";
+        chat_utf8 += "Grüße aus Köln, 日本語もOK ";
+        chat_invalid += "broken \xC3\x28 bytes \xF0\x28\x8C\x28 here ";
+    }
+    const Input inputs[] = {
+            {"username", "SomePlayer_1987"},
+            {"chat_ascii", chat_ascii},
+            {"chat_utf8", chat_utf8},
+            {"chat_invalid", chat_invalid},
+    };
+
+    for (const Input &input : inputs) {
+        Json::Value params(Json::objectValue);
+        params["input"] = input.label;
+        params["bytes"] = (Json::UInt64) input.text.size();
+        const char *text = input.text.c_str();
+        RunBenchmark("sanitize_utf8", params, 1000,
+                     []() {},
+                     [&](int) {
+                         std::string out = Str::SanitizeUtf8(text);
+                         if (out.empty()) { abort(); } // keep the result alive
+                     });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// SpamFilter::CheckForSpam
+
+static void BenchSpamFilter() {
+    const int cache_sizes[] = {0, 10, 100, 1000};
+
+    // Long interval and high count so messages stay cached and nobody gets gagged
+    Config::setSpamFilterMsgIntervalSec(3600);
+    Config::setSpamFilterMsgCount(1000000);
+
+    SinkTransport transport;
+    Client client(&s_sequencer, &transport);
+    std::vector<std::string> messages;
+    for (int i = 0; i < 2000; i++) {
+        messages.push_back("chat message number " + std::to_string(i) + ", nothing to see here");
+    }
+
+    for (int cache_size : cache_sizes) {
+        std::unique_ptr<SpamFilter> filter;
+        Json::Value params(Json::objectValue);
+        params["cached_messages"] = cache_size;
+        RunBenchmark("spamfilter_check", params, 64,
+                     [&]() {
+                         filter.reset(new SpamFilter(&s_sequencer, &client));
+                         for (int i = 0; i < cache_size; i++) {
+                             filter->CheckForSpam(messages[i]);
+                         }
+                     },
+                     [&](int i) {
+                         filter->CheckForSpam(messages[cache_size + i]);
+                     });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Self-check (-check): round trips of the codecs, user id allocation, no timing
+
+static int s_check_failures = 0;
+
+static void Check(bool ok, const std::string &what) {
+    if (!ok) {
+        fprintf(stderr, "check failed: %s\n", what.c_str());
+        s_check_failures++;
+    }
+}
+
+/// Encodes `frame` against `reference`, applies the result to a copy of it and compares.
+/// Returns whether a delta was produced, failed checks are counted.
+static bool CheckDeltaRoundTrip(const std::string &what, const std::vector<char> &reference,
+                                const std::vector<char> &frame) {
+    std::vector<char> delta;
+    if (!Messaging::EncodeDelta(reference, frame.data(), (unsigned int) frame.size(), delta)) {
+        return false;
+    }
+    Check(frame.empty() || delta.size() < frame.size(), what + ": delta not smaller than the frame");
+    std::vector<char> decoded(reference);
+    Check(Messaging::ApplyDelta(decoded, delta.data(), (unsigned int) delta.size()), what + ": delta rejected");
+    Check(decoded == frame, what + ": decoded frame differs");
+    return true;
+}
+
+static void CheckDelta() {
+    std::vector<char> reference(256);
+    for (size_t i = 0; i < reference.size(); i++) {
+        reference[i] = (char) (i * 7);
+    }
+
+    // identical frames: an empty delta
+    std::vector<char> delta;
+    Check(Messaging::EncodeDelta(reference, reference.data(), (unsigned int) reference.size(), delta) && delta.empty(),
+          "identical frames");
+    CheckDeltaRoundTrip("identical frames", reference, reference);
+    CheckDeltaRoundTrip("empty frames", std::vector<char>(), std::vector<char>());
+
+    // differing lengths are never encoded
+    std::vector<char> frame(reference);
+    frame.push_back(1);
+    Check(!CheckDeltaRoundTrip("longer frame", reference, frame), "longer frame encoded");
+    frame.resize(reference.size() - 1);
+    Check(!CheckDeltaRoundTrip("shorter frame", reference, frame), "shorter frame encoded");
+    std::vector<char> too_long(UINT16_MAX + 1, 'x');
+    Check(!CheckDeltaRoundTrip("frame above UINT16_MAX", too_long, too_long), "frame above UINT16_MAX encoded");
+
+    // runs at the buffer edges
+    frame = reference;
+    frame.front() ^= 1;
+    Check(CheckDeltaRoundTrip("first byte", reference, frame), "first byte not encoded");
+    frame = reference;
+    frame.back() ^= 1;
+    Check(CheckDeltaRoundTrip("last byte", reference, frame), "last byte not encoded");
+    frame.front() ^= 1;
+    Check(CheckDeltaRoundTrip("first and last byte", reference, frame), "first and last byte not encoded");
+    frame = reference;
+    for (size_t i = reference.size() - 8; i < reference.size(); i++) {
+        frame[i] ^= 0x55;
+    }
+    Check(CheckDeltaRoundTrip("tail run", reference, frame), "tail run not encoded");
+
+    // gaps shorter and longer than a run header
+    for (size_t gap = 1; gap <= 2 * sizeof(RoRnet::DeltaRun); gap++) {
+        frame = reference;
+        frame[100] ^= 1;
+        frame[100 + gap + 1] ^= 1;
+        Check(CheckDeltaRoundTrip("gap " + std::to_string(gap), reference, frame),
+              "gap " + std::to_string(gap) + " not encoded");
+    }
+
+    // a delta that isn't smaller is refused
+    frame = reference;
+    for (char &c : frame) {
+        c ^= 0x7f;
+    }
+    Check(!CheckDeltaRoundTrip("all bytes changed", reference, frame), "all bytes changed encoded");
+
+    // random changes, deterministic
+    uint32_t seed = 12345;
+    auto next_random = [&seed]() {
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 16) & 0x7fff;
+    };
+    for (int round = 0; round < 1000; round++) {
+        frame = reference;
+        const int num_changes = (int) (next_random() % 64);
+        for (int i = 0; i < num_changes; i++) {
+            frame[next_random() % frame.size()] = (char) next_random();
+        }
+        CheckDeltaRoundTrip("random round " + std::to_string(round), reference, frame);
+    }
+
+    // malformed deltas are rejected
+    std::vector<char> target(reference);
+    RoRnet::DeltaRun run;
+    run.skip = 0;
+    run.length = 4;
+    const char *run_bytes = (const char *) &run;
+    delta.assign(run_bytes, run_bytes + sizeof(RoRnet::DeltaRun));
+    Check(!Messaging::ApplyDelta(target, delta.data(), (unsigned int) delta.size()), "run without its bytes accepted");
+    Check(!Messaging::ApplyDelta(target, delta.data(), 1), "truncated run header accepted");
+    run.skip = (uint16_t) (reference.size() - 2);
+    delta.assign(run_bytes, run_bytes + sizeof(RoRnet::DeltaRun));
+    delta.resize(delta.size() + run.length, 1);
+    Check(!Messaging::ApplyDelta(target, delta.data(), (unsigned int) delta.size()), "run past the frame accepted");
+}
+
+/// User ids wrap around inside a node's range and skip the ones in use, see Cluster
+static void CheckUserIds() {
+    const int node_id = 7;
+    Cluster cluster(nullptr, node_id);
+    const unsigned int first = (unsigned int) cluster.GetFirstUserId();
+    const unsigned int last = (unsigned int) cluster.GetLastUserId();
+
+    std::set<unsigned int> in_use = { first, last - 1 };
+    unsigned int next = last - 2;
+    const unsigned int expected[] = { last - 2, last, first + 1, first + 2 };
+    for (unsigned int uid : expected) {
+        unsigned int allocated = Sequencer::AllocateUserId(next, first, last, in_use);
+        Check(allocated == uid, "allocated " + std::to_string(allocated) + ", expected " + std::to_string(uid));
+        Check(Cluster::GetNodeOfUser((int) allocated) == node_id, "user id " + std::to_string(allocated) + " outside the node's range");
+        in_use.insert(allocated);
+    }
+
+    next = last + 1; // Where counting up would have gone, the next node's range
+    Check(Sequencer::AllocateUserId(next, first, last, in_use) == first + 3, "allocation past the range not wrapped");
+
+    std::set<unsigned int> all = { 1, 2, 3 };
+    next = 2;
+    Check(Sequencer::AllocateUserId(next, 1, 3, all) == 0, "user id allocated from a used up range");
+    Check(Cluster::GetNodeOfUser(cluster.GetFirstUserId()) == node_id && Cluster::GetNodeOfUser(cluster.GetLastUserId()) == node_id,
+          "range not owned by its node");
+}
+
+static int RunChecks() {
+    CheckDelta();
+    CheckUserIds();
+    if (s_check_failures > 0) {
+        fprintf(stderr, "rorbench: %d checks failed\n", s_check_failures);
+        return 1;
+    }
+    printf("rorbench: all checks passed\n");
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static void ShowHelp() {
+    printf(
+            "Usage: rorbench [OPTIONS]\n"
+                    "Microbenchmarks of the relay hot path, results are written as JSON.\n"
+                    "\n"
+                    " -filter <text>               Only run benchmarks whose name contains <text>\n"
+                    " -min-time <ms>               Minimum measured time per benchmark (defaults to 300)\n"
+                    " -output <file>               Write the results to <file> instead of stdout\n"
+                    " -check                       Run the codec and user id self-checks instead, exits non-zero on failure\n"
+                    " -verbosity {0-5}             Sets displayed log verbosity (defaults to 4 = warn)\n"
+                    " -help                        Show this list\n");
+}
+
+int main(int argc, char *argv[]) {
+    Logger::SetLogLevel(LOGTYPE_DISPLAY, LOG_WARN);
+
+    for (int pos = 1; pos < argc; ++pos) {
+        std::string arg = argv[pos];
+        bool has_value = (pos + 1 < argc);
+        if (arg == "-filter" && has_value) {
+            s_options.filter = argv[++pos];
+        } else if (arg == "-min-time" && has_value) {
+            s_options.min_time_ms = atoi(argv[++pos]);
+        } else if (arg == "-output" && has_value) {
+            s_options.output_file = argv[++pos];
+        } else if (arg == "-check") {
+            s_options.check = true;
+        } else if (arg == "-verbosity" && has_value) {
+            Logger::SetLogLevel(LOGTYPE_DISPLAY, (LogLevel) atoi(argv[++pos]));
+        } else if (arg == "-help" || arg == "-h") {
+            ShowHelp();
+            return 0;
+        } else {
+            fprintf(stderr, "Unrecognized argument `%s`\n", arg.c_str());
+            return -1;
+        }
+    }
+
+    if (s_options.check) {
+        return RunChecks();
+    }
+
+    // No persistent side effects, no scripts
+    Config::setServerMode(SERVER_LAN);
+    Config::setBlacklistFile("");
+    Config::setMOTDFile("");
+    Config::setMaxVehicles(100);
+    s_sequencer.Initialize();
+
+    BenchBroadcasterQueue();
+    BenchSequencerFanout();
+    BenchSendMessage();
+    BenchSanitizeUtf8();
+    BenchSpamFilter();
+
+    Json::Value j_doc(Json::objectValue);
+    j_doc["protocol"] = RORNET_VERSION;
+    j_doc["min_time_ms"] = s_options.min_time_ms;
+    j_doc["results"] = s_results;
+
+    Json::StyledStreamWriter j_writer;
+    if (s_options.output_file.empty()) {
+        j_writer.write(std::cout, j_doc);
+    } else {
+        std::ofstream f(s_options.output_file);
+        if (!f.is_open()) {
+            Logger::Log(LOG_ERROR, "rorbench: cannot write '%s'", s_options.output_file.c_str());
+            return -1;
+        }
+        j_writer.write(f, j_doc);
+    }
+
+    // Clients stay attached, their threads end with the process
+    s_sequencer.Close();
+    return 0;
+}
@@ -0,0 +1,764 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   loadgen.cpp
+/// @brief  Headless bot clients for capacity testing of a running server.
+///
+/// Every virtual player does the regular RoRnet handshake, registers a character
+/// stream plus `-vehicles` actor streams and then keeps sending stream data at
+/// `-rate` Hz. Each vehicle frame carries the send time, so whenever another
+/// virtual player of this process receives it, the relay round-trip is known.
+///
+/// With `-in-process` the relay runs inside this process and the players are
+/// connected through in-memory transports, which takes the kernel out of the measurement.
+///
+/// With `-caps udp` against a server with `udp-port`, vehicle frames are sent and received
+/// as discardable stream data over the UDP channel (see udp.h).
+
+#include "compression.h"
+#include "config.h"
+#include "listener.h"
+#include "messaging.h"
+#include "rornet.h"
+#include "logger.h"
+#include "sequencer.h"
+#include "SocketW.h"
+#include "transport.h"
+#include "udp.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#define LOADGEN_STAMP_MAGIC     0x4C47454E  //!< "LGEN"
+#define LOADGEN_FIRST_STREAM_ID 10          //!< Same as the game, lower ids are reserved
+#define LOADGEN_CHARACTER_SIZE  76          //!< Approximate size of a character update
+
+// Stream types as used by the game
+#define LOADGEN_STREAM_ACTOR     0
+#define LOADGEN_STREAM_CHARACTER 1
+
+#pragma pack(push, 1)
+/// Placed right after the RoRnet::VehicleState of every vehicle frame.
+struct LoadgenStamp {
+    uint32_t magic;
+    uint64_t send_time_us;
+};
+#pragma pack(pop)
+
+struct LoadgenOptions {
+    std::string host = "127.0.0.1";
+    int         port = 12000;
+    std::string password;
+    int         num_clients = 8;
+    int         num_vehicles = 1;
+    int         rate_hz = 20;
+    int         frame_size = 512;
+    int         num_nodes = 0;       //!< Derived from `frame_size`
+    int         duration_sec = 30;
+    int         ramp_ms = 100;
+    bool        in_process = false;
+    std::string caps;                //!< Protocol capabilities to ask for, see RoRnet::Capability
+};
+
+/// One simulated player.
+struct VirtualClient {
+    int                   index = 0;
+    int                   uid = -1;
+    Transport            *transport = nullptr;
+    std::thread           send_thread;
+    std::thread           recv_thread;
+    std::atomic<bool>     connected;
+    std::atomic<uint64_t> frames_sent;
+    std::atomic<uint64_t> bytes_sent;
+    std::atomic<uint64_t> frames_received;
+    std::atomic<uint64_t> bytes_received;
+    std::mutex            latency_mutex;
+    std::vector<uint32_t> latency_us;    //!< Relay round-trips of frames from other virtual clients
+    std::unique_ptr<StreamCompressor>   compressor;   //!< If the server accepted "zstd"
+    std::unique_ptr<StreamDecompressor> decompressor;
+    std::vector<char>     inflated;      //!< Decompressed, not yet processed
+    bool                  use_delta = false;
+    std::map<std::pair<int, unsigned int>, std::vector<char>> stream_refs; //!< Last frame by source and stream, for deltas
+    int                   udp_socket = -1;   //!< If the server accepted "udp" and the address got bound
+    uint64_t              udp_token = 0;
+    uint32_t              udp_sequence = 0;  //!< Only used by the send thread
+    std::thread           udp_thread;
+
+    VirtualClient() : connected(false), frames_sent(0), bytes_sent(0), frames_received(0), bytes_received(0) {}
+    ~VirtualClient() {
+        delete transport;
+        if (udp_socket >= 0) {
+#ifdef _WIN32
+            closesocket(udp_socket);
+#else
+            close(udp_socket);
+#endif // _WIN32
+        }
+    }
+};
+
+static LoadgenOptions                      s_options;
+static std::atomic<bool>                   s_running(true);
+static std::chrono::steady_clock::time_point s_start_time;
+static Sequencer                           s_sequencer;     //!< Only with `-in-process`
+static Listener                            s_listener(&s_sequencer);
+
+static uint64_t GetTimeMicros() {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - s_start_time).count();
+}
+
+static void ShowHelp() {
+    printf(
+            "Usage: rorloadgen [OPTIONS]\n"
+                    "Simulates players against a running server and measures relay latency and throughput.\n"
+                    "\n"
+                    " -host <address>              Server address (defaults to 127.0.0.1)\n"
+                    " -port <port>                 Server port (defaults to 12000)\n"
+                    " -password <password>         Server password\n"
+                    " -clients <num>               Number of simulated players (defaults to 8)\n"
+                    " -vehicles <num>              Vehicles driven by each player (defaults to 1)\n"
+                    " -rate <hz>                   Stream data updates per second (defaults to 20)\n"
+                    " -size <bytes>                Size of one vehicle update (defaults to 512)\n"
+                    " -duration <sec>              How long to keep driving (defaults to 30)\n"
+                    " -ramp <ms>                   Delay between two player connections (defaults to 100)\n"
+                    " -in-process                  Run the relay in this process, ignores -host and -port\n"
+                    " -caps <name+name>            Protocol capabilities to ask for (e.g. bundle+zstd+delta+udp)\n"
+                    " -verbosity {0-5}             Sets displayed log verbosity (defaults to 3 = info)\n"
+                    " -help                        Show this list\n"
+                    "\n"
+                    "Note: the server must allow `-clients` players and `-vehicles` vehicles per player.\n");
+}
+
+static bool SendFrame(VirtualClient *vc, int type, unsigned int streamid, unsigned int len, const char *payload) {
+    if (vc->compressor != nullptr) {
+        char frame[sizeof(RoRnet::Header) + RORNET_MAX_MESSAGE_LENGTH];
+        RoRnet::Header head;
+        memset(&head, 0, sizeof(RoRnet::Header));
+        head.command = type;
+        head.source = vc->uid;
+        head.streamid = streamid;
+        head.size = len;
+        memcpy(frame, &head, sizeof(RoRnet::Header));
+        memcpy(frame + sizeof(RoRnet::Header), payload, len);
+        bool ok = vc->compressor->Compress(frame, sizeof(RoRnet::Header) + len,
+                [vc](const char *compressed, unsigned int compressed_len) {
+                    vc->bytes_sent += sizeof(RoRnet::Header) + compressed_len;
+                    return Messaging::SWSendMessage(vc->transport, RoRnet::MSG2_COMPRESSED, vc->uid, 0, compressed_len,
+                                                    compressed) == 0;
+                });
+        if (ok) {
+            vc->frames_sent++;
+        }
+        return ok;
+    }
+
+    if (Messaging::SWSendMessage(vc->transport, type, vc->uid, streamid, len, payload) != 0) {
+        return false;
+    }
+    vc->frames_sent++;
+    vc->bytes_sent += sizeof(RoRnet::Header) + len;
+    return true;
+}
+
+static bool SendDatagram(VirtualClient *vc, int type, unsigned int streamid, unsigned int len, const char *payload) {
+    char datagram[sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header) + RORNET_MAX_MESSAGE_LENGTH];
+    RoRnet::UdpHeader udp_head;
+    udp_head.token = vc->udp_token;
+    udp_head.sequence = ++vc->udp_sequence;
+    RoRnet::Header head;
+    head.command = type;
+    head.source = vc->uid;
+    head.streamid = streamid;
+    head.size = len;
+    memcpy(datagram, &udp_head, sizeof(RoRnet::UdpHeader));
+    memcpy(datagram + sizeof(RoRnet::UdpHeader), &head, sizeof(RoRnet::Header));
+    memcpy(datagram + sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header), payload, len);
+    const int datagram_len = (int) (sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header) + len);
+    if (send(vc->udp_socket, datagram, datagram_len, 0) != datagram_len) {
+        return false; // lost, as it could be on the way
+    }
+    vc->frames_sent++;
+    vc->bytes_sent += datagram_len;
+    return true;
+}
+
+/// Binds our UDP address to the connection: MSG2_HELLO datagrams until the server echoes one.
+static bool BindUdp(VirtualClient *vc, unsigned int port, uint64_t token) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *server = nullptr;
+    if (getaddrinfo(s_options.host.c_str(), std::to_string(port).c_str(), &hints, &server) != 0) {
+        Logger::Log(LOG_ERROR, "loadgen %d: cannot resolve %s for udp", vc->index, s_options.host.c_str());
+        return false;
+    }
+    vc->udp_socket = (int) socket(AF_INET, SOCK_DGRAM, 0);
+    bool connected = vc->udp_socket >= 0 && connect(vc->udp_socket, server->ai_addr, (int) server->ai_addrlen) == 0;
+    freeaddrinfo(server);
+    if (!connected) {
+        Logger::Log(LOG_ERROR, "loadgen %d: cannot create udp socket", vc->index);
+        return false;
+    }
+#ifdef _WIN32
+    DWORD timeout_ms = 200;
+    setsockopt(vc->udp_socket, SOL_SOCKET, SO_RCVTIMEO, (const char *) &timeout_ms, sizeof(timeout_ms));
+#else
+    struct timeval timeout = {0, 200000};
+    setsockopt(vc->udp_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif // _WIN32
+
+    vc->udp_token = token;
+    char reply[sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header) + RORNET_MAX_MESSAGE_LENGTH];
+    for (int attempt = 0; attempt < 10; attempt++) {
+        SendDatagram(vc, RoRnet::MSG2_HELLO, 0, 0, "");
+        int len = (int) recv(vc->udp_socket, reply, sizeof(reply), 0);
+        RoRnet::Header head;
+        if (len >= (int) (sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header))) {
+            memcpy(&head, reply + sizeof(RoRnet::UdpHeader), sizeof(RoRnet::Header));
+            if (head.command == RoRnet::MSG2_HELLO) {
+                return true;
+            }
+        }
+    }
+    Logger::Log(LOG_ERROR, "loadgen %d: server did not answer on udp port %u", vc->index, port);
+    return false;
+}
+
+/// HELLO -> ServerInfo -> UserInfo -> WELCOME, as the game does it.
+static bool Login(VirtualClient *vc) {
+    vc->transport->SetTimeout(10);
+
+    int type;
+    int source;
+    unsigned int streamid;
+    unsigned int len;
+    char buffer[RORNET_MAX_MESSAGE_LENGTH];
+
+    if (Messaging::SWSendMessage(vc->transport, RoRnet::MSG2_HELLO, 0, 0, (unsigned int) strlen(RORNET_VERSION) + 1,
+                                 RORNET_VERSION) ||
+        Messaging::SWReceiveMessage(vc->transport, &type, &source, &streamid, &len, buffer, RORNET_MAX_MESSAGE_LENGTH)) {
+        Logger::Log(LOG_ERROR, "loadgen %d: no response to hello", vc->index);
+        return false;
+    }
+    if (type != RoRnet::MSG2_HELLO) {
+        Logger::Log(LOG_ERROR, "loadgen %d: server rejected hello (message %d)", vc->index, type);
+        return false;
+    }
+
+    RoRnet::UserInfo user;
+    memset(&user, 0, sizeof(RoRnet::UserInfo));
+    snprintf(user.username, RORNET_MAX_USERNAME_LEN, "loadgen-%d", vc->index);
+    strncpy(user.serverpassword, s_options.password.c_str(), sizeof(user.serverpassword) - 1);
+    strncpy(user.language, "en-US", sizeof(user.language) - 1);
+    strncpy(user.clientname, "loadgen", sizeof(user.clientname) - 1);
+    strncpy(user.clientversion, RORNET_VERSION, sizeof(user.clientversion) - 1);
+    strncpy(user.sessiontype, "normal", sizeof(user.sessiontype) - 1);
+    if (!s_options.caps.empty()) {
+        snprintf(user.sessionoptions, sizeof(user.sessionoptions), "caps=%s", s_options.caps.c_str());
+    }
+
+    if (Messaging::SWSendMessage(vc->transport, RoRnet::MSG2_USER_INFO, 0, 0, sizeof(RoRnet::UserInfo), (char *) &user) ||
+        Messaging::SWReceiveMessage(vc->transport, &type, &source, &streamid, &len, buffer, RORNET_MAX_MESSAGE_LENGTH)) {
+        Logger::Log(LOG_ERROR, "loadgen %d: no response to user info", vc->index);
+        return false;
+    }
+    if (type != RoRnet::MSG2_WELCOME) {
+        Logger::Log(LOG_ERROR, "loadgen %d: server refused to join (message %d)", vc->index, type);
+        return false;
+    }
+
+    vc->uid = source;
+    if (!s_options.caps.empty()) {
+        const RoRnet::UserInfo *welcome = (const RoRnet::UserInfo *) buffer;
+        auto options = Utils::ParseSessionOptions(welcome->sessionoptions, sizeof(welcome->sessionoptions));
+        Logger::Log(LOG_VERBOSE, "loadgen %d: server accepted capabilities '%s'", vc->index, options["caps-ok"].c_str());
+        const uint32_t caps = Utils::ParseCapabilities(options["caps-ok"]);
+        vc->use_delta = (caps & RoRnet::CAP_DELTA) != 0;
+        if ((caps & RoRnet::CAP_COMPRESS) != 0) {
+            vc->compressor.reset(new StreamCompressor(1));
+            vc->decompressor.reset(new StreamDecompressor());
+        }
+        if ((caps & RoRnet::CAP_UDP) != 0 &&
+            !BindUdp(vc, (unsigned int) atoi(options["udp-port"].c_str()), strtoull(options["udp-token"].c_str(), nullptr, 16))) {
+            return false;
+        }
+    }
+
+    vc->transport->SetTimeout(0);
+    return true;
+}
+
+static bool Connect(VirtualClient *vc) {
+    if (!s_options.in_process) {
+        SWInetSocket *socket = new SWInetSocket();
+        vc->transport = new SocketTransport(socket);
+        SWBaseSocket::SWBaseError error;
+        if (!socket->connect(s_options.port, s_options.host, &error)) {
+            Logger::Log(LOG_ERROR, "loadgen %d: cannot connect: %s", vc->index, error.get_error().c_str());
+            return false;
+        }
+        return Login(vc);
+    }
+
+    // The server side of the handshake runs as it would in the listener thread
+    LoopbackTransport *client_side = nullptr;
+    LoopbackTransport *server_side = nullptr;
+    LoopbackTransport::CreatePair(client_side, server_side);
+    vc->transport = client_side;
+    std::thread listener_thread(&Listener::HandleConnection, &s_listener, server_side);
+    bool ok = Login(vc);
+    if (!ok) {
+        vc->transport->Disconnect(); // unblocks the listener side
+    }
+    listener_thread.join();
+    return ok;
+}
+
+static bool RegisterStreams(VirtualClient *vc) {
+    RoRnet::StreamRegister character;
+    memset(&character, 0, sizeof(RoRnet::StreamRegister));
+    character.type = LOADGEN_STREAM_CHARACTER;
+    character.origin_sourceid = vc->uid;
+    character.origin_streamid = LOADGEN_FIRST_STREAM_ID;
+    strncpy(character.name, "default", sizeof(character.name) - 1);
+    if (!SendFrame(vc, RoRnet::MSG2_STREAM_REGISTER, LOADGEN_FIRST_STREAM_ID, sizeof(RoRnet::StreamRegister),
+                     (char *) &character)) {
+        return false;
+    }
+
+    for (int i = 0; i < s_options.num_vehicles; i++) {
+        RoRnet::ActorStreamRegister actor;
+        memset(&actor, 0, sizeof(RoRnet::ActorStreamRegister));
+        actor.type = LOADGEN_STREAM_ACTOR;
+        actor.origin_sourceid = vc->uid;
+        actor.origin_streamid = LOADGEN_FIRST_STREAM_ID + 1 + i;
+        actor.bufferSize = s_options.frame_size;
+        strncpy(actor.name, "loadgen.truck", sizeof(actor.name) - 1);
+        if (!SendFrame(vc, RoRnet::MSG2_STREAM_REGISTER, actor.origin_streamid, sizeof(RoRnet::ActorStreamRegister),
+                         (char *) &actor)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Fills one vehicle frame like the game does: state, then the first node as floats
+/// and the remaining nodes as short offsets. Vehicles drive circles around the map.
+static unsigned int BuildVehicleFrame(char *buf, const VirtualClient *vc, int vehicle, uint64_t now_us) {
+    const float t = now_us / 1000000.f;
+    const float phase = (float) (vc->index * 7 + vehicle);
+
+    RoRnet::VehicleState *state = (RoRnet::VehicleState *) buf;
+    state->time = (int32_t) (now_us / 1000);
+    state->engine_speed = 1500.f + 1000.f * std::sin(t * 0.5f + phase);
+    state->engine_force = 0.5f + 0.5f * std::sin(t + phase);
+    state->engine_clutch = 1.f;
+    state->engine_gear = 1 + (int32_t) (t / 10.f + phase) % 5;
+    state->hydrodirstate = 0.3f * std::sin(t * 0.2f + phase);
+    state->brake = 0.f;
+    state->wheelspeed = 15.f + 5.f * std::sin(t * 0.1f + phase);
+    state->flagmask = RoRnet::NETMASK_ENGINE_CONT | RoRnet::NETMASK_ENGINE_RUN | RoRnet::NETMASK_ENGINE_MODE_AUTOMATIC;
+    if (((int) t + vehicle) % 20 < 2) {
+        state->flagmask |= RoRnet::NETMASK_HORN;
+    }
+
+    LoadgenStamp *stamp = (LoadgenStamp *) (buf + sizeof(RoRnet::VehicleState));
+    stamp->magic = LOADGEN_STAMP_MAGIC;
+    stamp->send_time_us = now_us;
+
+    char *nodes = buf + sizeof(RoRnet::VehicleState) + sizeof(LoadgenStamp);
+    const float radius = 100.f + 10.f * vehicle;
+    float *ref = (float *) nodes;
+    ref[0] = 1000.f + radius * std::cos(t * 0.1f + phase);
+    ref[1] = 50.f;
+    ref[2] = 1000.f + radius * std::sin(t * 0.1f + phase);
+
+    int16_t *offsets = (int16_t *) (nodes + 3 * sizeof(float));
+    for (int i = 0; i < (s_options.num_nodes - 1) * 3; i++) {
+        // small jitter around the rest pose, as a suspension would produce
+        offsets[i] = (int16_t) ((i * 37) % 2000 - 1000 + (int) (10.f * std::sin(t * 3.f + i)));
+    }
+
+    return (unsigned int) s_options.frame_size;
+}
+
+static void SendThreadMain(VirtualClient *vc) {
+    std::vector<char> buffer(std::max(s_options.frame_size, LOADGEN_CHARACTER_SIZE), 0);
+    const auto interval = std::chrono::microseconds(1000000 / s_options.rate_hz);
+    auto next_tick = std::chrono::steady_clock::now();
+
+    while (s_running && vc->connected) {
+        const uint64_t now_us = GetTimeMicros();
+
+        // character first, as the game does
+        float *character = (float *) buffer.data();
+        memset(buffer.data(), 0, LOADGEN_CHARACTER_SIZE);
+        character[0] = 1000.f + 5.f * std::cos(now_us / 1000000.f);
+        character[1] = 50.f;
+        character[2] = 1000.f + 5.f * std::sin(now_us / 1000000.f);
+        if (!SendFrame(vc, RoRnet::MSG2_STREAM_DATA, LOADGEN_FIRST_STREAM_ID, LOADGEN_CHARACTER_SIZE,
+                         buffer.data())) {
+            break;
+        }
+
+        for (int i = 0; i < s_options.num_vehicles; i++) {
+            unsigned int len = BuildVehicleFrame(buffer.data(), vc, i, now_us);
+            if (vc->udp_socket >= 0 && len <= UdpChannel::MAX_PAYLOAD) {
+                SendDatagram(vc, RoRnet::MSG2_STREAM_DATA_DISCARDABLE, LOADGEN_FIRST_STREAM_ID + 1 + i, len, buffer.data());
+                continue;
+            }
+            if (!SendFrame(vc, RoRnet::MSG2_STREAM_DATA, LOADGEN_FIRST_STREAM_ID + 1 + i, len, buffer.data())) {
+                vc->connected = false;
+                break;
+            }
+        }
+
+        next_tick += interval;
+        std::this_thread::sleep_until(next_tick);
+    }
+    vc->connected = false;
+}
+
+/// Returns false if the player got kicked.
+static bool HandleMessage(VirtualClient *vc, int type, int source, unsigned int streamid, unsigned int len,
+                          const char *data, uint64_t now_us) {
+    vc->frames_received++;
+
+    if (vc->use_delta) {
+        const auto key = std::make_pair(source, streamid);
+        if (type == RoRnet::MSG2_STREAM_DATA) {
+            vc->stream_refs[key].assign(data, data + len);
+        } else if (type == RoRnet::MSG2_STREAM_DATA_DELTA) {
+            auto found = vc->stream_refs.find(key);
+            if (found == vc->stream_refs.end() || !Messaging::ApplyDelta(found->second, data, len)) {
+                Logger::Log(LOG_ERROR, "loadgen %d: delta without matching frame from %d:%u", vc->index, source, streamid);
+                return false;
+            }
+            type = RoRnet::MSG2_STREAM_DATA;
+            data = found->second.data();
+            len = (unsigned int) found->second.size();
+        } else if (type == RoRnet::MSG2_STREAM_REGISTER) {
+            vc->stream_refs.erase(key);
+        }
+    }
+
+    if ((type == RoRnet::MSG2_STREAM_DATA || type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE) &&
+        len >= sizeof(RoRnet::VehicleState) + sizeof(LoadgenStamp)) {
+        const LoadgenStamp *stamp = (const LoadgenStamp *) (data + sizeof(RoRnet::VehicleState));
+        if (stamp->magic == LOADGEN_STAMP_MAGIC && stamp->send_time_us <= now_us) {
+            std::lock_guard<std::mutex> lock(vc->latency_mutex);
+            vc->latency_us.push_back((uint32_t) std::min<uint64_t>(now_us - stamp->send_time_us, UINT32_MAX));
+        }
+    } else if (type == RoRnet::MSG2_USER_LEAVE && source == vc->uid) {
+        Logger::Log(LOG_WARN, "loadgen %d: kicked by server: %s", vc->index, std::string(data, len).c_str());
+        return false;
+    }
+    return true;
+}
+
+/// Returns false if the player got kicked or the frame is malformed.
+static bool HandleFrame(VirtualClient *vc, int type, int source, unsigned int streamid, unsigned int len,
+                        const char *data, uint64_t now_us) {
+    if (type != RoRnet::MSG2_BUNDLE) {
+        return HandleMessage(vc, type, source, streamid, len, data, now_us);
+    }
+
+    bool kicked = false;
+    bool valid = Messaging::UnpackBundle(data, len,
+            [vc, now_us, &kicked](int sub_type, int sub_source, unsigned int sub_streamid, unsigned int sub_len,
+                                  const char *sub_data) {
+                kicked |= !HandleMessage(vc, sub_type, sub_source, sub_streamid, sub_len, sub_data, now_us);
+            });
+    if (!valid) {
+        Logger::Log(LOG_ERROR, "loadgen %d: malformed bundle from server", vc->index);
+    }
+    return valid && !kicked;
+}
+
+/// Processes the frames of the decompressed stream which are complete by now.
+static bool HandleInflated(VirtualClient *vc, uint64_t now_us) {
+    size_t pos = 0;
+    while (vc->inflated.size() - pos >= sizeof(RoRnet::Header)) {
+        RoRnet::Header head;
+        memcpy(&head, vc->inflated.data() + pos, sizeof(RoRnet::Header));
+        if (head.size > RORNET_MAX_MESSAGE_LENGTH) {
+            Logger::Log(LOG_ERROR, "loadgen %d: malformed compressed data from server", vc->index);
+            return false;
+        }
+        if (vc->inflated.size() - pos < sizeof(RoRnet::Header) + head.size) {
+            break;
+        }
+        if (!HandleFrame(vc, head.command, head.source, head.streamid, head.size,
+                         vc->inflated.data() + pos + sizeof(RoRnet::Header), now_us)) {
+            return false;
+        }
+        pos += sizeof(RoRnet::Header) + head.size;
+    }
+    vc->inflated.erase(vc->inflated.begin(), vc->inflated.begin() + pos);
+    return true;
+}
+
+static void RecvThreadMain(VirtualClient *vc) {
+    int type;
+    int source;
+    unsigned int streamid;
+    unsigned int len;
+    char buffer[RORNET_MAX_MESSAGE_LENGTH];
+
+    while (s_running) {
+        if (Messaging::SWReceiveMessage(vc->transport, &type, &source, &streamid, &len, buffer,
+                                        RORNET_MAX_MESSAGE_LENGTH)) {
+            break;
+        }
+        const uint64_t now_us = GetTimeMicros();
+        vc->bytes_received += sizeof(RoRnet::Header) + len;
+
+        if (type == RoRnet::MSG2_COMPRESSED && vc->decompressor != nullptr) {
+            if (!vc->decompressor->Decompress(buffer, len, vc->inflated) || !HandleInflated(vc, now_us)) {
+                break;
+            }
+        } else if (!HandleFrame(vc, type, source, streamid, len, buffer, now_us)) {
+            break;
+        }
+    }
+    vc->connected = false;
+}
+
+/// Discardable stream data from the server, dropping datagrams which got overtaken.
+static void UdpThreadMain(VirtualClient *vc) {
+    char buffer[sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header) + RORNET_MAX_MESSAGE_LENGTH];
+    const size_t header_len = sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header);
+    std::map<std::pair<int, unsigned int>, uint32_t> newest; //!< Sequence by source and stream
+
+    while (s_running && vc->connected) {
+        int len = (int) recv(vc->udp_socket, buffer, sizeof(buffer), 0);
+        if (len < (int) header_len) {
+            continue; // timeout
+        }
+        RoRnet::UdpHeader udp_head;
+        RoRnet::Header head;
+        memcpy(&udp_head, buffer, sizeof(RoRnet::UdpHeader));
+        memcpy(&head, buffer + sizeof(RoRnet::UdpHeader), sizeof(RoRnet::Header));
+        if (udp_head.token != vc->udp_token || head.size != len - header_len ||
+            head.command != RoRnet::MSG2_STREAM_DATA_DISCARDABLE) {
+            continue;
+        }
+        auto key = std::make_pair(head.source, head.streamid);
+        auto found = newest.find(key);
+        if (found != newest.end() && (int32_t) (udp_head.sequence - found->second) <= 0) {
+            continue;
+        }
+        newest[key] = udp_head.sequence;
+        vc->bytes_received += len;
+        HandleMessage(vc, head.command, head.source, head.streamid, head.size, buffer + header_len, GetTimeMicros());
+    }
+}
+
+static uint32_t Percentile(const std::vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t pos = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[pos];
+}
+
+int main(int argc, char *argv[]) {
+    Logger::SetLogLevel(LOGTYPE_DISPLAY, LOG_INFO);
+
+    for (int pos = 1; pos < argc; ++pos) {
+        std::string arg = argv[pos];
+        bool has_value = (pos + 1 < argc);
+        if (arg == "-host" && has_value) {
+            s_options.host = argv[++pos];
+        } else if (arg == "-port" && has_value) {
+            s_options.port = atoi(argv[++pos]);
+        } else if (arg == "-password" && has_value) {
+            s_options.password = argv[++pos];
+        } else if (arg == "-clients" && has_value) {
+            s_options.num_clients = atoi(argv[++pos]);
+        } else if (arg == "-vehicles" && has_value) {
+            s_options.num_vehicles = atoi(argv[++pos]);
+        } else if (arg == "-rate" && has_value) {
+            s_options.rate_hz = atoi(argv[++pos]);
+        } else if (arg == "-size" && has_value) {
+            s_options.frame_size = atoi(argv[++pos]);
+        } else if (arg == "-duration" && has_value) {
+            s_options.duration_sec = atoi(argv[++pos]);
+        } else if (arg == "-ramp" && has_value) {
+            s_options.ramp_ms = atoi(argv[++pos]);
+        } else if (arg == "-in-process") {
+            s_options.in_process = true;
+        } else if (arg == "-caps" && has_value) {
+            s_options.caps = argv[++pos];
+        } else if (arg == "-verbosity" && has_value) {
+            Logger::SetLogLevel(LOGTYPE_DISPLAY, (LogLevel) atoi(argv[++pos]));
+        } else if (arg == "-help" || arg == "-h") {
+            ShowHelp();
+            return 0;
+        } else {
+            fprintf(stderr, "Unrecognized argument `%s`\n", arg.c_str());
+            return -1;
+        }
+    }
+
+    // A frame must hold the state, the stamp and at least one reference node
+    const int min_size = (int) (sizeof(RoRnet::VehicleState) + sizeof(LoadgenStamp) + 3 * sizeof(float));
+    if (s_options.num_clients < 1 || s_options.num_vehicles < 0 || s_options.rate_hz < 1 ||
+        s_options.frame_size < min_size || s_options.frame_size > RORNET_MAX_MESSAGE_LENGTH) {
+        fprintf(stderr, "Invalid options, the update size must be between %d and %d bytes\n", min_size,
+                RORNET_MAX_MESSAGE_LENGTH);
+        return -1;
+    }
+    s_options.num_nodes = 1 + (s_options.frame_size - min_size) / (int) (3 * sizeof(int16_t));
+
+    if (s_options.in_process) {
+        // Room for everybody and no persistent side effects
+        if (!Config::setMaxClients((unsigned int) std::max(2, s_options.num_clients))) {
+            fprintf(stderr, "At most %d players are possible with -in-process\n", RORNET_MAX_PEERS);
+            return -1;
+        }
+        Config::setMaxVehicles((unsigned int) std::max(1, s_options.num_vehicles));
+        Config::setServerMode(SERVER_LAN);
+        Config::setBlacklistFile("");
+        Config::setMOTDFile("");
+        s_sequencer.Initialize();
+    }
+
+    s_start_time = std::chrono::steady_clock::now();
+    std::vector<VirtualClient *> clients;
+    int num_failed = 0;
+    for (int i = 0; i < s_options.num_clients; i++) {
+        VirtualClient *vc = new VirtualClient();
+        vc->index = i;
+        clients.push_back(vc);
+        if (!Connect(vc) || !RegisterStreams(vc)) {
+            num_failed++;
+            continue;
+        }
+        vc->connected = true;
+        vc->recv_thread = std::thread(RecvThreadMain, vc);
+        vc->send_thread = std::thread(SendThreadMain, vc);
+        if (vc->udp_socket >= 0) {
+            vc->udp_thread = std::thread(UdpThreadMain, vc);
+        }
+        Logger::Log(LOG_VERBOSE, "loadgen %d: joined as uid %d", i, vc->uid);
+        std::this_thread::sleep_for(std::chrono::milliseconds(s_options.ramp_ms));
+    }
+    const int num_joined = s_options.num_clients - num_failed;
+    Logger::Log(LOG_INFO, "loadgen: %d of %d players joined, driving for %d seconds", num_joined,
+                s_options.num_clients, s_options.duration_sec);
+
+    // measure only the steady state, after everyone joined
+    uint64_t received_at_start = 0;
+    for (VirtualClient *vc : clients) {
+        received_at_start += vc->bytes_received;
+        std::lock_guard<std::mutex> lock(vc->latency_mutex);
+        vc->latency_us.clear();
+    }
+    const auto measure_start = std::chrono::steady_clock::now();
+    for (int sec = 0; sec < s_options.duration_sec; sec++) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        int num_connected = 0;
+        for (VirtualClient *vc : clients) {
+            num_connected += vc->connected ? 1 : 0;
+        }
+        Logger::Log(LOG_DEBUG, "loadgen: %d s, %d players connected", sec + 1, num_connected);
+    }
+    const double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - measure_start).count();
+
+    s_running = false;
+    uint64_t frames_sent = 0, bytes_sent = 0, frames_received = 0, bytes_received = 0;
+    int num_dropped = 0;
+    std::vector<uint32_t> latencies;
+    for (VirtualClient *vc : clients) {
+        if (vc->send_thread.joinable()) {
+            num_dropped += vc->connected ? 0 : 1;
+            vc->send_thread.join();
+            SendFrame(vc, RoRnet::MSG2_USER_LEAVE, 0, 0, "");
+            vc->transport->Disconnect();
+            vc->recv_thread.join();
+        }
+        if (vc->udp_thread.joinable()) {
+            vc->udp_thread.join();
+        }
+        frames_sent += vc->frames_sent;
+        bytes_sent += vc->bytes_sent;
+        frames_received += vc->frames_received;
+        bytes_received += vc->bytes_received;
+        latencies.insert(latencies.end(), vc->latency_us.begin(), vc->latency_us.end());
+        delete vc;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    uint64_t latency_sum = 0;
+    for (uint32_t l : latencies) {
+        latency_sum += l;
+    }
+
+    // machine-readable summary
+    printf("clients=%d\n", s_options.num_clients);
+    printf("clients_joined=%d\n", num_joined);
+    printf("clients_dropped=%d\n", num_dropped);
+    printf("vehicles_per_client=%d\n", s_options.num_vehicles);
+    printf("rate_hz=%d\n", s_options.rate_hz);
+    printf("frame_size=%d\n", s_options.frame_size);
+    printf("duration_sec=%.3f\n", duration);
+    printf("frames_sent=%llu\n", (unsigned long long) frames_sent);
+    printf("bytes_sent=%llu\n", (unsigned long long) bytes_sent);
+    printf("frames_received=%llu\n", (unsigned long long) frames_received);
+    printf("bytes_received=%llu\n", (unsigned long long) bytes_received);
+    printf("receive_kbytes_per_sec=%.1f\n", (bytes_received - received_at_start) / 1024.0 / duration);
+    printf("latency_samples=%zu\n", latencies.size());
+    printf("latency_avg_us=%.0f\n", latencies.empty() ? 0.0 : (double) latency_sum / latencies.size());
+    printf("latency_p50_us=%u\n", Percentile(latencies, 0.50));
+    printf("latency_p95_us=%u\n", Percentile(latencies, 0.95));
+    printf("latency_p99_us=%u\n", Percentile(latencies, 0.99));
+    printf("latency_max_us=%u\n", latencies.empty() ? 0 : latencies.back());
+
+    if (s_options.in_process) {
+        s_sequencer.Close();
+    }
+    return (num_joined > 0) ? 0 : -1;
+}
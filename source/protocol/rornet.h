@@ -66,6 +66,11 @@ enum MessageType
 
     MSG2_NO_RANK,                      //!< client has no ranked status
 
+    // Protocol extensions, only used if negotiated (see Capability)
+    MSG2_BUNDLE,                       //!< several messages in one frame, each preceded by a BundleHeader
+    MSG2_COMPRESSED,                   //!< piece of the zstd stream of this connection, decompresses to frames
+    MSG2_STREAM_DATA_DELTA,            //!< stream data as DeltaRuns against the previous frame of the stream received over TCP
+
     // Legacy values (RoRnet_2.38 and earlier)
     MSG2_WRONG_VER_LEGACY = 1003,      //!< Wrong version
 
@@ -82,6 +87,19 @@ enum UserAuth
     AUTH_BANNED = BITMASK(5)           //!< banned
 };
 
+/// Optional protocol extensions, negotiated per connection. The client lists the ones it
+/// supports as `caps=<name>+<name>` in UserInfo::sessionoptions and the server answers with
+/// the accepted ones as `caps-ok=<name>+<name>` in the sessionoptions of MSG2_WELCOME.
+/// Without `caps-ok` (older servers echo the options unchanged) only the classic protocol is used.
+enum Capability
+{
+    CAP_NONE    = 0,
+    CAP_BUNDLE  = BITMASK(1),          //!< "bundle": server may pack messages into MSG2_BUNDLE
+    CAP_COMPRESS = BITMASK(2),         //!< "zstd": both sides may send MSG2_COMPRESSED
+    CAP_DELTA   = BITMASK(3),          //!< "delta": server may send MSG2_STREAM_DATA_DELTA
+    CAP_UDP     = BITMASK(4)           //!< "udp": MSG2_STREAM_DATA_DISCARDABLE may travel as UdpHeader datagrams, these never become a delta reference
+};
+
 enum Netmask
 {
     NETMASK_HORN         = BITMASK(1),  //!< horn is in use
@@ -131,6 +149,26 @@ struct Header                      //!< Common header for every packet
     uint32_t size;                 //!< size of the attached data block
 };
 
+struct BundleHeader                //!< Compact header of a message inside MSG2_BUNDLE
+{
+    uint16_t command;              //!< the command of this message: MSG2_*
+    uint16_t streamid;             //!< streamid for this message
+    int32_t  source;               //!< source of this message
+    uint16_t size;                 //!< size of the attached data block
+};
+
+struct DeltaRun                    //!< Inside MSG2_STREAM_DATA_DELTA, followed by `length` bytes to XOR into the previous frame (TCP only, see CAP_UDP)
+{
+    uint16_t skip;                 //!< unchanged bytes since the end of the previous run
+    uint16_t length;               //!< changed bytes
+};
+
+struct UdpHeader                   //!< Starts every datagram of the UDP channel, followed by one Header and its data
+{
+    uint64_t token;                //!< from `udp-token` in MSG2_WELCOME, identifies the connection
+    uint32_t sequence;             //!< counts up per direction; older datagrams of a stream are dropped
+};
+
 struct StreamRegister              //!< Sent from the client to server and vice versa, to broadcast a new stream
 {
     int32_t type;                  //!< stream type
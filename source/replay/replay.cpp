@@ -0,0 +1,291 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   replay.cpp
+/// @brief  Feeds capture files (see capture.h) back into an in-process relay.
+///
+/// Every captured client gets an in-memory connection to a local Sequencer, one per
+/// recorded session; its frames are written to that connection at the recorded pace
+/// (scaled by `-speed`) and whatever the relay sends back is drained and counted.
+
+#include "capture.h"
+#include "config.h"
+#include "logger.h"
+#include "messaging.h"
+#include "rornet.h"
+#include "sequencer.h"
+#include "transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// The client side of one replayed connection.
+struct ReplayPeer {
+    unsigned int          session = 0;
+    int                   captured_uid = 0;
+    Transport            *transport = nullptr;   //!< Client end of the connection
+    std::thread           drain_thread;
+    std::atomic<uint64_t> messages_received;
+    std::atomic<uint64_t> bytes_received;
+
+    ReplayPeer() : messages_received(0), bytes_received(0) {}
+};
+
+typedef std::pair<unsigned int, int> PeerKey;     //!< Session, captured uid
+
+static std::map<unsigned int, Sequencer*> s_sessions; //!< By SessionConfig::index, created on first use
+static std::map<PeerKey, ReplayPeer*>     s_live_peers;
+static std::set<PeerKey>                  s_rejected_peers;  //!< Their frames are skipped until they leave
+static std::vector<ReplayPeer*>           s_all_peers;
+
+static void ShowHelp() {
+    printf(
+            "Usage: rorreplay [OPTIONS] <capture file> [<capture file> ...]\n"
+                    "Replays captures recorded with `-capture-file` against a local relay.\n"
+                    "\n"
+                    " -speed <factor>              Playback speed, 1 = original pace, 0 = as fast as possible\n"
+                    " -script-file <script.as>     Server script to run during the replay\n"
+                    " -verbosity {0-5}             Sets displayed log verbosity (defaults to 4 = warn)\n"
+                    " -help                        Show this list\n");
+}
+
+static void DrainThreadMain(ReplayPeer *peer) {
+    RoRnet::Header head;
+    char payload[RORNET_MAX_MESSAGE_LENGTH];
+    while (true) {
+        if (!peer->transport->RecvAll((char *) &head, (int) sizeof(RoRnet::Header))) {
+            break;
+        }
+        if (head.size > RORNET_MAX_MESSAGE_LENGTH) {
+            Logger::Log(LOG_ERROR, "rorreplay: relay sent oversized message to replayed uid %d (session %u)",
+                        peer->captured_uid, peer->session);
+            break;
+        }
+        if (head.size > 0 && !peer->transport->RecvAll(payload, (int) head.size)) {
+            break;
+        }
+        peer->messages_received++;
+        peer->bytes_received += sizeof(RoRnet::Header) + head.size;
+    }
+}
+
+/// Recorded sessions are replayed into relays of their own, like the server hosted them
+static Sequencer *GetSession(unsigned int index) {
+    Sequencer *&session = s_sessions[index];
+    if (session == nullptr) {
+        SessionConfig config = Config::getDefaultSession();
+        if (index != 0) {
+            config.id = "session-" + std::to_string(index);
+            config.index = index;
+        }
+        session = new Sequencer();
+        session->Initialize(config);
+    }
+    return session;
+}
+
+/// @return nullptr if the relay rejected the client.
+static ReplayPeer *ConnectPeer(unsigned int session, int captured_uid, RoRnet::UserInfo user) {
+    LoopbackTransport *client_side = nullptr;
+    LoopbackTransport *server_side = nullptr;
+    LoopbackTransport::CreatePair(client_side, server_side);
+
+    // Never report replayed users to the serverlist
+    user.authstatus &= ~RoRnet::AUTH_RANKED;
+    try {
+        GetSession(session)->createClient(server_side, user);
+    } catch (std::runtime_error &e) {
+        Logger::Log(LOG_WARN, "rorreplay: replayed uid %d (session %u) rejected: %s", captured_uid, session, e.what());
+        delete server_side;
+        delete client_side;
+        s_rejected_peers.insert(PeerKey(session, captured_uid));
+        return nullptr;
+    }
+
+    ReplayPeer *peer = new ReplayPeer();
+    peer->session = session;
+    peer->captured_uid = captured_uid;
+    peer->transport = client_side;
+    peer->drain_thread = std::thread(DrainThreadMain, peer);
+    s_live_peers[PeerKey(session, captured_uid)] = peer;
+    s_all_peers.push_back(peer);
+    return peer;
+}
+
+/// For clients that joined before the capture was started, or whose join didn't fit into the segment.
+static RoRnet::UserInfo MakeSyntheticUser(int captured_uid) {
+    RoRnet::UserInfo user;
+    memset(&user, 0, sizeof(RoRnet::UserInfo));
+    snprintf(user.username, RORNET_MAX_USERNAME_LEN, "replay-%d", captured_uid);
+    strncpy(user.language, "en-US", sizeof(user.language) - 1);
+    strncpy(user.clientname, "rorreplay", sizeof(user.clientname) - 1);
+    strncpy(user.clientversion, RORNET_VERSION, sizeof(user.clientversion) - 1);
+    return user;
+}
+
+static bool SendFrame(ReplayPeer *peer, const RoRnet::Header &head, const char *payload) {
+    char buffer[sizeof(RoRnet::Header) + RORNET_MAX_MESSAGE_LENGTH];
+    memcpy(buffer, &head, sizeof(RoRnet::Header));
+    memcpy(buffer + sizeof(RoRnet::Header), payload, head.size);
+    const int len = (int) (sizeof(RoRnet::Header) + head.size);
+    return peer->transport->SendAll(buffer, len);
+}
+
+int main(int argc, char *argv[]) {
+    Logger::SetLogLevel(LOGTYPE_DISPLAY, LOG_WARN);
+
+    double speed = 1.0;
+    std::vector<std::string> files;
+    for (int pos = 1; pos < argc; ++pos) {
+        std::string arg = argv[pos];
+        bool has_value = (pos + 1 < argc);
+        if (arg == "-speed" && has_value) {
+            speed = atof(argv[++pos]);
+        } else if (arg == "-script-file" && has_value) {
+            Config::setScriptName(argv[++pos]);
+        } else if (arg == "-verbosity" && has_value) {
+            Logger::SetLogLevel(LOGTYPE_DISPLAY, (LogLevel) atoi(argv[++pos]));
+        } else if (arg == "-help" || arg == "-h") {
+            ShowHelp();
+            return 0;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "Unrecognized argument `%s`\n", arg.c_str());
+            return -1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.empty()) {
+        ShowHelp();
+        return -1;
+    }
+
+    // The replayed relay runs with maximum room and without persistent side effects
+    Config::setMaxClients(RORNET_MAX_PEERS);
+    Config::setServerMode(SERVER_LAN);
+    Config::setBlacklistFile("");
+    Config::setMOTDFile("");
+
+    CaptureRecordHeader rec;
+    char payload[RORNET_MAX_MESSAGE_LENGTH];
+    uint64_t num_records = 0;
+    bool have_base_time = false;
+    uint64_t base_time_us = 0;
+    const auto start_time = std::chrono::steady_clock::now();
+
+    for (const std::string &filename : files) {
+        CaptureReader reader;
+        if (!reader.Open(filename)) {
+            continue;
+        }
+
+        while (reader.ReadNext(rec, payload, RORNET_MAX_MESSAGE_LENGTH)) {
+            if (!have_base_time) {
+                base_time_us = rec.timestamp_us;
+                have_base_time = true;
+            }
+            if (speed > 0 && rec.timestamp_us > base_time_us) {
+                auto offset = std::chrono::microseconds((int64_t) ((rec.timestamp_us - base_time_us) / speed));
+                std::this_thread::sleep_until(start_time + offset);
+            }
+            ++num_records;
+
+            const PeerKey key(rec.session, rec.uid);
+            auto found = s_live_peers.find(key);
+            ReplayPeer *peer = (found != s_live_peers.end()) ? found->second : nullptr;
+
+            if (rec.header.command == RoRnet::MSG2_USER_INFO) {
+                // Recorded join, or repeated at the start of a segment for a client we already know
+                if (peer == nullptr && s_rejected_peers.count(key) == 0) {
+                    RoRnet::UserInfo user;
+                    memset(&user, 0, sizeof(RoRnet::UserInfo));
+                    memcpy(&user, payload, std::min((size_t) rec.header.size, sizeof(RoRnet::UserInfo)));
+                    ConnectPeer(rec.session, rec.uid, user);
+                }
+                continue;
+            }
+
+            if (peer == nullptr) {
+                if (rec.header.command == RoRnet::MSG2_USER_LEAVE) {
+                    s_rejected_peers.erase(key);
+                    continue; // Already gone
+                }
+                if (s_rejected_peers.count(key) != 0) {
+                    continue;
+                }
+                peer = ConnectPeer(rec.session, rec.uid, MakeSyntheticUser(rec.uid));
+                if (peer == nullptr) {
+                    continue;
+                }
+            }
+
+            if (!SendFrame(peer, rec.header, payload) || rec.header.command == RoRnet::MSG2_USER_LEAVE) {
+                // The relay closes the connection on its own, the drain thread notices
+                s_live_peers.erase(key);
+            }
+        }
+    }
+
+    // Let the broadcasters flush what is still queued
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    const size_t num_clients = s_all_peers.size();
+    uint64_t messages_out = 0;
+    uint64_t bytes_out = 0;
+    for (ReplayPeer *peer : s_all_peers) {
+        peer->transport->Disconnect();
+        peer->drain_thread.join();
+        messages_out += peer->messages_received;
+        bytes_out += peer->bytes_received;
+        delete peer->transport;
+        delete peer;
+    }
+    s_all_peers.clear();
+    s_live_peers.clear();
+
+    // machine-readable summary
+    stream_traffic_t traffic = Messaging::GetTrafficStats();
+    printf("records=%llu\n", (unsigned long long) num_records);
+    printf("clients=%zu\n", num_clients);
+    printf("sessions=%zu\n", s_sessions.size());
+    printf("speed=%.2f\n", speed);
+    printf("duration_sec=%.3f\n", duration);
+    printf("relay_bytes_in=%.0f\n", traffic.bandwidthIncoming);
+    printf("relay_bytes_out=%.0f\n", traffic.bandwidthOutgoing);
+    printf("relay_bytes_dropped=%.0f\n", traffic.bandwidthDropOutgoing);
+    printf("received_messages=%llu\n", (unsigned long long) messages_out);
+    printf("received_bytes=%llu\n", (unsigned long long) bytes_out);
+
+    for (auto &session : s_sessions) {
+        session.second->Close();
+    }
+    return 0;
+}
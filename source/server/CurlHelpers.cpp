@@ -23,76 +23,191 @@
 
 #include "CurlHelpers.h"
 #include "ScriptEngine.h"
+#include "config.h"
+#include "logger.h"
 
 #include <curl/curl.h>
 #include <curl/easy.h>
 
+#include <algorithm>
 #include <string>
 
-static size_t CurlStringWriteFunc(void *ptr, size_t size, size_t nmemb, std::string* data)
+// Defined here too, PROGRESS_INTERVAL_MS is passed by reference (std::chrono)
+const size_t CurlPool::MAX_TRANSFERS;
+const size_t CurlPool::MAX_WAITING;
+const int    CurlPool::PROGRESS_INTERVAL_MS;
+
+static const int IDLE_POLL_MS = 60 * 1000; // curl_multi_wakeup() interrupts it when a request comes in
+
+CurlPool::CurlPool(ScriptEngine* script_engine)
+    : m_script_engine(script_engine)
 {
-    data->append((char*)ptr, size * nmemb);
-    return size * nmemb;
+    m_multi = curl_multi_init();
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)MAX_TRANSFERS);
+    m_thread = std::thread(&CurlPool::ThreadMain, this);
+}
+
+CurlPool::~CurlPool()
+{
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_mutex);
+        m_stop = true;
+    }
+    curl_multi_wakeup(m_multi);
+    m_thread.join();
+
+    for (auto& entry : m_transfers)
+    {
+        curl_multi_remove_handle(m_multi, entry.first);
+        curl_easy_cleanup(entry.first);
+    }
+    m_transfers.clear();
+    curl_multi_cleanup(m_multi);
 }
 
-static size_t CurlXferInfoFunc(void* ptr, curl_off_t filesize_B, curl_off_t downloaded_B, curl_off_t uploadsize_B, curl_off_t uploaded_B)
+void CurlPool::Request(const std::string& url, const std::string& displayname)
 {
-    CurlTaskContext* context = (CurlTaskContext*)ptr;
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_mutex);
+        if (m_waiting.size() < MAX_WAITING)
+        {
+            m_waiting.push_back(Waiting{url, displayname});
+            curl_multi_wakeup(m_multi);
+            return;
+        }
+    }
+    Logger::Log(LOG_WARN, "CurlPool: %zu requests are waiting already, failing '%s'", MAX_WAITING, displayname.c_str());
+    m_script_engine->QueueCurlStatus(CURL_STATUS_FAILURE, (int)CURLE_FAILED_INIT, 0, displayname, "Too many requests waiting");
+}
 
-    context->ctc_script_engine->curlStatus(
-        CURL_STATUS_PROGRESS, (int)downloaded_B, (int)filesize_B, context->ctc_displayname, "");
+size_t CurlPool::WriteFunc(void* ptr, size_t size, size_t nmemb, Transfer* transfer)
+{
+    transfer->payload.append((char*)ptr, size * nmemb);
+    return size * nmemb;
+}
+
+int CurlPool::XferInfoFunc(void* ptr, curl_off_t filesize_B, curl_off_t downloaded_B, curl_off_t uploadsize_B, curl_off_t uploaded_B)
+{
+    // Called many times a second; ReportProgress() passes on the latest numbers now and then
+    Transfer* transfer = (Transfer*)ptr;
+    if (downloaded_B != transfer->downloaded_B || filesize_B != transfer->filesize_B)
+    {
+        transfer->downloaded_B = downloaded_B;
+        transfer->filesize_B = filesize_B;
+        transfer->progress_pending = true;
+    }
 
     // If you don't return 0, the transfer will be aborted - see the documentation
     return 0;
 }
 
-bool GetUrlAsString(const std::string& url, CURLcode& curl_result, long& response_code, std::string& response_payload)
+void CurlPool::ThreadMain()
+{
+    while (true)
+    {
+        std::deque<Waiting> starting;
+        {
+            std::lock_guard<std::mutex> scoped_lock(m_mutex);
+            if (m_stop)
+                break;
+            while (!m_waiting.empty() && m_transfers.size() + starting.size() < MAX_TRANSFERS)
+            {
+                starting.push_back(std::move(m_waiting.front()));
+                m_waiting.pop_front();
+            }
+        }
+        for (const Waiting& request : starting)
+        {
+            this->StartTransfer(request);
+        }
+
+        int running = 0;
+        curl_multi_perform(m_multi, &running);
+
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(m_multi, &queued))
+        {
+            if (msg->msg == CURLMSG_DONE)
+                this->FinishTransfer(msg->easy_handle, msg->data.result);
+        }
+
+        this->ReportProgress(std::chrono::steady_clock::now());
+
+        // until there's network activity, a new request or progress to report
+        curl_multi_poll(m_multi, nullptr, 0, m_transfers.empty() ? IDLE_POLL_MS : PROGRESS_INTERVAL_MS, nullptr);
+    }
+}
+
+void CurlPool::StartTransfer(const Waiting& request)
 {
-    std::string response_header;
-    std::string user_agent = "Rigs of Rods Server";
+    std::unique_ptr<Transfer> transfer(new Transfer());
+    transfer->displayname = request.displayname;
+    transfer->error[0] = '\0';
+    transfer->next_progress = std::chrono::steady_clock::now() + std::chrono::milliseconds(PROGRESS_INTERVAL_MS);
 
     CURL *curl = curl_easy_init();
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
     curl_easy_setopt(curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4);
 #ifdef _WIN32
     curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS, CURLSSLOPT_NATIVE_CA);
 #endif // _WIN32
     curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "gzip");
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, user_agent.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlStringWriteFunc);
-    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, CurlXferInfoFunc);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_payload);
-    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &response_header);
-
-    curl_result = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-
-    curl_easy_cleanup(curl);
-    curl = nullptr;
-
-    if (curl_result != CURLE_OK || response_code != 200)
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "Rigs of Rods Server");
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteFunc);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get());
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, XferInfoFunc);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, transfer.get());
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, transfer->error);
+    const long timeout_sec = Config::getScriptHttpTimeoutSec();
+    if (timeout_sec > 0)
     {
-        return false;
+        // Runs out as CURLE_OPERATION_TIMEDOUT, which FinishTransfer() reports as CURL_STATUS_FAILURE
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, std::min(timeout_sec, (long)CONNECT_TIMEOUT_SEC));
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout_sec);
     }
 
-    return true;
+    m_script_engine->QueueCurlStatus(CURL_STATUS_START, 0, 0, transfer->displayname, "");
+    curl_multi_add_handle(m_multi, curl);
+    m_transfers[curl] = std::move(transfer);
 }
 
-bool CurlRequestThreadFunc(CurlTaskContext context)
+void CurlPool::FinishTransfer(CURL* curl, CURLcode curl_result)
 {
-    context.ctc_script_engine->curlStatus(CURL_STATUS_START, 0, 0, context.ctc_displayname, "");
-    std::string data;
-    CURLcode curl_result = CURLE_OK;
+    std::map<CURL*, std::unique_ptr<Transfer>>::iterator it = m_transfers.find(curl);
+    if (it == m_transfers.end())
+        return;
+    Transfer& transfer = *it->second;
+
     long http_response = 0;
-    if (GetUrlAsString(context.ctc_url, /*out:*/curl_result, /*out:*/http_response, /*out:*/data))
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response);
+    if (curl_result == CURLE_OK && http_response == 200)
     {
-        context.ctc_script_engine->curlStatus(CURL_STATUS_SUCCESS, (int)curl_result, (int)http_response, context.ctc_displayname, data);
-        return true;
+        m_script_engine->QueueCurlStatus(CURL_STATUS_SUCCESS, (int)curl_result, (int)http_response, transfer.displayname, transfer.payload);
     }
     else
     {
-        context.ctc_script_engine->curlStatus(CURL_STATUS_FAILURE, (int)curl_result, (int)http_response, context.ctc_displayname, curl_easy_strerror(curl_result));
-        return false;
+        std::string error = (transfer.error[0] != '\0') ? transfer.error : curl_easy_strerror(curl_result);
+        m_script_engine->QueueCurlStatus(CURL_STATUS_FAILURE, (int)curl_result, (int)http_response, transfer.displayname, error);
+    }
+
+    curl_multi_remove_handle(m_multi, curl);
+    curl_easy_cleanup(curl);
+    m_transfers.erase(it);
+}
+
+void CurlPool::ReportProgress(std::chrono::steady_clock::time_point now)
+{
+    for (auto& entry : m_transfers)
+    {
+        Transfer& transfer = *entry.second;
+        if (!transfer.progress_pending || now < transfer.next_progress)
+            continue;
+
+        m_script_engine->QueueCurlStatus(CURL_STATUS_PROGRESS, (int)transfer.downloaded_B, (int)transfer.filesize_B, transfer.displayname, "");
+        transfer.progress_pending = false;
+        transfer.next_progress = now + std::chrono::milliseconds(PROGRESS_INTERVAL_MS);
     }
 }
 
@@ -37,21 +37,63 @@ class ScriptEngine;
 #include <curl/curl.h>
 #include <curl/easy.h>
 
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
-
-struct CurlTaskContext
+/// Runs the script's HTTP requests on one background thread, through a curl multi handle which keeps
+/// connections open for the next request. Status is reported via server callback `curlStatus()`,
+/// queued to the script thread.
+class CurlPool
 {
-    std::string ctc_displayname;
-    std::string ctc_url;
-    ScriptEngine* ctc_script_engine;
-    // Status is reported via new server callback `curlStatus()`
+public:
+    static const size_t MAX_TRANSFERS = 4;         //!< At once; further requests wait their turn
+    static const size_t MAX_WAITING = 100;         //!< Further requests fail right away
+    static const int    PROGRESS_INTERVAL_MS = 500; //!< At most one CURL_STATUS_PROGRESS per transfer this often
+    static const int    CONNECT_TIMEOUT_SEC = 10;   //!< Connecting may take this long of `script-http-timeout`
+
+    explicit CurlPool(ScriptEngine* script_engine);
+    ~CurlPool(); //!< Aborts the transfers in progress
+
+    void Request(const std::string& url, const std::string& displayname); //!< Callable from any thread
+
+private:
+    struct Waiting
+    {
+        std::string url;
+        std::string displayname;
+    };
+
+    struct Transfer
+    {
+        std::string displayname;
+        std::string payload;
+        char        error[CURL_ERROR_SIZE];
+        curl_off_t  downloaded_B = 0;
+        curl_off_t  filesize_B = 0;
+        bool        progress_pending = false; //!< Not yet reported
+        std::chrono::steady_clock::time_point next_progress;
+    };
+
+    static size_t WriteFunc(void* ptr, size_t size, size_t nmemb, Transfer* transfer);
+    static int    XferInfoFunc(void* ptr, curl_off_t filesize_B, curl_off_t downloaded_B, curl_off_t uploadsize_B, curl_off_t uploaded_B);
+
+    void ThreadMain();
+    void StartTransfer(const Waiting& request);
+    void FinishTransfer(CURL* curl, CURLcode curl_result);
+    void ReportProgress(std::chrono::steady_clock::time_point now);
+
+    ScriptEngine*       m_script_engine;
+    CURLM*              m_multi;
+    std::thread         m_thread;
+    std::mutex          m_mutex;   //!< Protects: m_waiting, m_stop
+    std::deque<Waiting> m_waiting;
+    bool                m_stop = false;
+    std::map<CURL*, std::unique_ptr<Transfer>> m_transfers; //!< Only used on the pool thread
 };
 
-bool GetUrlAsString(const std::string& url, CURLcode& curl_result, long& response_code, std::string& response_payload);
-
-bool CurlRequestThreadFunc(CurlTaskContext task);
-
-
-
 #endif // WITH_CURL
@@ -37,6 +37,7 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "ScriptFileSafe.h" // (edited) angelscript addon
 
 #include "utils.h"
+#include "sha1_util.h"
 #include "SocketW.h"
 
 #include <cstdio>
@@ -55,8 +56,15 @@ using namespace std;
 
 #endif
 
-#include <thread>
+#include <algorithm>
 #include <future>
+#include <memory>
+#include <thread>
+
+// Defined here too, they're passed by reference (std::chrono)
+const int    ScriptEngine::VERDICT_TIMEOUT_MS;
+const size_t ScriptEngine::MAX_PENDING_EVENTS;
+const int    ScriptEngine::PROFILE_REPORT_INTERVAL_SEC;
 
 
 // Stream_register_t wrapper
@@ -64,18 +72,105 @@ std::string stream_register_get_name(RoRnet::StreamRegister *reg) {
     return std::string(reg->name);
 }
 
+static void player_info_construct(ScriptPlayerInfo *self) {
+    new(self) ScriptPlayerInfo();
+}
+
+static void player_info_copy_construct(const ScriptPlayerInfo &other, ScriptPlayerInfo *self) {
+    new(self) ScriptPlayerInfo(other);
+}
+
+static void player_info_destruct(ScriptPlayerInfo *self) {
+    self->~ScriptPlayerInfo();
+}
+
+static void stream_sample_construct(ScriptStreamSample *self) {
+    new(self) ScriptStreamSample();
+}
+
+static void stream_sample_copy_construct(const ScriptStreamSample &other, ScriptStreamSample *self) {
+    new(self) ScriptStreamSample(other);
+}
+
+static void stream_sample_destruct(ScriptStreamSample *self) {
+    self->~ScriptStreamSample();
+}
+
+unsigned int ScriptStreamSample::getSize() const {
+    return payload ? (unsigned int) payload->size() : 0;
+}
+
+uint8_t ScriptStreamSample::getUInt8(unsigned int offset) const {
+    uint8_t value = 0;
+    ReadPayload(offset, &value, sizeof(value));
+    return value;
+}
+
+int32_t ScriptStreamSample::getInt32(unsigned int offset) const {
+    int32_t value = 0;
+    ReadPayload(offset, &value, sizeof(value));
+    return value;
+}
+
+float ScriptStreamSample::getFloat(unsigned int offset) const {
+    float value = 0.f;
+    ReadPayload(offset, &value, sizeof(value));
+    return value;
+}
+
+bool ScriptStreamSample::ReadPayload(unsigned int offset, void *value, size_t len) const {
+    if (!payload || (size_t) offset + len > payload->size()) {
+        asIScriptContext *ctx = asGetActiveContext();
+        if (ctx) ctx->SetException("StreamSample: reading beyond the end of the payload");
+        return false;
+    }
+    memcpy(value, payload->data() + offset, len); // unaligned
+    return true;
+}
+
+static std::string auth_name(int authstatus) {
+    if (authstatus & RoRnet::AUTH_ADMIN) return "admin";
+    else if (authstatus & RoRnet::AUTH_MOD) return "moderator";
+    else if (authstatus & RoRnet::AUTH_RANKED) return "ranked";
+    else if (authstatus & RoRnet::AUTH_BOT) return "bot";
+    //else if(authstatus & RoRnet::AUTH_NONE)
+    return "none";
+}
+
+// Per CallbackType: the name scripts use, and the declaration a callback needs around its name
+static const struct {
+    const char *name;
+    const char *return_type;
+    const char *params;
+} CALLBACK_INFO[CALLBACK_COUNT] = {
+    {"frameStep",     "void", "(float)"},
+    {"playerChat",    "int",  "(int, const string &in)"},
+    {"gameCmd",       "void", "(int, const string &in)"},
+    {"playerAdded",   "void", "(int)"},
+    {"playerDeleted", "void", "(int, int)"},
+    {"streamAdded",   "int",  "(int, StreamRegister@)"},
+    {"curlStatus",    "void", "(curlStatusType, int, int, string, string)"},
+    {"streamData",    "void", "(array<StreamSample>@)"},
+};
+
 
 
 ScriptEngine::ScriptEngine(Sequencer *seq) : seq(seq),
                                              engine(0),
                                              context(0)
 {
+    for (int type = 0; type < CALLBACK_COUNT; ++type) {
+        callbacks[type] = std::make_shared<const callbackList>();
+    }
     init();
 }
 
 ScriptEngine::~ScriptEngine() {
     // Stop thread first
-    this->StopTimerThread();
+    this->StopScriptThread();
+#ifdef WITH_CURL
+    m_curl_pool.reset();
+#endif // WITH_CURL
 
     // Clean up
     deleteAllCallbacks();
@@ -86,15 +181,22 @@ ScriptEngine::~ScriptEngine() {
 void ScriptEngine::deleteAllCallbacks() {
     if (!engine) return;
 
-    for (std::map<std::string, callbackList>::iterator typeit = callbacks.begin();
-         typeit != callbacks.end(); ++typeit) {
-        for (callbackList::iterator it = typeit->second.begin(); it != typeit->second.end(); ++it) {
+    std::lock_guard<std::mutex> scoped_lock(callbacks_mutex);
+    for (int type = 0; type < CALLBACK_COUNT; ++type) {
+        for (callbackList::const_iterator it = callbacks[type]->begin(); it != callbacks[type]->end(); ++it) {
             if (it->obj)
                 it->obj->Release();
         }
-        typeit->second.clear();
+        callbacks[type] = std::make_shared<const callbackList>();
+    }
+    m_overruns.clear();
+
+    for (auto &entry : m_timers) {
+        if (entry.second.callback.obj)
+            entry.second.callback.obj->Release();
     }
-    callbacks.clear();
+    m_timers.clear();
+    m_timer_heap = decltype(m_timer_heap)();
 }
 
 int
@@ -128,24 +230,46 @@ RoRServerScriptBuilderIncludeCallback(const char *include, const char *from, CSc
 
 int ScriptEngine::loadScript(std::string scriptname) {
     if (scriptname.empty()) return 0;
+    if (!engine || !context) return 1; // init() failed
 
+    m_script_name = scriptname;
+    int r = this->BuildScript(scriptname, "script");
+    if (r != 0)
+        return r;
+    return this->StartScript(engine->GetModule("script"), scriptname);
+}
+
+int ScriptEngine::BuildScript(const std::string &scriptname, const char *module_name) {
     int r;
     CScriptBuilder builder;
     builder.SetIncludeCallback(RoRServerScriptBuilderIncludeCallback, NULL);
 
-    r = builder.StartNewModule(engine, "script");
-    if (r < 0) {
-        Logger::Log(LOG_ERROR, "ScriptEngine: Unknown error while starting a new script module.");
-        return 1;
-    }
+    r = this->ReadScript(builder, scriptname, module_name);
+    if (r != 0)
+        return r;
 
-    r = builder.AddSectionFromFile(scriptname.c_str());
-    if (r < 0) {
-        Logger::Log(LOG_ERROR, "ScriptEngine: Unknown error while adding a new section from file.");
-        return 1;
+    // Use the bytecode of the last build if the sources didn't change since
+    std::string cache_path, cache_key;
+    bool from_cache = false;
+    if (!Config::getScriptCacheDir().empty()) {
+        std::string cache_name = scriptname.substr(scriptname.find_last_of("/\\") + 1);
+        for (std::string::iterator it = cache_name.begin(); it < cache_name.end(); ++it) {
+            if (!isalnum((unsigned char) *it) && *it != '-')
+                *it = '_';
+        }
+        cache_path = Config::getScriptCacheDir() + "/" + cache_name + ".asbc";
+        cache_key = this->GetBytecodeCacheKey(builder);
+        bool module_lost = false;
+        from_cache = this->LoadBytecodeCache(cache_path, cache_key, module_name, module_lost);
+        if (module_lost) {
+            // the cached bytecode replaced the module but turned out broken, start over
+            r = this->ReadScript(builder, scriptname, module_name);
+            if (r != 0)
+                return r;
+        }
     }
 
-    r = builder.BuildModule();
+    r = from_cache ? 0 : builder.BuildModule();
     if (r < 0) {
         if (r == asINVALID_CONFIGURATION)
             Logger::Log(LOG_ERROR, "ScriptEngine: The engine configuration is invalid.");
@@ -166,37 +290,41 @@ int ScriptEngine::loadScript(std::string scriptname) {
         return 1;
     }
 
-    // Get the newly created module
-    asIScriptModule *mod = builder.GetModule();
+    if (!from_cache && !cache_path.empty()) {
+        this->SaveBytecodeCache(cache_path, cache_key, module_name);
+    }
+    return 0;
+}
+
+int ScriptEngine::StartScript(asIScriptModule *mod, const std::string &scriptname) {
+    int r;
 
     // get some other optional functions
     asIScriptFunction *func;
 
     func = mod->GetFunctionByDecl("void frameStep(float)");
-    if (func) addCallback("frameStep", func, NULL);
+    if (func) addCallback(CALLBACK_FRAME_STEP, func, NULL);
 
     func = mod->GetFunctionByDecl("void playerDeleted(int, int)");
-    if (func) addCallback("playerDeleted", func, NULL);
+    if (func) addCallback(CALLBACK_PLAYER_DELETED, func, NULL);
 
     func = mod->GetFunctionByDecl("void playerAdded(int)");
-    if (func) addCallback("playerAdded", func, NULL);
+    if (func) addCallback(CALLBACK_PLAYER_ADDED, func, NULL);
 
     func = mod->GetFunctionByDecl("int streamAdded(int, StreamRegister@)");
-    if (func) addCallback("streamAdded", func, NULL);
+    if (func) addCallback(CALLBACK_STREAM_ADDED, func, NULL);
 
     func = mod->GetFunctionByDecl("int playerChat(int, string msg)");
-    if (func) addCallback("playerChat", func, NULL);
+    if (func) addCallback(CALLBACK_PLAYER_CHAT, func, NULL);
 
     func = mod->GetFunctionByDecl("void gameCmd(int, string)");
-    if (func) addCallback("gameCmd", func, NULL);
+    if (func) addCallback(CALLBACK_GAME_CMD, func, NULL);
 
     func = mod->GetFunctionByDecl("void curlStatus(curlStatusType, int, int, string, string)");
-    if (func) addCallback("curlStatus", func, NULL);
+    if (func) addCallback(CALLBACK_CURL_STATUS, func, NULL);
 
-    // Create and configure our context
-    context = engine->CreateContext();
-    //context->SetLineCallback(asMETHOD(ScriptEngine,LineCallback), this, asCALL_THISCALL);
-    context->SetExceptionCallback(asMETHOD(ScriptEngine, ExceptionCallback), this, asCALL_THISCALL);
+    func = mod->GetFunctionByDecl("void streamData(array<StreamSample>@)");
+    if (func) addCallback(CALLBACK_STREAM_DATA, func, NULL);
 
     // Find the function that is to be called.
     func = mod->GetFunctionByDecl("void main()");
@@ -211,7 +339,7 @@ int ScriptEngine::loadScript(std::string scriptname) {
     // prepare and execute the main function
     context->Prepare(func);
     Logger::Log(LOG_INFO, "ScriptEngine: Executing main()");
-    r = context->Execute();
+    r = this->Execute();
     if (r != asEXECUTION_FINISHED) {
         // The execution didn't complete as expected. Determine what happened.
         if (r == asEXECUTION_EXCEPTION) {
@@ -219,12 +347,151 @@ int ScriptEngine::loadScript(std::string scriptname) {
             Logger::Log(LOG_ERROR,
                         "ScriptEngine: An exception '%s' occurred. Please correct the code in file '%s' and try again.",
                         context->GetExceptionString(), scriptname.c_str());
+        } else if (r == asEXECUTION_ABORTED) {
+            Logger::Log(LOG_ERROR, "ScriptEngine: main() in file '%s' was aborted, it ran out of time.",
+                        scriptname.c_str());
         }
+        return 1;
+    }
+
+    return 0;
+}
+
+// asIBinaryStream over a FILE, for the bytecode cache
+class BytecodeFileStream : public asIBinaryStream {
+public:
+    explicit BytecodeFileStream(FILE *file) : m_file(file) {}
+
+    int Read(void *ptr, asUINT size) override {
+        return (size == 0 || fread(ptr, size, 1, m_file) == 1) ? 0 : -1;
+    }
+
+    int Write(const void *ptr, asUINT size) override {
+        return (size == 0 || fwrite(ptr, size, 1, m_file) == 1) ? 0 : -1;
+    }
+
+private:
+    FILE *m_file;
+};
+
+static const char BYTECODE_CACHE_MAGIC[] = "RoRServer script bytecode 1\n";
+
+int ScriptEngine::ReadScript(CScriptBuilder &builder, const std::string &scriptname, const char *module_name) {
+    int r = builder.StartNewModule(engine, module_name);
+    if (r < 0) {
+        Logger::Log(LOG_ERROR, "ScriptEngine: Unknown error while starting a new script module.");
+        return 1;
     }
 
+    r = builder.AddSectionFromFile(scriptname.c_str());
+    if (r < 0) {
+        Logger::Log(LOG_ERROR, "ScriptEngine: Unknown error while adding a new section from file.");
+        return 1;
+    }
     return 0;
 }
 
+std::string ScriptEngine::GetBytecodeCacheKey(const CScriptBuilder &builder) {
+    // Bytecode refers to what we register by position, so our script API is part of the key
+    std::string data = std::string(ANGELSCRIPT_VERSION_STRING) + " " + asGetLibraryOptions() + "\n";
+    for (asUINT i = 0; i < engine->GetGlobalFunctionCount(); ++i) {
+        data += engine->GetGlobalFunctionByIndex(i)->GetDeclaration(true, true, true);
+        data += "\n";
+    }
+    for (asUINT i = 0; i < engine->GetGlobalPropertyCount(); ++i) {
+        const char *name = nullptr;
+        int typeId = 0;
+        engine->GetGlobalPropertyByIndex(i, &name, nullptr, &typeId);
+        data += std::string(engine->GetTypeDeclaration(typeId, true)) + " " + name + "\n";
+    }
+    for (asUINT i = 0; i < engine->GetObjectTypeCount(); ++i) {
+        asITypeInfo *type = engine->GetObjectTypeByIndex(i);
+        data += std::string(type->GetName()) + "\n";
+        for (asUINT m = 0; m < type->GetMethodCount(); ++m) {
+            data += std::string(" ") + type->GetMethodByIndex(m)->GetDeclaration(true, true, true) + "\n";
+        }
+        for (asUINT p = 0; p < type->GetPropertyCount(); ++p) {
+            data += std::string(" ") + type->GetPropertyDeclaration(p, true) + "\n";
+        }
+    }
+    for (asUINT i = 0; i < engine->GetEnumCount(); ++i) {
+        asITypeInfo *type = engine->GetEnumByIndex(i);
+        data += std::string(type->GetName()) + "\n";
+        for (asUINT v = 0; v < type->GetEnumValueCount(); ++v) {
+            int value = 0;
+            data += std::string(" ") + type->GetEnumValueByIndex(v, &value) + "=" + std::to_string(value) + "\n";
+        }
+    }
+
+    // ... and so are the script sources, with all includes
+    for (unsigned int i = 0; i < builder.GetSectionCount(); ++i) {
+        std::string section = builder.GetSectionName(i);
+        std::string source;
+        this->loadScriptFile(section.c_str(), source);
+        data += section + "\n" + std::to_string(source.size()) + "\n" + source;
+    }
+
+    char key[41] = "";
+    SHA1FromBuffer(key, data.c_str(), (int) data.size());
+    return std::string(key);
+}
+
+bool ScriptEngine::LoadBytecodeCache(const std::string &path, const std::string &key, const char *module_name,
+                                     bool &module_lost) {
+    module_lost = false;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+
+    // header: magic, then the key of the sources it was built from
+    const size_t magic_len = sizeof(BYTECODE_CACHE_MAGIC) - 1;
+    char header[sizeof(BYTECODE_CACHE_MAGIC) + 41] = "";
+    if (fread(header, magic_len + 41, 1, file) != 1 ||
+        memcmp(header, BYTECODE_CACHE_MAGIC, magic_len) != 0 ||
+        key.compare(0, 40, header + magic_len, 40) != 0) {
+        fclose(file);
+        Logger::Log(LOG_INFO, "ScriptEngine: the script changed, rebuilding it");
+        return false;
+    }
+
+    asIScriptModule *mod = engine->GetModule(module_name, asGM_ALWAYS_CREATE);
+    BytecodeFileStream stream(file);
+    int r = mod->LoadByteCode(&stream);
+    fclose(file);
+    if (r < 0) {
+        Logger::Log(LOG_WARN, "ScriptEngine: cannot load the bytecode cache '%s' (%d), rebuilding the script",
+                    path.c_str(), r);
+        remove(path.c_str());
+        module_lost = true;
+        return false;
+    }
+    Logger::Log(LOG_INFO, "ScriptEngine: loaded the script from the bytecode cache '%s'", path.c_str());
+    return true;
+}
+
+void ScriptEngine::SaveBytecodeCache(const std::string &path, const std::string &key, const char *module_name) {
+    // write to a temporary file first, so a crash doesn't leave a truncated cache behind
+    const std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        Logger::Log(LOG_WARN, "ScriptEngine: cannot write the bytecode cache '%s'", tmp_path.c_str());
+        return;
+    }
+
+    const std::string header = std::string(BYTECODE_CACHE_MAGIC) + key + "\n";
+    BytecodeFileStream stream(file);
+    bool ok = fwrite(header.c_str(), header.size(), 1, file) == 1 &&
+              engine->GetModule(module_name)->SaveByteCode(&stream) >= 0; // with debug info, for line numbers
+    ok = (fclose(file) == 0) && ok;
+#ifdef _WIN32
+    remove(path.c_str()); // rename() doesn't replace files here
+#endif // _WIN32
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        Logger::Log(LOG_WARN, "ScriptEngine: cannot write the bytecode cache '%s'", path.c_str());
+        remove(tmp_path.c_str());
+    }
+}
+
 void ScriptEngine::ExceptionCallback(asIScriptContext *ctx, void *param) {
     const asIScriptFunction *function = ctx->GetExceptionFunction();
     Logger::Log(LOG_INFO, "--- exception ---");
@@ -248,24 +515,34 @@ void ScriptEngine::ExceptionCallback(asIScriptContext *ctx, void *param) {
     Logger::Log(LOG_INFO, "--- end of script exception message ---");
 }
 
-void ScriptEngine::LineCallback(asIScriptContext *ctx, void *param) {
-    char tmp[1024] = "";
-    asIScriptEngine *engine = ctx->GetEngine();
-    int col;
-    const char *sectionName;
-    int line = ctx->GetLineNumber(0, &col, &sectionName);
-    int indent = ctx->GetCallstackSize();
-    for (int n = 0; n < indent; n++)
-        sprintf(tmp + n, " ");
-    const asIScriptFunction *function = engine->GetFunctionById(0);
-    sprintf(tmp + indent, "%s:%s:%s:%d,%d", function->GetModuleName(), sectionName,
-            function->GetDeclaration(),
-            line, col);
+void ScriptEngine::LineCallback(asIScriptContext *ctx) {
+    if (m_execute_depth == 0)
+        return;
 
-    strcat(tmp, "");
-    Logger::Log(LOG_INFO, tmp);
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (Config::getScriptProfiling() >= 2 && now >= m_next_sample) {
+        int col;
+        const char *sectionName = nullptr;
+        int line = ctx->GetLineNumber(0, &col, &sectionName);
+        const asIScriptFunction *function = ctx->GetFunction(0);
+        m_profiler.RecordSample(function ? function->GetDeclaration() : "?", sectionName, line);
+        m_next_sample = now + std::chrono::microseconds(ScriptProfiler::SAMPLE_INTERVAL_US);
+    }
+
+    if (Config::getScriptTimeBudgetMs() <= 0 || now < m_deadline)
+        return;
 
-//	PrintVariables(ctx, -1);
+    if (!m_budget_exceeded) {
+        m_budget_exceeded = true;
+        int col;
+        const char *sectionName = "";
+        int line = ctx->GetLineNumber(0, &col, &sectionName);
+        const asIScriptFunction *function = ctx->GetFunction(0);
+        Logger::Log(LOG_WARN, "ScriptEngine: aborting the script after %d ms in %s (%s:%d)",
+                    Config::getScriptTimeBudgetMs(), function ? function->GetDeclaration() : "?",
+                    sectionName ? sectionName : "?", line);
+    }
+    ctx->Abort();
 }
 
 void ScriptEngine::PrintVariables(asIScriptContext *ctx, int stackLevel) {
@@ -348,6 +625,39 @@ void ScriptEngine::init() {
 
     Logger::Log(LOG_INFO, "ScriptEngine: Registration of libs done, now custom things");
 
+    // Register ScriptPlayerInfo, for server.getPlayers()
+    result = engine->RegisterObjectType("PlayerInfo", sizeof(ScriptPlayerInfo), asOBJ_VALUE | asOBJ_APP_CLASS_CDAK);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectBehaviour("PlayerInfo", asBEHAVE_CONSTRUCT, "void f()",
+                                             asFUNCTION(player_info_construct), asCALL_CDECL_OBJLAST);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectBehaviour("PlayerInfo", asBEHAVE_CONSTRUCT, "void f(const PlayerInfo &in)",
+                                             asFUNCTION(player_info_copy_construct), asCALL_CDECL_OBJLAST);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectBehaviour("PlayerInfo", asBEHAVE_DESTRUCT, "void f()",
+                                             asFUNCTION(player_info_destruct), asCALL_CDECL_OBJLAST);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("PlayerInfo", "PlayerInfo &opAssign(const PlayerInfo &in)",
+                                          asMETHODPR(ScriptPlayerInfo, operator=, (const ScriptPlayerInfo &), ScriptPlayerInfo &),
+                                          asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "int uid", asOFFSET(ScriptPlayerInfo, uid));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "string username", asOFFSET(ScriptPlayerInfo, username));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "string auth", asOFFSET(ScriptPlayerInfo, auth));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "int authRaw", asOFFSET(ScriptPlayerInfo, auth_raw));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "int colourNum", asOFFSET(ScriptPlayerInfo, colour_num));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "string token", asOFFSET(ScriptPlayerInfo, token));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "string version", asOFFSET(ScriptPlayerInfo, version));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("PlayerInfo", "string ipAddress", asOFFSET(ScriptPlayerInfo, ip_address));
+    assert_net(result >= 0);
+
     // Register ServerScript class
     result = engine->RegisterObjectType("ServerScriptClass", sizeof(ServerScript), asOBJ_REF | asOBJ_NOCOUNT);
     assert_net(result >= 0);
@@ -376,6 +686,9 @@ void ScriptEngine::init() {
     result = engine->RegisterObjectMethod("ServerScriptClass", "int getNumClients()",
                                           asMETHOD(ServerScript, getNumClients), asCALL_THISCALL);
     assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("ServerScriptClass", "array<PlayerInfo>@ getPlayers()",
+                                          asMETHOD(ServerScript, getPlayers), asCALL_THISCALL);
+    assert_net(result >= 0);
     result = engine->RegisterObjectMethod("ServerScriptClass", "string getUserName(int uid)",
                                           asMETHOD(ServerScript, getUserName), asCALL_THISCALL);
     assert_net(result >= 0);
@@ -426,6 +739,21 @@ void ScriptEngine::init() {
                                           "void deleteCallback(const string &in, const string &in, ?&in)",
                                           asMETHOD(ServerScript, deleteCallback), asCALL_THISCALL);
     assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("ServerScriptClass", "int setTimeout(const string &in, int, ?&in)",
+                                          asMETHOD(ServerScript, setTimeout), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("ServerScriptClass", "int setInterval(const string &in, int, ?&in)",
+                                          asMETHOD(ServerScript, setInterval), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("ServerScriptClass", "void clearTimer(int)",
+                                          asMETHOD(ServerScript, clearTimer), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("ServerScriptClass", "void subscribeStreamData(int uid, int streamid, int interval_ms)",
+                                          asMETHOD(ServerScript, subscribeStreamData), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("ServerScriptClass", "void unsubscribeStreamData(int uid, int streamid)",
+                                          asMETHOD(ServerScript, unsubscribeStreamData), asCALL_THISCALL);
+    assert_net(result >= 0);
     result = engine->RegisterObjectMethod("ServerScriptClass", "void throwException(const string &in)",
                                           asMETHOD(ServerScript, throwException), asCALL_THISCALL);
     assert_net(result >= 0);
@@ -493,6 +821,59 @@ void ScriptEngine::init() {
     assert_net(result >= 0);
 
 
+    // Register ScriptStreamSample, for the streamData callback
+    result = engine->RegisterObjectType("StreamSample", sizeof(ScriptStreamSample), asOBJ_VALUE | asOBJ_APP_CLASS_CDAK);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectBehaviour("StreamSample", asBEHAVE_CONSTRUCT, "void f()",
+                                             asFUNCTION(stream_sample_construct), asCALL_CDECL_OBJLAST);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectBehaviour("StreamSample", asBEHAVE_CONSTRUCT, "void f(const StreamSample &in)",
+                                             asFUNCTION(stream_sample_copy_construct), asCALL_CDECL_OBJLAST);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectBehaviour("StreamSample", asBEHAVE_DESTRUCT, "void f()",
+                                             asFUNCTION(stream_sample_destruct), asCALL_CDECL_OBJLAST);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("StreamSample", "StreamSample &opAssign(const StreamSample &in)",
+                                          asMETHODPR(ScriptStreamSample, operator=, (const ScriptStreamSample &), ScriptStreamSample &),
+                                          asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "int uid", asOFFSET(ScriptStreamSample, uid));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "int streamid", asOFFSET(ScriptStreamSample, streamid));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "int type", asOFFSET(ScriptStreamSample, type));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "int time", asOFFSET(ScriptStreamSample, state.time));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "float engineSpeed", asOFFSET(ScriptStreamSample, state.engine_speed));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "float engineForce", asOFFSET(ScriptStreamSample, state.engine_force));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "float engineClutch", asOFFSET(ScriptStreamSample, state.engine_clutch));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "int engineGear", asOFFSET(ScriptStreamSample, state.engine_gear));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "float hydroDirState", asOFFSET(ScriptStreamSample, state.hydrodirstate));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "float brake", asOFFSET(ScriptStreamSample, state.brake));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "float wheelSpeed", asOFFSET(ScriptStreamSample, state.wheelspeed));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectProperty("StreamSample", "uint flagmask", asOFFSET(ScriptStreamSample, state.flagmask));
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("StreamSample", "uint getSize() const",
+                                          asMETHOD(ScriptStreamSample, getSize), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("StreamSample", "uint8 getUInt8(uint offset) const",
+                                          asMETHOD(ScriptStreamSample, getUInt8), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("StreamSample", "int getInt32(uint offset) const",
+                                          asMETHOD(ScriptStreamSample, getInt32), asCALL_THISCALL);
+    assert_net(result >= 0);
+    result = engine->RegisterObjectMethod("StreamSample", "float getFloat(uint offset) const",
+                                          asMETHOD(ScriptStreamSample, getFloat), asCALL_THISCALL);
+    assert_net(result >= 0);
+
     // Register ServerType enum for the server.serverMode attribute
     result = engine->RegisterEnum("ServerType");
     assert_net(result >= 0);
@@ -567,6 +948,12 @@ void ScriptEngine::init() {
     assert_net(result >= 0);
 
 
+    // Create and configure our context; all script code runs in it, it outlives reloads of the script
+    context = engine->CreateContext();
+    if (Config::getScriptTimeBudgetMs() > 0 || Config::getScriptProfiling() >= 2)
+        context->SetLineCallback(asMETHOD(ScriptEngine, LineCallback), this, asCALL_THISCALL);
+    context->SetExceptionCallback(asMETHOD(ScriptEngine, ExceptionCallback), this, asCALL_THISCALL);
+
     Logger::Log(LOG_INFO, "ScriptEngine: Registration done");
 }
 
@@ -599,12 +986,12 @@ int ScriptEngine::loadScriptFile(const char *fileName, string &script) {
 }
 
 int ScriptEngine::frameStep(float dt) {
-    if (!engine) return 0;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return 0;
     int r;
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["frameStep"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_FRAME_STEP));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -622,7 +1009,7 @@ int ScriptEngine::frameStep(float dt) {
         context->SetArgFloat(0, dt);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_FRAME_STEP, queue[i]);
     }
 
     // Collect garbage
@@ -631,9 +1018,50 @@ int ScriptEngine::frameStep(float dt) {
     return 0;
 }
 
+void ScriptEngine::streamData() {
+    std::map<std::pair<int, int>, ScriptStreamSample> samples;
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_stream_data_mutex);
+        samples.swap(m_stream_data);
+        m_stream_data_queued = false;
+    }
+    if (!engine || !context || samples.empty()) return;
+    int r;
+
+    // One array for all callbacks; it holds the payloads, not copies of them
+    CScriptArray *array = CScriptArray::Create(engine->GetTypeInfoByDecl("array<StreamSample>"), (asUINT) samples.size());
+    asUINT index = 0;
+    for (auto &entry : samples) {
+        *static_cast<ScriptStreamSample *>(array->At(index++)) = std::move(entry.second);
+    }
+
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_STREAM_DATA));
+    const callbackList &queue = *snapshot;
+
+    // loop over all callbacks
+    for (unsigned int i = 0; i < queue.size(); ++i) {
+        // prepare the call
+        r = context->Prepare(queue[i].func);
+        if (r < 0) continue;
+
+        // Set the object if present (if we don't set it, then we call a global function)
+        if (queue[i].obj != NULL) {
+            context->SetObject(queue[i].obj);
+            if (r < 0) continue;
+        }
+
+        // Set the arguments
+        context->SetArgObject(0, array);
+
+        // Execute it
+        r = this->ExecuteCallback(CALLBACK_STREAM_DATA, queue[i]);
+    }
+    array->Release();
+}
+
 void ScriptEngine::playerDeleted(int uid, int crash, bool doNestedCall /*= false*/) {
-    if (!engine) return;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return;
     int r;
 
     // Push the state of the context if this is a nested call
@@ -642,8 +1070,9 @@ void ScriptEngine::playerDeleted(int uid, int crash, bool doNestedCall /*= false
         if (r < 0) return;
     }
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["playerDeleted"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_PLAYER_DELETED));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -662,7 +1091,7 @@ void ScriptEngine::playerDeleted(int uid, int crash, bool doNestedCall /*= false
         context->SetArgDWord(1, crash);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_PLAYER_DELETED, queue[i]);
     }
 
     // Pop the state of the context if this is was a nested call
@@ -676,12 +1105,12 @@ void ScriptEngine::playerDeleted(int uid, int crash, bool doNestedCall /*= false
 }
 
 void ScriptEngine::playerAdded(int uid) {
-    if (!engine) return;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return;
     int r;
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["playerAdded"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_PLAYER_ADDED));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -699,19 +1128,19 @@ void ScriptEngine::playerAdded(int uid) {
         context->SetArgDWord(0, uid);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_PLAYER_ADDED, queue[i]);
     }
     return;
 }
 
 int ScriptEngine::streamAdded(int uid, RoRnet::StreamRegister *reg) {
-    if (!engine) return 0;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return 0;
     int r;
     int ret = BROADCAST_AUTO;
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["streamAdded"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_STREAM_ADDED));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -730,7 +1159,7 @@ int ScriptEngine::streamAdded(int uid, RoRnet::StreamRegister *reg) {
         context->SetArgObject(1, (void *) reg);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_STREAM_ADDED, queue[i]);
         if (r == asEXECUTION_FINISHED) {
             int newRet = context->GetReturnDWord();
 
@@ -744,13 +1173,13 @@ int ScriptEngine::streamAdded(int uid, RoRnet::StreamRegister *reg) {
 }
 
 int ScriptEngine::playerChat(int uid, std::string msg) {
-    if (!engine) return 0;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return 0;
     int r;
     int ret = BROADCAST_AUTO;
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["playerChat"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_PLAYER_CHAT));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -769,7 +1198,7 @@ int ScriptEngine::playerChat(int uid, std::string msg) {
         context->SetArgObject(1, (void *) &msg);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_PLAYER_CHAT, queue[i]);
         if (r == asEXECUTION_FINISHED) {
             int newRet = context->GetReturnDWord();
 
@@ -783,12 +1212,12 @@ int ScriptEngine::playerChat(int uid, std::string msg) {
 }
 
 void ScriptEngine::gameCmd(int uid, const std::string &cmd) {
-    if (!engine) return;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return;
     int r;
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["gameCmd"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_GAME_CMD));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -807,7 +1236,7 @@ void ScriptEngine::gameCmd(int uid, const std::string &cmd) {
         context->SetArgObject(1, (void *) &cmd);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_GAME_CMD, queue[i]);
     }
 
     return;
@@ -820,12 +1249,12 @@ void ScriptEngine::curlStatus(CurlStatusType type, int n1, int n2, string displa
     // - otherwise, n1 = CURL return code, n2 = HTTP result code.
     // -------------------------------------------------------------------
 
-    if (!engine) return;
-    if (!context) context = engine->CreateContext();
+    if (!engine || !context) return;
     int r;
 
-    // Copy the callback list, because the callback list itself may get changed while executing the script
-    callbackList queue(callbacks["curlStatus"]);
+    // Take a snapshot of the callback list, because the callback list itself may get changed while executing the script
+    callbackSnapshot snapshot(this->GetCallbacks(CALLBACK_CURL_STATUS));
+    const callbackList &queue = *snapshot;
 
     // loop over all callbacks
     for (unsigned int i = 0; i < queue.size(); ++i) {
@@ -847,52 +1276,383 @@ void ScriptEngine::curlStatus(CurlStatusType type, int n1, int n2, string displa
         context->SetArgObject(4, (void*)&message);
 
         // Execute it
-        r = context->Execute();
+        r = this->ExecuteCallback(CALLBACK_CURL_STATUS, queue[i]);
     }
 }
 
-void ScriptEngine::TimerThreadMain() {
-    while (this->GetTimerThreadState() == ThreadState::RUNNING) {
-        // sleep 200 miliseconds
-#ifndef _WIN32
-        usleep(200000);
-#else // _WIN32
-        Sleep(200);
-#endif // _WIN32
+void ScriptEngine::ScriptThreadMain() {
+    typedef std::chrono::steady_clock Clock;
+    Logger::Log(LOG_DEBUG, "ScriptEngine: script thread started");
+    const std::chrono::milliseconds frame_step_interval(Config::getScriptFrameStepMs());
+    Clock::time_point last_frame_step = Clock::now();
+    const std::chrono::seconds profile_report_interval(PROFILE_REPORT_INTERVAL_SEC);
+    Clock::time_point next_profile_report = Clock::now() + profile_report_interval;
+
+    while (true) {
+        // the script adds and removes callbacks and timers on this thread only, so this stays valid while we sleep
+        Clock::time_point wake_up = this->GetNextTimerDeadline();
+        const bool frame_step = frame_step_interval.count() > 0 && this->HasCallbacks(CALLBACK_FRAME_STEP);
+        if (frame_step)
+            wake_up = std::min(wake_up, last_frame_step + frame_step_interval);
+        const bool profile_report = Config::getScriptProfiling() > 0 && !Config::getScriptProfileFile().empty();
+        if (profile_report)
+            wake_up = std::min(wake_up, next_profile_report);
+
+        std::deque<ScriptEvent> events;
+        {
+            std::unique_lock<std::mutex> uni_lock(m_events_mutex);
+            auto pending = [this]() {
+                return !m_events.empty() || m_script_thread_state != ThreadState::RUNNING;
+            };
+            if (wake_up == Clock::time_point::max())
+                m_events_cond.wait(uni_lock, pending);
+            else
+                m_events_cond.wait_until(uni_lock, wake_up, pending);
+            if (m_script_thread_state != ThreadState::RUNNING)
+                break;
+            events.swap(m_events);
+        }
+
+        for (ScriptEvent &event : events) {
+            event();
+        }
+
+        const Clock::time_point now = Clock::now();
+        this->RunDueTimers(now);
+
+        if (!frame_step) {
+            last_frame_step = now; // the first frameStep comes an interval after the callback got added
+        } else if (now >= last_frame_step + frame_step_interval) {
+            // a slow script gets fewer, longer frame steps instead of running them back to back
+            this->frameStep(std::chrono::duration<float, std::milli>(now - last_frame_step).count());
+            last_frame_step = now;
+        }
+
+        if (profile_report && now >= next_profile_report) {
+            m_profiler.WriteReport(Config::getScriptProfileFile());
+            next_profile_report = now + profile_report_interval;
+        }
+    }
+    Logger::Log(LOG_DEBUG, "ScriptEngine: script thread stopped");
+}
+
+std::chrono::steady_clock::time_point ScriptEngine::GetNextTimerDeadline() {
+    // drop cleared timers, so they don't wake us up
+    while (!m_timer_heap.empty() && m_timers.find(m_timer_heap.top().second) == m_timers.end()) {
+        m_timer_heap.pop();
+    }
+    return m_timer_heap.empty() ? std::chrono::steady_clock::time_point::max() : m_timer_heap.top().first;
+}
+
+void ScriptEngine::RunDueTimers(std::chrono::steady_clock::time_point now) {
+    if (!engine || !context) return;
+    while (!m_timer_heap.empty() && m_timer_heap.top().first <= now) {
+        const TimerDeadline due = m_timer_heap.top();
+        m_timer_heap.pop();
+        std::map<int, ScriptTimer>::iterator it = m_timers.find(due.second);
+        if (it == m_timers.end() || it->second.deadline != due.first)
+            continue; // cleared
+
+        // the timer may get cleared while it runs
+        const callback_t callback = it->second.callback;
+        if (it->second.interval.count() > 0) {
+            // a slow script skips runs instead of catching up on them
+            it->second.deadline = std::max(due.first + it->second.interval, now);
+            m_timer_heap.push(TimerDeadline(it->second.deadline, due.second));
+            if (callback.obj)
+                engine->AddRefScriptObject(callback.obj, callback.obj->GetObjectType());
+        } else {
+            m_timers.erase(it);
+        }
+
+        if (context->Prepare(callback.func) >= 0) {
+            if (callback.obj != NULL)
+                context->SetObject(callback.obj);
+
+            const ScriptProfiler::Clock::time_point start = ScriptProfiler::Clock::now();
+            int r = this->Execute();
+            if (Config::getScriptProfiling() > 0) {
+                m_profiler.RecordCall("timer", callback.func->GetDeclaration(true), ScriptProfiler::Clock::now() - start);
+            }
+            if (r == asEXECUTION_ABORTED && m_budget_exceeded) {
+                Logger::Log(LOG_WARN, "ScriptEngine: timer %d (%s) ran out of time, removing it", due.second,
+                            callback.func->GetDeclaration(true));
+                this->ClearTimer(due.second);
+            }
+        }
+        if (callback.obj)
+            callback.obj->Release();
+    }
+}
+
+int ScriptEngine::AddTimer(const std::string &func_name, int delay_ms, bool repeat, asIScriptObject *obj) {
+    if (!engine) return 0;
 
-        // call script
-        seq->frameStepScripts(200);
+    if (delay_ms < 0 || (repeat && delay_ms == 0)) {
+        setException("The timer interval needs to be positive, got " + std::to_string(delay_ms) + " ms.");
+        return 0;
     }
+    asIScriptFunction *func = this->FindScriptFunction("void " + func_name + "()", func_name, obj);
+    if (!func)
+        return 0;
+
+    if (obj)
+        engine->AddRefScriptObject(obj, obj->GetObjectType());
+
+    ScriptTimer timer;
+    timer.callback.obj = obj;
+    timer.callback.func = func;
+    timer.interval = std::chrono::milliseconds(repeat ? delay_ms : 0);
+    timer.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+
+    const int id = m_next_timer_id++;
+    m_timers[id] = timer;
+    m_timer_heap.push(TimerDeadline(timer.deadline, id));
+    return id;
 }
 
-void ScriptEngine::EnsureTimerThreadRunning() {
-    std::lock_guard<std::mutex> scoped_lock(m_timer_thread_mutex);
-    if (m_timer_thread_state == ThreadState::NOT_RUNNING) {
-        Logger::Log(LOG_DEBUG, "ScriptEngine: starting framestep thread");
-        m_timer_thread = std::thread(&ScriptEngine::TimerThreadMain, this);
-        m_timer_thread_state = ThreadState::RUNNING;
-    }    
+void ScriptEngine::ClearTimer(int id) {
+    std::map<int, ScriptTimer>::iterator it = m_timers.find(id);
+    if (it == m_timers.end())
+        return;
+    if (it->second.callback.obj)
+        it->second.callback.obj->Release();
+    m_timers.erase(it);
 }
 
-ScriptEngine::ThreadState ScriptEngine::GetTimerThreadState() {
-    std::lock_guard<std::mutex> scoped_lock(m_timer_thread_mutex);
-    return m_timer_thread_state;
+void ScriptEngine::CurlRequest(const std::string &url, const std::string &displayname) {
+#ifdef WITH_CURL
+    if (!m_curl_pool)
+        m_curl_pool.reset(new CurlPool(this));
+    m_curl_pool->Request(url, displayname);
+#else
+    Logger::Log(LOG_WARN, "ScriptEngine: curlRequestAsync('%s') ignored, the server was built without curl", displayname.c_str());
+#endif // WITH_CURL
 }
 
-void ScriptEngine::StopTimerThread() {
+void ScriptEngine::StartScriptThread() {
+    std::lock_guard<std::mutex> scoped_lock(m_events_mutex);
+    if (m_script_thread_state == ThreadState::NOT_RUNNING) {
+        m_script_thread = std::thread(&ScriptEngine::ScriptThreadMain, this);
+        m_script_thread_state = ThreadState::RUNNING;
+    }
+}
+
+void ScriptEngine::StopScriptThread() {
     {
-        std::lock_guard<std::mutex> scoped_lock(m_timer_thread_mutex);
-        if (m_timer_thread_state != ThreadState::RUNNING)
+        std::lock_guard<std::mutex> scoped_lock(m_events_mutex);
+        if (m_script_thread_state != ThreadState::RUNNING)
             return;
-        m_timer_thread_state = ThreadState::STOP_REQUESTED;
+        m_script_thread_state = ThreadState::STOP_REQUESTED;
+    }
+
+    m_events_cond.notify_one();
+    m_script_thread.join();
+
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_events_mutex);
+        m_script_thread_state = ThreadState::NOT_RUNNING;
+        m_events.clear();
+    }
+}
+
+bool ScriptEngine::QueueEvent(ScriptEvent event) {
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_events_mutex);
+        if (m_script_thread_state != ThreadState::RUNNING)
+            return false;
+        if (m_events.size() >= MAX_PENDING_EVENTS) {
+            Logger::Log(LOG_WARN, "ScriptEngine: script is %zu events behind, dropping events", m_events.size());
+            return false;
+        }
+        m_events.push_back(std::move(event));
     }
+    m_events_cond.notify_one();
+    return true;
+}
+
+int ScriptEngine::WaitForVerdict(std::future<int> &verdict, const char *callback_type) {
+    if (verdict.wait_for(std::chrono::milliseconds(VERDICT_TIMEOUT_MS)) == std::future_status::ready)
+        return verdict.get();
+    Logger::Log(LOG_WARN, "ScriptEngine: no '%s' verdict within %d ms, continuing without", callback_type,
+                VERDICT_TIMEOUT_MS);
+    return BROADCAST_AUTO;
+}
+
+void ScriptEngine::QueuePlayerAdded(int uid) {
+    this->QueueEvent([this, uid]() { this->playerAdded(uid); });
+}
 
-    m_timer_thread.join();
-    
+void ScriptEngine::QueuePlayerDeleted(int uid, int crash) {
+    this->QueueEvent([this, uid, crash]() { this->playerDeleted(uid, crash); });
+}
+
+void ScriptEngine::QueueGameCmd(int uid, const std::string &cmd) {
+    this->QueueEvent([this, uid, cmd]() { this->gameCmd(uid, cmd); });
+}
+
+void ScriptEngine::QueueCurlStatus(CurlStatusType type, int n1, int n2, std::string displayname, std::string message) {
+    this->QueueEvent([this, type, n1, n2, displayname, message]() {
+        this->curlStatus(type, n1, n2, displayname, message);
+    });
+}
+
+void ScriptEngine::QueueStreamData(const ScriptStreamSample &sample) {
     {
-        std::lock_guard<std::mutex> scoped_lock(m_timer_thread_mutex);
-        m_timer_thread_state = ThreadState::NOT_RUNNING;
+        std::lock_guard<std::mutex> scoped_lock(m_stream_data_mutex);
+        m_stream_data[std::make_pair(sample.uid, sample.streamid)] = sample;
+        if (m_stream_data_queued)
+            return; // goes with the batch which is queued already
+        m_stream_data_queued = true;
+    }
+    if (!this->QueueEvent([this]() { this->streamData(); })) {
+        std::lock_guard<std::mutex> scoped_lock(m_stream_data_mutex);
+        m_stream_data.clear();
+        m_stream_data_queued = false;
+    }
+}
+
+void ScriptEngine::QueueReload(int requested_by_uid) {
+    this->QueueEvent([this, requested_by_uid]() { this->ReloadScript(requested_by_uid); });
+}
+
+void ScriptEngine::ReloadScript(int requested_by_uid) {
+    static const char *RELOAD_MODULE = "script-reload";
+    std::string result;
+    bool success = false;
+
+    Logger::Log(LOG_INFO, "ScriptEngine: reloading '%s'", m_script_name.c_str());
+    if (m_script_name.empty() || !engine || !context) {
+        result = "There is no script to reload.";
+    } else if (this->BuildScript(m_script_name, RELOAD_MODULE) != 0) {
+        engine->DiscardModule(RELOAD_MODULE);
+        result = "The script failed to build, the old one keeps running. See the server log.";
+    } else if (!engine->GetModule(RELOAD_MODULE)->GetFunctionByDecl("void main()")) {
+        engine->DiscardModule(RELOAD_MODULE);
+        result = "The script has no 'void main()', the old one keeps running.";
+    } else {
+        // Let the old script hand over its state, then swap the modules
+        std::string state;
+        asIScriptModule *old_mod = engine->GetModule("script");
+        asIScriptFunction *func = old_mod ? old_mod->GetFunctionByDecl("string onScriptUnload()") : nullptr;
+        if (func && context->Prepare(func) >= 0 && this->Execute() == asEXECUTION_FINISHED) {
+            state = *static_cast<std::string *>(context->GetAddressOfReturnValue());
+        }
+        this->deleteAllCallbacks();
+        {
+            std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+            seq->m_stream_data_subs.clear(); // the new script subscribes again
+        }
+        if (old_mod) {
+            engine->DiscardModule("script");
+        }
+
+        // The new module takes over the name, setCallback() looks functions up by it
+        asIScriptModule *mod = engine->GetModule(RELOAD_MODULE);
+        mod->SetName("script");
+        if (this->StartScript(mod, m_script_name) != 0) {
+            result = "The script was reloaded, but its main() failed. See the server log.";
+        } else {
+            func = mod->GetFunctionByDecl("void onScriptReload(const string &in)");
+            if (func && context->Prepare(func) >= 0) {
+                context->SetArgObject(0, &state);
+                this->Execute();
+            }
+            result = "The script was reloaded.";
+            success = true;
+        }
+    }
+
+    Logger::Log(success ? LOG_INFO : LOG_ERROR, "ScriptEngine: %s", result.c_str());
+    if (requested_by_uid >= 0) {
+        std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+        seq->serverSay(result, requested_by_uid, FROM_SERVER);
+    }
+}
+
+int ScriptEngine::RequestStreamAdded(int uid, const RoRnet::StreamRegister &reg) {
+    std::shared_ptr<std::promise<int>> verdict = std::make_shared<std::promise<int>>();
+    std::future<int> result = verdict->get_future();
+    RoRnet::StreamRegister copy = reg; // the sender's buffer is gone once we time out
+    bool queued = this->QueueEvent([this, uid, copy, verdict]() mutable {
+        verdict->set_value(this->streamAdded(uid, &copy));
+    });
+    return queued ? this->WaitForVerdict(result, "streamAdded") : (int) BROADCAST_AUTO;
+}
+
+int ScriptEngine::RequestPlayerChat(int uid, const std::string &msg) {
+    std::shared_ptr<std::promise<int>> verdict = std::make_shared<std::promise<int>>();
+    std::future<int> result = verdict->get_future();
+    bool queued = this->QueueEvent([this, uid, msg, verdict]() {
+        verdict->set_value(this->playerChat(uid, msg));
+    });
+    return queued ? this->WaitForVerdict(result, "playerChat") : (int) BROADCAST_AUTO;
+}
+
+bool ScriptEngine::HasCallbacks(CallbackType type) {
+    std::lock_guard<std::mutex> scoped_lock(callbacks_mutex);
+    return !callbacks[type]->empty();
+}
+
+int ScriptEngine::Execute() {
+    if (m_execute_depth == 0) {
+        // nested calls share the budget of the callback which made them
+        m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(Config::getScriptTimeBudgetMs());
+        m_budget_exceeded = false;
+    }
+    ++m_execute_depth;
+    int r = context->Execute();
+    --m_execute_depth;
+    return r;
+}
+
+int ScriptEngine::ExecuteCallback(CallbackType type, const callback_t &callback) {
+    const ScriptProfiler::Clock::time_point start = ScriptProfiler::Clock::now();
+    int r = this->Execute();
+    if (Config::getScriptProfiling() > 0) {
+        m_profiler.RecordCall(GetCallbackName(type), callback.func->GetDeclaration(true),
+                              ScriptProfiler::Clock::now() - start);
     }
+
+    if (r != asEXECUTION_ABORTED || !m_budget_exceeded)
+        return r;
+
+    int overruns = ++m_overruns[std::make_pair(callback.func, callback.obj)];
+    Logger::Log(LOG_WARN, "ScriptEngine: '%s' callback %s ran out of time (%d times)", GetCallbackName(type),
+                callback.func->GetDeclaration(true), overruns);
+    if (Config::getScriptMaxOverruns() > 0 && overruns >= Config::getScriptMaxOverruns()) {
+        Logger::Log(LOG_ERROR, "ScriptEngine: removing the '%s' callback %s, it keeps running out of time",
+                    GetCallbackName(type), callback.func->GetDeclaration(true));
+        this->deleteCallback(type, callback.func, callback.obj);
+    }
+    return r;
+}
+
+std::vector<std::string> ScriptEngine::GetProfileReport(size_t max_rows) {
+    if (Config::getScriptProfiling() == 0)
+        return std::vector<std::string>();
+    return m_profiler.GetReport(max_rows);
+}
+
+void ScriptEngine::ResetProfile() {
+    m_profiler.Reset();
+}
+
+callbackSnapshot ScriptEngine::GetCallbacks(CallbackType type) {
+    std::lock_guard<std::mutex> scoped_lock(callbacks_mutex);
+    return callbacks[type];
+}
+
+const char *ScriptEngine::GetCallbackName(CallbackType type) {
+    return (type < CALLBACK_COUNT) ? CALLBACK_INFO[type].name : "?";
+}
+
+CallbackType ScriptEngine::GetCallbackType(const std::string &type_name) {
+    for (int type = 0; type < CALLBACK_COUNT; ++type) {
+        if (type_name == CALLBACK_INFO[type].name)
+            return static_cast<CallbackType>(type);
+    }
+    return CALLBACK_INVALID;
 }
 
 void ScriptEngine::setException(const std::string &message) {
@@ -905,70 +1665,30 @@ void ScriptEngine::setException(const std::string &message) {
         context->SetException(message.c_str());
 }
 
-void ScriptEngine::addCallbackScript(const std::string &type, const std::string &_func, asIScriptObject *obj) {
+void ScriptEngine::addCallbackScript(const std::string &type_name, const std::string &_func, asIScriptObject *obj) {
     if (!engine) return;
 
     // get the function declaration and check the type at the same time
-    std::string funcDecl = "";
-    if (type == "frameStep")
-        funcDecl = "void " + _func + "(float)";
-    else if (type == "playerChat")
-        funcDecl = "int " + _func + "(int, const string &in)";
-    else if (type == "gameCmd")
-        funcDecl = "void " + _func + "(int, const string &in)";
-    else if (type == "playerAdded")
-        funcDecl = "void " + _func + "(int)";
-    else if (type == "playerDeleted")
-        funcDecl = "void " + _func + "(int, int)";
-    else if (type == "streamAdded")
-        funcDecl = "int " + _func + "(int, StreamRegister@)";
-    else if (type == "curlStatus")
-        funcDecl = "void " + _func + "(curlStatusType, int, int, string, string)";
-    else {
-        setException("Type " + type +
-                     " does not exist! Possible type strings: 'frameStep', 'playerChat', 'gameCmd', 'playerAdded', 'playerDeleted', 'streamAdded'.");
+    CallbackType type = GetCallbackType(type_name);
+    if (type == CALLBACK_INVALID) {
+        setException("Type " + type_name +
+                     " does not exist! Possible type strings: 'frameStep', 'playerChat', 'gameCmd', 'playerAdded', 'playerDeleted', 'streamAdded', 'curlStatus', 'streamData'.");
         return;
     }
+    std::string funcDecl = std::string(CALLBACK_INFO[type].return_type) + " " + _func + CALLBACK_INFO[type].params;
 
-    asIScriptFunction *func;
-    if (obj) {
-        // search for a method in the class
-        asITypeInfo *objType = obj->GetObjectType();
-        func = objType->GetMethodByDecl(funcDecl.c_str());
-        if (!func) {
-            // give a nice error message that says that the method was not found.
-            func = objType->GetMethodByName(_func.c_str());
-            if (func)
-                setException("Method '" + std::string(func->GetDeclaration(false)) + "' was found in '" +
-                             objType->GetName() + "' but the correct declaration is: '" + funcDecl + "'.");
-            else
-                setException("Method '" + funcDecl + "' was not found in '" + objType->GetName() + "'.");
-            return;
-        }
-    } else {
-        // search for a global function
-        asIScriptModule *mod = engine->GetModule("script");
-        func = mod->GetFunctionByDecl(funcDecl.c_str());
-        if (!func) {
-            // give a nice error message that says that the function was not found.
-            func = mod->GetFunctionByName(_func.c_str());
-            if (func)
-                setException("Function '" + std::string(func->GetDeclaration(false)) +
-                             "' was found, but the correct declaration is: '" + funcDecl + "'.");
-            else
-                setException("Function '" + funcDecl + "' was not found.");
-            return;
-        }
-    }
+    asIScriptFunction *func = this->FindScriptFunction(funcDecl, _func, obj);
+    if (!func)
+        return;
 
     if (callbackExists(type, func, obj))
         Logger::Log(LOG_INFO, "ScriptEngine: error: Function '" + std::string(func->GetDeclaration(false)) +
-                              "' is already a callback for '" + type + "'.");
+                              "' is already a callback for '" + type_name + "'.");
     else
         addCallback(type, func, obj);
 }
 
-void ScriptEngine::addCallback(const std::string &type, asIScriptFunction *func, asIScriptObject *obj) {
+void ScriptEngine::addCallback(CallbackType type, asIScriptFunction *func, asIScriptObject *obj) {
     if (!engine) return;
 
     if (obj) {
@@ -982,44 +1702,41 @@ void ScriptEngine::addCallback(const std::string &type, asIScriptFunction *func,
     callback_t tmp;
     tmp.obj = obj;
     tmp.func = func;
-    callbacks[type].push_back(tmp);
-
-    // Do we need to start the frameStep thread?
-    if (type == "frameStep") {
-        this->EnsureTimerThreadRunning();
+    {
+        std::lock_guard<std::mutex> scoped_lock(callbacks_mutex);
+        std::shared_ptr<callbackList> list = std::make_shared<callbackList>(*callbacks[type]);
+        list->push_back(tmp);
+        callbacks[type] = list;
     }
 
     // finished :)
-    Logger::Log(LOG_INFO, "ScriptEngine: success: Added a '" + type + "' callback for: " +
+    Logger::Log(LOG_INFO, "ScriptEngine: success: Added a '" + std::string(GetCallbackName(type)) + "' callback for: " +
                           std::string(func->GetDeclaration(true)));
 }
 
-void ScriptEngine::deleteCallbackScript(const std::string &type, const std::string &_func, asIScriptObject *obj) {
+void ScriptEngine::deleteCallbackScript(const std::string &type_name, const std::string &_func, asIScriptObject *obj) {
     if (!engine) return;
 
     // get the function declaration and check the type at the same time
-    std::string funcDecl = "";
-    if (type == "frameStep")
-        funcDecl = "void " + _func + "(float)";
-    else if (type == "playerChat")
-        funcDecl = "int " + _func + "(int, const string &in)";
-    else if (type == "gameCmd")
-        funcDecl = "void " + _func + "(int, const string &in)";
-    else if (type == "playerAdded")
-        funcDecl = "void " + _func + "(int)";
-    else if (type == "playerDeleted")
-        funcDecl = "void " + _func + "(int, int)";
-    else if (type == "streamAdded")
-        funcDecl = "int " + _func + "(int, StreamRegister@)";
-    else if (type == "curlStatus")
-        funcDecl = "void " + _func + "(curlStatusType, int, int, string, string)";
-    else {
-        setException("Type " + type +
-                     " does not exist! Possible type strings: 'frameStep', 'playerChat', 'gameCmd', 'playerAdded', 'playerDeleted', 'streamAdded'.");
+    CallbackType type = GetCallbackType(type_name);
+    if (type == CALLBACK_INVALID) {
+        setException("Type " + type_name +
+                     " does not exist! Possible type strings: 'frameStep', 'playerChat', 'gameCmd', 'playerAdded', 'playerDeleted', 'streamAdded', 'curlStatus', 'streamData'.");
         Logger::Log(LOG_INFO, "ScriptEngine: error: Failed to remove callback: " + _func);
         return;
     }
+    std::string funcDecl = std::string(CALLBACK_INFO[type].return_type) + " " + _func + CALLBACK_INFO[type].params;
 
+    asIScriptFunction *func = this->FindScriptFunction(funcDecl, _func, obj);
+    if (!func) {
+        Logger::Log(LOG_INFO, "ScriptEngine: error: Failed to remove callback: " + funcDecl);
+        return;
+    }
+    deleteCallback(type, func, obj);
+}
+
+asIScriptFunction *ScriptEngine::FindScriptFunction(const std::string &funcDecl, const std::string &_func,
+                                                    asIScriptObject *obj) {
     asIScriptFunction *func;
     if (obj) {
         // search for a method in the class
@@ -1033,8 +1750,7 @@ void ScriptEngine::deleteCallbackScript(const std::string &type, const std::stri
                              objType->GetName() + "' but the correct declaration is: '" + funcDecl + "'.");
             else
                 setException("Method '" + funcDecl + "' was not found in '" + objType->GetName() + "'.");
-            Logger::Log(LOG_INFO, "ScriptEngine: error: Failed to remove callback: " + funcDecl);
-            return;
+            return NULL;
         }
     } else {
         // search for a global function
@@ -1048,20 +1764,23 @@ void ScriptEngine::deleteCallbackScript(const std::string &type, const std::stri
                              "' was found, but the correct declaration is: '" + funcDecl + "'.");
             else
                 setException("Function '" + funcDecl + "' was not found.");
-            Logger::Log(LOG_INFO, "ScriptEngine: error: Failed to remove callback: " + funcDecl);
-            return;
+            return NULL;
         }
     }
-    deleteCallback(type, func, obj);
+    return func;
 }
 
-void ScriptEngine::deleteCallback(const std::string &type, asIScriptFunction *func, asIScriptObject *obj) {
+void ScriptEngine::deleteCallback(CallbackType type, asIScriptFunction *func, asIScriptObject *obj) {
     if (!engine) return;
 
-    for (callbackList::iterator it = callbacks[type].begin(); it != callbacks[type].end(); ++it) {
+    std::lock_guard<std::mutex> scoped_lock(callbacks_mutex);
+    for (callbackList::const_iterator it = callbacks[type]->begin(); it != callbacks[type]->end(); ++it) {
         if (it->obj == obj && it->func == func) {
-            callbacks[type].erase(it);
-            Logger::Log(LOG_INFO, "ScriptEngine: success: removed a '" + type + "' callback: " +
+            std::shared_ptr<callbackList> list = std::make_shared<callbackList>(*callbacks[type]);
+            list->erase(list->begin() + (it - callbacks[type]->begin()));
+            callbacks[type] = list;
+            m_overruns.erase(std::make_pair(func, obj));
+            Logger::Log(LOG_INFO, "ScriptEngine: success: removed a '" + std::string(GetCallbackName(type)) + "' callback: " +
                                   std::string(func->GetDeclaration(true)));
             if (obj)
                 engine->ReleaseScriptObject(obj, obj->GetObjectType());
@@ -1071,10 +1790,11 @@ void ScriptEngine::deleteCallback(const std::string &type, asIScriptFunction *fu
     Logger::Log(LOG_INFO, "ScriptEngine: error: failed to remove callback: " + std::string(func->GetDeclaration(true)));
 }
 
-bool ScriptEngine::callbackExists(const std::string &type, asIScriptFunction *func, asIScriptObject *obj) {
+bool ScriptEngine::callbackExists(CallbackType type, asIScriptFunction *func, asIScriptObject *obj) {
     if (!engine) return false;
 
-    for (callbackList::iterator it = callbacks[type].begin(); it != callbacks[type].end(); ++it) {
+    std::lock_guard<std::mutex> scoped_lock(callbacks_mutex);
+    for (callbackList::const_iterator it = callbacks[type]->begin(); it != callbacks[type]->end(); ++it) {
         if (it->obj == obj && it->func == func)
             return true;
     }
@@ -1092,25 +1812,36 @@ void ServerScript::log(std::string &msg) {
     Logger::Log(LOG_INFO, "SCRIPT|%s", msg.c_str());
 }
 
+// Scripts run on the script thread, so everything touching the session locks the clients-mutex
+
 void ServerScript::say(std::string &msg, int uid, int type) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     seq->serverSay(msg, uid, type);
 }
 
 void ServerScript::kick(int kuid, std::string &msg) {
-    seq->QueueClientForDisconnect(kuid, msg.c_str(), false, false);
+    {
+        std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+        seq->QueueClientForDisconnect(kuid, msg.c_str(), false, false);
+    }
     mse->playerDeleted(kuid, 0, true);
 }
 
 void ServerScript::ban(int buid, std::string &msg) {
-    seq->SilentBan(buid, msg.c_str(), false);
+    {
+        std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+        seq->SilentBan(buid, msg.c_str(), false);
+    }
     mse->playerDeleted(buid, 0, true);
 }
 
 bool ServerScript::unban(int buid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     return seq->UnBan(buid);
 }
 
 std::string ServerScript::getUserName(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return "";
 
@@ -1119,6 +1850,7 @@ std::string ServerScript::getUserName(int uid) {
 }
 
 void ServerScript::setUserName(int uid, const string &username) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return;
     std::string username_sane = Str::SanitizeUtf8(username.begin(), username.end());
@@ -1126,53 +1858,56 @@ void ServerScript::setUserName(int uid, const string &username) {
 }
 
 std::string ServerScript::getUserAuth(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return "none";
-    if (c->user.authstatus & RoRnet::AUTH_ADMIN) return "admin";
-    else if (c->user.authstatus & RoRnet::AUTH_MOD) return "moderator";
-    else if (c->user.authstatus & RoRnet::AUTH_RANKED) return "ranked";
-    else if (c->user.authstatus & RoRnet::AUTH_BOT) return "bot";
-    //else if(c->user.authstatus & RoRnet::AUTH_NONE)
-    return "none";
+    return auth_name(c->user.authstatus);
 }
 
 int ServerScript::getUserAuthRaw(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return RoRnet::AUTH_NONE;
     return c->user.authstatus;
 }
 
 void ServerScript::setUserAuthRaw(int uid, int authmode) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return;
     c->user.authstatus = authmode & ~(RoRnet::AUTH_RANKED | RoRnet::AUTH_BANNED);
 }
 
 int ServerScript::getUserColourNum(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return 0;
     return c->user.colournum;
 }
 
 void ServerScript::setUserColourNum(int uid, int num) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return;
     c->user.colournum = num;
 }
 
 std::string ServerScript::getUserToken(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return "";
     return std::string(c->user.usertoken, 40);
 }
 
 std::string ServerScript::getUserVersion(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *c = seq->getClient(uid);
     if (!c) return "";
     return std::string(c->user.clientversion, 25);
 }
 
 std::string ServerScript::getUserIPAddress(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     Client *client = seq->getClient(uid);
     if (client != nullptr) {
         return client->GetIpAddress();
@@ -1181,29 +1916,66 @@ std::string ServerScript::getUserIPAddress(int uid) {
 }
 
 std::string ServerScript::getServerTerrain() {
-    return Config::getTerrainName();
+    return seq->GetConfig().terrain_name;
 }
 
 int ServerScript::sendGameCommand(int uid, std::string cmd) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     return seq->sendGameCommand(uid, cmd);
 }
 
 void ServerScript::curlRequestAsync(std::string url, string displayname) {
-#if WITH_CURL
-    CurlTaskContext context;
-    context.ctc_url = url;
-    context.ctc_displayname = displayname;
-    context.ctc_script_engine = this->mse;
-
-    std::packaged_task<void(CurlTaskContext)> pktask(CurlRequestThreadFunc);
-    std::thread(std::move(pktask), context).detach();
-#endif
+    mse->CurlRequest(url, displayname);
 }
 
 int ServerScript::getNumClients() {
     return seq->getNumClients();
 }
 
+void ServerScript::subscribeStreamData(int uid, int streamid, int interval_ms) {
+    if (uid < -1 || streamid < -1 || (uid == -1 && streamid != -1) || interval_ms < 0) {
+        mse->setException("subscribeStreamData: uid and streamid need to be valid or -1 (streamid -1 if uid is),"
+                          " interval_ms cannot be negative.");
+        return;
+    }
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+    seq->m_stream_data_subs[std::make_pair(uid, streamid)] = interval_ms;
+}
+
+void ServerScript::unsubscribeStreamData(int uid, int streamid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+    seq->m_stream_data_subs.erase(std::make_pair(uid, streamid));
+}
+
+CScriptArray *ServerScript::getPlayers() {
+    std::vector<ScriptPlayerInfo> players;
+    {
+        std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
+        players.reserve(seq->m_clients.size());
+        for (Client *c : seq->m_clients) {
+            if (c->GetStatus() != Client::STATUS_USED)
+                continue;
+            ScriptPlayerInfo player;
+            player.uid = c->user.uniqueid;
+            player.username = Str::SanitizeUtf8(c->user.username);
+            player.auth = auth_name(c->user.authstatus);
+            player.auth_raw = c->user.authstatus;
+            player.colour_num = c->user.colournum;
+            player.token = std::string(c->user.usertoken, 40);
+            player.version = std::string(c->user.clientversion, 25);
+            player.ip_address = c->GetIpAddress();
+            players.push_back(std::move(player));
+        }
+    }
+
+    CScriptArray *array = CScriptArray::Create(mse->getEngine()->GetTypeInfoByDecl("array<PlayerInfo>"),
+                                               (asUINT) players.size());
+    for (asUINT i = 0; i < players.size(); ++i) {
+        *static_cast<ScriptPlayerInfo *>(array->At(i)) = std::move(players[i]);
+    }
+    return array;
+}
+
 int ServerScript::getStartTime() {
     return seq->getStartTime();
 }
@@ -1248,6 +2020,40 @@ void ServerScript::setCallback(const std::string &type, const std::string &func,
     }
 }
 
+int ServerScript::setTimeout(const std::string &func, int delay_ms, void *obj, int refTypeId) {
+    bool valid = false;
+    asIScriptObject *script_obj = this->GetCallbackObject("setTimeout", obj, refTypeId, valid);
+    return valid ? mse->AddTimer(func, delay_ms, false, script_obj) : 0;
+}
+
+int ServerScript::setInterval(const std::string &func, int interval_ms, void *obj, int refTypeId) {
+    bool valid = false;
+    asIScriptObject *script_obj = this->GetCallbackObject("setInterval", obj, refTypeId, valid);
+    return valid ? mse->AddTimer(func, interval_ms, true, script_obj) : 0;
+}
+
+void ServerScript::clearTimer(int id) {
+    mse->ClearTimer(id);
+}
+
+asIScriptObject *ServerScript::GetCallbackObject(const char *caller, void *obj, int refTypeId, bool &valid) {
+    valid = true;
+    if (refTypeId & asTYPEID_SCRIPTOBJECT && (refTypeId & asTYPEID_OBJHANDLE))
+        return *(asIScriptObject **) obj;
+    if (refTypeId == asTYPEID_VOID)
+        return NULL;
+
+    valid = false;
+    if (refTypeId & asTYPEID_SCRIPTOBJECT) {
+        // see setCallback()
+        mse->setException("server." + std::string(caller) +
+                          " should be called with a handle of the object! (that is: put an @ sign in front of the object)");
+    } else {
+        mse->setException("The object for the callback has to be a script-class or null!");
+    }
+    return NULL;
+}
+
 void ServerScript::throwException(const std::string &message) {
     mse->setException(message);
 }
@@ -1264,13 +2070,13 @@ std::string ServerScript::get_protocolVersion() {
     return std::string(RORNET_VERSION);
 }
 
-unsigned int ServerScript::get_maxClients() { return Config::getMaxClients(); }
+unsigned int ServerScript::get_maxClients() { return seq->GetConfig().max_clients; }
 
-std::string ServerScript::get_serverName() { return Config::getServerName(); }
+std::string ServerScript::get_serverName() { return seq->GetConfig().server_name; }
 
 std::string ServerScript::get_IPAddr() { return Config::getIPAddr(); }
 
-unsigned int ServerScript::get_listenPort() { return Config::getListenPort(); }
+unsigned int ServerScript::get_listenPort() { return seq->GetConfig().listen_port; }
 
 int ServerScript::get_serverMode() { return (int)Config::getServerMode(); }
 
@@ -1287,6 +2093,7 @@ int ServerScript::rangeRandomInt(int from, int to) {
 }
 
 void ServerScript::broadcastUserInfo(int uid) {
+    std::lock_guard<std::mutex> scoped_lock(seq->m_clients_mutex);
     seq->broadcastUserInfo(uid);
 }
 
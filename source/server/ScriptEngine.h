@@ -24,8 +24,16 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "UnicodeStrings.h"
 #include "CurlHelpers.h"
+#include "ScriptProfiler.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <queue>
 #include <thread>
 #include <vector>
 #include "angelscript.h"
@@ -40,6 +48,12 @@ class Beam;
 
 class Sequencer;
 
+class CScriptBuilder;
+
+class CurlPool;
+
+class CScriptArray;
+
 /**
  * This struct holds the information for a script callback.
  */
@@ -48,7 +62,65 @@ struct callback_t {
     asIScriptFunction *func; //!< The function or method pointer that will be called.
 };
 typedef std::vector<callback_t> callbackList;
+typedef std::shared_ptr<const callbackList> callbackSnapshot; //!< Replaced, never modified, once published
+
+/**
+ * The kinds of script callbacks; the names scripts use are in ScriptEngine::GetCallbackName().
+ */
+enum CallbackType {
+    CALLBACK_FRAME_STEP,
+    CALLBACK_PLAYER_CHAT,
+    CALLBACK_GAME_CMD,
+    CALLBACK_PLAYER_ADDED,
+    CALLBACK_PLAYER_DELETED,
+    CALLBACK_STREAM_ADDED,
+    CALLBACK_CURL_STATUS,
+    CALLBACK_STREAM_DATA,
+    CALLBACK_COUNT,
+    CALLBACK_INVALID = CALLBACK_COUNT
+};
+
+/**
+ * A connected player as server.getPlayers() returns them (`PlayerInfo` in scripts);
+ * the same values as the getUser*() functions give, copied in one go.
+ */
+struct ScriptPlayerInfo {
+    int         uid = 0;
+    std::string username;
+    std::string auth;       //!< As getUserAuth()
+    int         auth_raw = 0;
+    int         colour_num = 0;
+    std::string token;
+    std::string version;
+    std::string ip_address;
+};
+
+/**
+ * The newest data of a stream, as sampled for the `streamData` callback (`StreamSample` in scripts),
+ * see ServerScript::subscribeStreamData(). The payload is the one the relay stored, not a copy.
+ */
+struct ScriptStreamSample {
+    int                  uid = 0;
+    int                  streamid = 0;
+    int                  type = 0;   //!< StreamRegister::type
+    RoRnet::VehicleState state = {}; //!< Decoded for vehicle streams, zero otherwise
+    std::shared_ptr<const std::vector<char>> payload;
+
+    unsigned int getSize() const;
+    uint8_t      getUInt8(unsigned int offset) const; //!< Script exception if out of range, as below
+    int32_t      getInt32(unsigned int offset) const;
+    float        getFloat(unsigned int offset) const;
+
+private:
+    bool ReadPayload(unsigned int offset, void *value, size_t len) const;
+};
 
+/**
+ * Runs the server script. All script code executes on one script thread, fed through an
+ * event queue, so the relay never waits for a script: the Sequencer queues events and only
+ * waits (briefly, see VERDICT_TIMEOUT_MS) where it needs a verdict. Script functions take
+ * the clients-mutex themselves while they access the session.
+ */
 class ScriptEngine {
 public:
     enum class ThreadState
@@ -58,11 +130,49 @@ public:
         STOP_REQUESTED
     };
 
+    static const int    VERDICT_TIMEOUT_MS = 50;      //!< Then playerChat/streamAdded count as BROADCAST_AUTO
+    static const size_t MAX_PENDING_EVENTS = 10000;   //!< Further events are dropped while the script is this far behind
+    static const int    PROFILE_REPORT_INTERVAL_SEC = 60; //!< To `script-profile-file`
+
     ScriptEngine(Sequencer *seq);
 
     ~ScriptEngine();
 
-    /// @name callbacks
+    /// @name events; callable from any thread, the callbacks run on the script thread
+    /// @{
+
+    void QueuePlayerAdded(int uid);
+
+    void QueuePlayerDeleted(int uid, int crash);
+
+    void QueueGameCmd(int uid, const std::string &cmd);
+
+    void QueueCurlStatus(CurlStatusType type, int n1, int n2, std::string displayname, std::string message);
+
+    /// Delivered with the other samples which come in until the script gets to them; a newer sample of
+    /// the same stream replaces this one. Doesn't wait for the script.
+    void QueueStreamData(const ScriptStreamSample &sample);
+
+    /// Recompiles the script and swaps it in between two events. The old script may hand its state over:
+    /// `string onScriptUnload()` is called before the swap, `void onScriptReload(const string &in)` after
+    /// the new main(). If the new script doesn't build, the old one keeps running.
+    /// @param requested_by_uid Gets told the outcome, -1 = nobody
+    void QueueReload(int requested_by_uid);
+
+    int RequestStreamAdded(int uid, const RoRnet::StreamRegister &reg); //!< Waits for the verdict, don't hold the clients-mutex
+
+    int RequestPlayerChat(int uid, const std::string &msg); //!< Waits for the verdict, don't hold the clients-mutex
+
+    bool HasCallbacks(CallbackType type); //!< To skip waiting for verdicts nobody gives
+
+    /// Text lines, see ScriptProfiler::GetReport(); empty if `script-profiling` is off
+    std::vector<std::string> GetProfileReport(size_t max_rows);
+
+    void ResetProfile();
+
+    /// @}
+
+    /// @name callbacks; only on the script thread (or while loading the script)
     /// @{
 
     int loadScript(std::string scriptName);
@@ -85,10 +195,26 @@ public:
      */
     void curlStatus(CurlStatusType type, int n1, int n2, std::string displayname, std::string message);
 
-    int frameStep(float dt);
+    int frameStep(float dt); //!< `dt` = milliseconds since the previous frameStep
+
+    void streamData(); //!< Passes the queued samples, see QueueStreamData()
+
+    /// @}
+
+    /// @name timers; only on the script thread
+    /// @{
+
+    /// Calls `void func()` (a method if `obj` is set) once after `delay_ms`, or every `delay_ms` if `repeat`
+    /// @return Timer ID for ClearTimer(), 0 on error
+    int AddTimer(const std::string &func, int delay_ms, bool repeat, asIScriptObject *obj);
+
+    void ClearTimer(int id);
 
     /// @}
 
+    /// Starts an HTTP GET in the background, see ServerScript::curlRequestAsync(); only on the script thread
+    void CurlRequest(const std::string &url, const std::string &displayname);
+
     /**
      * Gets the currently used AngelScript script engine.
      * @return a pointer to the currently used AngelScript script engine
@@ -103,65 +229,113 @@ public:
 
     /**
      * Adds a script callback.
-     * @param type The type of the callback. This can be one of the following: 'frameStep', 'playerChat', 'gameCmd', 'playerAdded', 'playerDeleted'.
+     * @param type The type of the callback.
      * @param func A pointer to a script function.
      * @param obj A pointer to the object of the method or NULL if func is a global function.
      */
-    void addCallback(const std::string &type, asIScriptFunction *func, asIScriptObject *obj);
+    void addCallback(CallbackType type, asIScriptFunction *func, asIScriptObject *obj);
 
     /**
      * This method checks and converts the parameters and then adds a script callback.
-     * @param type The type of the callback. \see addCallback
+     * @param type_name The type of the callback, one of the names from GetCallbackName().
      * @param func The name of a script function.
      * @param obj A pointer to the object of the method or NULL if func is a global function.
      */
-    void addCallbackScript(const std::string &type, const std::string &func, asIScriptObject *obj);
+    void addCallbackScript(const std::string &type_name, const std::string &func, asIScriptObject *obj);
 
     /**
      * Deletes a script callback.
-     * @param type The type of the callback. \see addCallback
+     * @param type The type of the callback.
      * @param func A pointer to a script function.
      * @param obj A pointer to the object of the method or NULL if func is a global function.
      */
-    void deleteCallback(const std::string &type, asIScriptFunction *func, asIScriptObject *obj);
+    void deleteCallback(CallbackType type, asIScriptFunction *func, asIScriptObject *obj);
 
     /**
      * This method checks and converts the parameters and then deletes a script callback.
-     * @param type The type of the callback. \see addCallback
+     * @param type_name The type of the callback. \see addCallbackScript
      * @param func The name of a script function.
      * @param obj A pointer to the object of the method or NULL if func is a global function.
      */
-    void deleteCallbackScript(const std::string &type, const std::string &_func, asIScriptObject *obj);
+    void deleteCallbackScript(const std::string &type_name, const std::string &_func, asIScriptObject *obj);
 
     /**
-     * Deletes all script callbacks.
+     * Deletes all script callbacks and timers.
      */
     void deleteAllCallbacks();
 
     /**
      * This checks if a script callback exists.
-     * @param type The type of the callback. \see addCallback
+     * @param type The type of the callback.
      * @param func A pointer to a script function.
      * @param obj A pointer to the object of the method or NULL if func is a global function.
      * @return true if the callback exists
      */
-    bool callbackExists(const std::string &type, asIScriptFunction *func, asIScriptObject *obj);
+    bool callbackExists(CallbackType type, asIScriptFunction *func, asIScriptObject *obj);
+
+    static const char  *GetCallbackName(CallbackType type);           //!< As used by server.setCallback()
+    static CallbackType GetCallbackType(const std::string &type_name); //!< CALLBACK_INVALID if unknown
 
-    // Timer thread control
-    void        EnsureTimerThreadRunning();
-    void        StopTimerThread();
-    ThreadState GetTimerThreadState();
+    // Script thread control
+    void        StartScriptThread(); //!< After loadScript()
+    void        StopScriptThread();
 
 protected:
+    typedef std::function<void()> ScriptEvent;
+
     Sequencer *seq;
     asIScriptEngine *engine;                //!< instance of the scripting engine
     asIScriptContext *context;              //!< context in which all scripting happens
-    std::map<std::string, callbackList> callbacks; //!< A map containing the script callbacks by type.
+    std::string m_script_name;              //!< As loaded, for reloads
+    callbackSnapshot callbacks[CALLBACK_COUNT]; //!< The script callbacks by type, copied on write
+    std::mutex callbacks_mutex;             //!< Protects: callbacks
+
+    // Script thread context
+    std::thread              m_script_thread;
+    ThreadState              m_script_thread_state = ThreadState::NOT_RUNNING;
+    std::deque<ScriptEvent>  m_events;
+    std::condition_variable  m_events_cond;
+    std::mutex               m_events_mutex; //!< Protects: m_script_thread_state, m_events
+
+    // Timer context; only used on the script thread
+    struct ScriptTimer {
+        callback_t                callback;
+        std::chrono::milliseconds interval;     //!< 0 = runs once
+        std::chrono::steady_clock::time_point deadline;
+    };
+    typedef std::pair<std::chrono::steady_clock::time_point, int> TimerDeadline; //!< Deadline, timer ID
+    std::map<int, ScriptTimer> m_timers;
+    std::priority_queue<TimerDeadline, std::vector<TimerDeadline>, std::greater<TimerDeadline>> m_timer_heap; //!< Cleared timers stay until they're due
+    int                      m_next_timer_id = 1;
+
+    // Watchdog context; `script-time-budget` per outermost Execute(), enforced by LineCallback()
+    std::chrono::steady_clock::time_point m_deadline;
+    int                      m_execute_depth = 0;      //!< Callbacks may call into the script again (e.g. kick)
+    bool                     m_budget_exceeded = false;
+    std::map<std::pair<asIScriptFunction*, asIScriptObject*>, int> m_overruns; //!< Per callback
+
+    // Stream data context, see QueueStreamData()
+    std::map<std::pair<int, int>, ScriptStreamSample> m_stream_data; //!< By uid, streamid
+    bool                     m_stream_data_queued = false; //!< The event for streamData() is queued
+    std::mutex               m_stream_data_mutex;          //!< Protects: m_stream_data, m_stream_data_queued
+
+    ScriptProfiler           m_profiler;
+
+#ifdef WITH_CURL
+    std::unique_ptr<CurlPool> m_curl_pool;   //!< Started with the first request
+#endif // WITH_CURL
+    std::chrono::steady_clock::time_point m_next_sample; //!< Line sampling, `script-profiling` 2
+
+    bool QueueEvent(ScriptEvent event); //!< False if the script thread doesn't run or is too far behind
+
+    int WaitForVerdict(std::future<int> &verdict, const char *callback_type);
 
-    // Timer thread context
-    std::thread m_timer_thread;
-    ThreadState m_timer_thread_state = ThreadState::NOT_RUNNING;
-    std::mutex  m_timer_thread_mutex;
+    callbackSnapshot GetCallbacks(CallbackType type); //!< Stays valid while callbacks get added or deleted
+
+    int Execute(); //!< context->Execute() within the time budget; asEXECUTION_ABORTED once it's used up
+
+    /// Execute() for a prepared callback; removes the callback after `script-max-overruns` aborts
+    int ExecuteCallback(CallbackType type, const callback_t &callback);
 
     /**
      * This function initialzies the engine and registeres all types
@@ -200,14 +374,49 @@ protected:
     void PrintVariables(asIScriptContext *ctx, int stackLevel);
 
     /**
-     * unused
+     * Called by AngelScript for every statement while the time budget is enforced or
+     * lines are sampled; aborts the script once the deadline has passed.
      */
-    void LineCallback(asIScriptContext *ctx, void *param);
+    void LineCallback(asIScriptContext *ctx);
 
     /**
-     * A loop that periodically the frameStep() script callback.
+     * Executes the queued events, the due timers, and the frameStep() script callback every
+     * `script-frame-step` ms. Sleeps until the next of these, for good when there's none.
      */
-    void TimerThreadMain();
+    void ScriptThreadMain();
+
+    std::chrono::steady_clock::time_point GetNextTimerDeadline(); //!< time_point::max() if there's no timer
+
+    void RunDueTimers(std::chrono::steady_clock::time_point now);
+
+    /// Looks `decl` up as a method of `obj`, or as a global function if that's NULL; sets a script exception if it's missing
+    asIScriptFunction *FindScriptFunction(const std::string &decl, const std::string &func_name, asIScriptObject *obj);
+
+    /// @name loading the script
+    /// @{
+
+    int BuildScript(const std::string &scriptname, const char *module_name); //!< Compiled or from the bytecode cache
+
+    int StartScript(asIScriptModule *mod, const std::string &scriptname); //!< Registers the callbacks, runs main()
+
+    /// Builds the script in a module of its own and swaps it in, see QueueReload()
+    void ReloadScript(int requested_by_uid);
+
+    int ReadScript(CScriptBuilder &builder, const std::string &scriptname, const char *module_name); //!< Starts the module with all sources
+
+    /// @}
+
+    /// @name bytecode cache, see `script-cache-dir`
+    /// @{
+
+    std::string GetBytecodeCacheKey(const CScriptBuilder &builder); //!< Hash of the sources and of our script API
+
+    /// Replaces the module if the cache is valid; `module_lost` if it looked valid but failed to load
+    bool LoadBytecodeCache(const std::string &path, const std::string &key, const char *module_name, bool &module_lost);
+
+    void SaveBytecodeCache(const std::string &path, const std::string &key, const char *module_name);
+
+    /// @}
 };
 
 class ServerScript {
@@ -260,6 +469,9 @@ public:
 
     int getNumClients();
 
+    /// All players who completed joining, from one lock of the clients-mutex; `array<PlayerInfo>@` in scripts
+    CScriptArray *getPlayers();
+
     int getStartTime();
 
     int getTime();
@@ -299,7 +511,8 @@ public:
     void broadcastUserInfo(int uid);
 
     /**
-     * Launches a background task, use `curlStatus` callback to monitor progress and receive result.
+     * Launches a background request, use `curlStatus` callback to monitor progress and receive result.
+     * Up to CurlPool::MAX_TRANSFERS requests run at once, the others wait for their turn.
      * @param displayname The "correlation ID" - the label passed to the callback to identify the transfer.
      * @remark Callback signature: `curlStatus(curlStatusType, int n1, int n2, string displayname, string message)`
      * - CURL_STATUS_PROGRESS: n1 = bytes downloaded, n2 = total bytes, message = empty
@@ -307,6 +520,25 @@ public:
      * - CURL_STATUS_FAILURE: n1 = CURL return code, n2 = HTTP result code, message = CURL error string
      */
     void curlRequestAsync(std::string url, std::string displayname);
+
+    int setTimeout(const std::string &func, int delay_ms, void *obj, int refTypeId); //!< See ScriptEngine::AddTimer()
+
+    int setInterval(const std::string &func, int interval_ms, void *obj, int refTypeId);
+
+    void clearTimer(int id);
+
+    /**
+     * Samples a stream's data for the `streamData` callback, at most every `interval_ms`.
+     * @param uid The user, -1 = all users (of this server, not of other cluster nodes)
+     * @param streamid The stream, -1 = all streams of the user
+     * @remark Callback signature: `void streamData(array<StreamSample>@ samples)`
+     */
+    void subscribeStreamData(int uid, int streamid, int interval_ms);
+
+    void unsubscribeStreamData(int uid, int streamid); //!< Takes the same `uid` and `streamid` as subscribed
+
+private:
+    asIScriptObject *GetCallbackObject(const char *caller, void *obj, int refTypeId, bool &valid);
 };
 
 #endif // WITH_ANGELSCRIPT
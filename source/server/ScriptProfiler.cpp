@@ -0,0 +1,135 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef WITH_ANGELSCRIPT
+
+#include "ScriptProfiler.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+const int ScriptProfiler::SAMPLE_INTERVAL_US; // passed by reference (std::chrono)
+
+ScriptProfiler::ScriptProfiler() : m_since(Clock::now()) {
+}
+
+void ScriptProfiler::RecordCall(const std::string &type, const std::string &function, Clock::duration elapsed) {
+    const uint64_t us = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+
+    std::lock_guard<std::mutex> scoped_lock(m_mutex);
+    CallStats *tables[] = {&m_callbacks[type], &m_functions[function]};
+    for (CallStats *stats : tables) {
+        stats->calls++;
+        stats->total_us += us;
+        stats->max_us = std::max(stats->max_us, us);
+    }
+}
+
+void ScriptProfiler::RecordSample(const std::string &function, const char *section, int line) {
+    char location[256] = "";
+    snprintf(location, sizeof(location), "%s:%d ", (section != nullptr) ? section : "?", line);
+
+    std::lock_guard<std::mutex> scoped_lock(m_mutex);
+    m_samples[location + function]++;
+    m_total_samples++;
+}
+
+void ScriptProfiler::AppendCallTable(std::vector<std::string> &report, const char *title, const CallTable &table,
+                                     size_t max_rows) {
+    std::vector<std::pair<std::string, CallStats>> rows(table.begin(), table.end());
+    std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, CallStats> &a,
+                                           const std::pair<std::string, CallStats> &b) {
+        return a.second.total_us > b.second.total_us;
+    });
+    if (max_rows > 0 && rows.size() > max_rows)
+        rows.resize(max_rows);
+
+    char line[512] = "";
+    snprintf(line, sizeof(line), "%10s %10s %8s %8s  %s", "calls", "total ms", "avg us", "max us", title);
+    report.push_back(line);
+    for (const auto &row : rows) {
+        snprintf(line, sizeof(line), "%10llu %10.1f %8llu %8llu  %s",
+                 (unsigned long long) row.second.calls, row.second.total_us / 1000.0,
+                 (unsigned long long) (row.second.total_us / row.second.calls),
+                 (unsigned long long) row.second.max_us, row.first.c_str());
+        report.push_back(line);
+    }
+}
+
+std::vector<std::string> ScriptProfiler::GetReport(size_t max_rows) {
+    std::lock_guard<std::mutex> scoped_lock(m_mutex);
+    std::vector<std::string> report;
+    char line[512] = "";
+
+    const long long seconds = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - m_since).count();
+    snprintf(line, sizeof(line), "script profile of the last %lld s", seconds);
+    report.push_back(line);
+
+    AppendCallTable(report, "callback", m_callbacks, max_rows);
+    AppendCallTable(report, "function", m_functions, max_rows);
+
+    if (m_total_samples > 0) {
+        std::vector<std::pair<std::string, uint64_t>> rows(m_samples.begin(), m_samples.end());
+        std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, uint64_t> &a,
+                                               const std::pair<std::string, uint64_t> &b) {
+            return a.second > b.second;
+        });
+        if (max_rows > 0 && rows.size() > max_rows)
+            rows.resize(max_rows);
+
+        snprintf(line, sizeof(line), "%10s %10s  %s", "samples", "share", "line");
+        report.push_back(line);
+        for (const auto &row : rows) {
+            snprintf(line, sizeof(line), "%10llu %9.1f%%  %s", (unsigned long long) row.second,
+                     100.0 * row.second / m_total_samples, row.first.c_str());
+            report.push_back(line);
+        }
+    }
+    return report;
+}
+
+bool ScriptProfiler::WriteReport(const std::string &path) {
+    std::vector<std::string> report = this->GetReport(0);
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        Logger::Log(LOG_WARN, "ScriptProfiler: cannot write '%s'", path.c_str());
+        return false;
+    }
+    for (const std::string &line : report) {
+        fprintf(file, "%s\n", line.c_str());
+    }
+    fclose(file);
+    return true;
+}
+
+void ScriptProfiler::Reset() {
+    std::lock_guard<std::mutex> scoped_lock(m_mutex);
+    m_since = Clock::now();
+    m_callbacks.clear();
+    m_functions.clear();
+    m_samples.clear();
+    m_total_samples = 0;
+}
+
+#endif // WITH_ANGELSCRIPT
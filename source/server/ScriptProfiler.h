@@ -0,0 +1,77 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   ScriptProfiler.h
+/// @brief  Where a server script spends its time, see `script-profiling`.
+///
+/// The ScriptEngine records every callback it executes, by callback type and by script
+/// function, and with line sampling on, the script line being executed about every
+/// SAMPLE_INTERVAL_US. Recording happens on the script thread, reports may be taken
+/// from any thread.
+
+#pragma once
+
+#ifdef WITH_ANGELSCRIPT
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ScriptProfiler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const int SAMPLE_INTERVAL_US = 1000;
+
+    ScriptProfiler();
+
+    void RecordCall(const std::string &type, const std::string &function, Clock::duration elapsed);
+    void RecordSample(const std::string &function, const char *section, int line);
+
+    /// Text report, the busiest `max_rows` entries of each table; 0 = all of them
+    std::vector<std::string> GetReport(size_t max_rows);
+
+    bool WriteReport(const std::string &path); //!< Replaces the file with the full report
+    void Reset();
+
+private:
+    struct CallStats {
+        uint64_t calls = 0;
+        uint64_t total_us = 0;
+        uint64_t max_us = 0;
+    };
+
+    typedef std::map<std::string, CallStats> CallTable;
+
+    static void AppendCallTable(std::vector<std::string> &report, const char *title, const CallTable &table,
+                                size_t max_rows);
+
+    std::mutex                      m_mutex;
+    Clock::time_point               m_since;
+    CallTable                       m_callbacks; //!< By callback type
+    CallTable                       m_functions; //!< By function declaration
+    std::map<std::string, uint64_t> m_samples;   //!< By "section:line function"
+    uint64_t                        m_total_samples = 0;
+};
+
+#endif // WITH_ANGELSCRIPT
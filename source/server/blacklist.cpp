@@ -35,12 +35,12 @@ Blacklist::Blacklist(Sequencer* database)
 void Blacklist::SaveBlacklistToFile()
 {
     std::ofstream f;
-    f.open(Config::getBlacklistFile(), std::ios::out);
+    f.open(m_database->GetConfig().blacklist_file, std::ios::out);
     if (!f.is_open() || !f.good())
     {
         Logger::Log(LogLevel::LOG_WARN,
             "Couldn't open the local blacklist file ('%s'). Bans were not saved.",
-            Config::getBlacklistFile().c_str());
+            m_database->GetConfig().blacklist_file.c_str());
         return;
     }
 
@@ -68,12 +68,12 @@ void Blacklist::SaveBlacklistToFile()
 bool Blacklist::LoadBlacklistFromFile()
 {
     std::ifstream f;
-    f.open(Config::getBlacklistFile(), std::ios::in);
+    f.open(m_database->GetConfig().blacklist_file, std::ios::in);
     if (!f.is_open() || !f.good())
     {
         Logger::Log(LogLevel::LOG_WARN,
                     "Couldn't open the local blacklist file ('%s'). No bans were loaded.",
-                    Config::getBlacklistFile().c_str());
+                    m_database->GetConfig().blacklist_file.c_str());
         return false;
     }
 
@@ -82,7 +82,7 @@ bool Blacklist::LoadBlacklistFromFile()
         f.close();
         Logger::Log(LogLevel::LOG_WARN,
                     "Local blacklist file ('%s') is empty.",
-                    Config::getBlacklistFile().c_str());
+                    m_database->GetConfig().blacklist_file.c_str());
         return false;
     }
 
@@ -22,10 +22,12 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "logger.h"
 #include "messaging.h"
-#include "SocketW.h"
+#include "transport.h"
 #include "sequencer.h"
+#include "config.h"
 
 #include <cassert>
+#include <climits>
 #include <cstring>
 #include <map>
 #include <algorithm>
@@ -47,6 +49,19 @@ void Broadcaster::Start(Client* client) {
     m_packet_drop_counter = 0;
     m_packet_good_counter = 0;
     m_msg_queue.clear();
+    m_udp_holds.clear();
+    m_compressor.reset();
+    m_delta_refs.clear();
+    if (client->HasCapability(RoRnet::CAP_COMPRESS)) {
+        m_compressor.reset(new StreamCompressor(Config::getCompressionLevel()));
+    }
+    m_tick_interval = std::chrono::microseconds(0);
+    if (Config::getRelayTickRate() > 0) {
+        m_tick_interval = std::chrono::microseconds(1000000 / Config::getRelayTickRate());
+    }
+    m_next_tick = Clock::now() + m_tick_interval;
+    m_tick_frames.clear();
+    m_batch.clear();
 
     m_thread = std::thread(&Broadcaster::ThreadMain, this);
     m_thread_state = ThreadState::RUNNING;
@@ -85,8 +100,8 @@ void Broadcaster::ThreadMain() {
 
     bool exit_loop = false;
     while (!exit_loop) {
-        QueueEntry message;
-        ThreadState state = this->ThreadWaitForMessage(message);
+        std::deque<QueueEntry> messages;
+        ThreadState state = this->ThreadWaitForMessages(messages);
 
         if (state == ThreadState::STOP_REQUESTED) {
             Logger::Log(LOG_DEBUG, "Broadcaster thread (client_id %d) was requested to stop", m_client->GetUserId());
@@ -95,11 +110,16 @@ void Broadcaster::ThreadMain() {
             while (!m_msg_queue.empty() && this->ThreadTransmitMessage(m_msg_queue.front())) {
                 m_msg_queue.pop_front();
             }
+            this->ThreadFlush();
+            exit_loop = true;
+        } else if (!this->ThreadTransmitMessages(messages)) {
+            m_sequencer->disconnectClient(m_client->GetUserId(), "Broadcaster: Send error", true, true);
             exit_loop = true;
         } else {
-            if (!this->ThreadTransmitMessage(message)) {
-                m_sequencer->disconnectClient(m_client->GetUserId(), "Broadcaster: Send error", true, true);
-                exit_loop = true;
+            // Written out, datagrams of these streams can no longer overtake their registers
+            std::lock_guard<std::mutex> scoped_lock(m_mutex);
+            for (QueueEntry const& msg : messages) {
+                this->UpdateUdpHolds(msg, -1);
             }
         }
     }
@@ -108,28 +128,285 @@ void Broadcaster::ThreadMain() {
 }
 
 
-Broadcaster::ThreadState Broadcaster::ThreadWaitForMessage(QueueEntry& out_message) {
+Broadcaster::ThreadState Broadcaster::ThreadWaitForMessages(std::deque<QueueEntry>& out_messages) {
     std::unique_lock<std::mutex> uni_lock(m_mutex); // Scoped
+    if (m_tick_interval.count() > 0) {
+        // Tick mode: everything queued during the tick goes out at once
+        m_queue_cond.wait_until(uni_lock, m_next_tick, [this]() { return m_thread_state != ThreadState::RUNNING; });
+        if (m_thread_state != ThreadState::RUNNING) {
+            return m_thread_state; // the queue is sent by ThreadMain()
+        }
+
+        // A whole tick passed while sending the previous one: the connection can't keep up
+        const Clock::time_point now = Clock::now();
+        if (now >= m_next_tick + m_tick_interval) {
+            m_packet_good_counter = 0;
+            m_is_dropping_packets = (++m_packet_drop_counter > 3) ? true : m_is_dropping_packets;
+            m_next_tick = now + m_tick_interval;
+        } else {
+            m_packet_drop_counter = 0;
+            m_is_dropping_packets = (++m_packet_good_counter > 3) ? false : m_is_dropping_packets;
+            m_next_tick += m_tick_interval;
+        }
+        out_messages.swap(m_msg_queue);
+        m_tick_frames.clear();
+        return m_thread_state;
+    }
+
     if (m_msg_queue.empty()) {
         m_queue_cond.wait(uni_lock);
     }
+    if (m_thread_state != ThreadState::RUNNING) {
+        return m_thread_state;
+    }
     if (!m_msg_queue.empty()) {
-        out_message = m_msg_queue.front();
-        m_msg_queue.pop_front();
+        if (m_client->HasCapability(RoRnet::CAP_BUNDLE)) {
+            out_messages.swap(m_msg_queue); // whatever got queued in the meantime goes into the bundle
+        } else {
+            out_messages.push_back(m_msg_queue.front());
+            m_msg_queue.pop_front();
+        }
     }
     return m_thread_state;
 }
 
 
+bool Broadcaster::ThreadTransmitMessages(std::deque<QueueEntry> const& messages) {
+    if (m_client->HasCapability(RoRnet::CAP_BUNDLE)) {
+        if (!this->ThreadTransmitBundled(messages))
+            return false;
+    } else {
+        for (QueueEntry const& msg : messages) {
+            if (!this->ThreadTransmitMessage(msg))
+                return false;
+        }
+    }
+    return this->ThreadFlush();
+}
+
+
 bool Broadcaster::ThreadTransmitMessage(QueueEntry const& msg) {
-    int type = msg.type;
-    if (type == RoRnet::MSG2_INVALID)
+    if (msg.snapshot != nullptr)
+        return this->ThreadTransmitSnapshot(*msg.snapshot);
+    if (msg.type == RoRnet::MSG2_INVALID)
         return true; // No error.
-    if (type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE)
-        type = RoRnet::MSG2_STREAM_DATA;
 
-    int res = Messaging::SWSendMessage(m_client->GetSocket(), type, msg.uid, msg.streamid, msg.datalen, msg.data);
-    return res == 0;
+    int type;
+    unsigned int len;
+    const char *data = this->ThreadEncode(msg, type, len);
+    return this->ThreadSendFrame(type, msg.uid, msg.streamid, len, data);
+}
+
+
+const char *Broadcaster::ThreadEncode(QueueEntry const& msg, int &out_type, unsigned int &out_len) {
+    out_type = (msg.type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE) ? RoRnet::MSG2_STREAM_DATA : msg.type;
+    out_len = msg.datalen;
+    if (!m_client->HasCapability(RoRnet::CAP_DELTA))
+        return msg.data;
+
+    // A reference is only valid for frames sent since the stream was registered
+    const StreamKey key(msg.uid, msg.streamid);
+    if (out_type == RoRnet::MSG2_STREAM_REGISTER || out_type == RoRnet::MSG2_STREAM_UNREGISTER) {
+        m_delta_refs.erase(key);
+        return msg.data;
+    }
+    if (out_type == RoRnet::MSG2_USER_LEAVE) {
+        m_delta_refs.erase(m_delta_refs.lower_bound(StreamKey(msg.uid, 0)), m_delta_refs.upper_bound(StreamKey(msg.uid, UINT_MAX)));
+        return msg.data;
+    }
+    if (out_type != RoRnet::MSG2_STREAM_DATA)
+        return msg.data;
+
+    DeltaReference &ref = m_delta_refs[key];
+    const bool keyframe_due = (++ref.num_deltas >= DELTA_KEYFRAME_INTERVAL);
+    if (!keyframe_due && Messaging::EncodeDelta(ref.frame, msg.data, msg.datalen, m_delta)) {
+        ref.frame.assign(msg.data, msg.data + msg.datalen);
+        out_type = RoRnet::MSG2_STREAM_DATA_DELTA;
+        out_len = (unsigned int) m_delta.size();
+        return m_delta.data();
+    }
+    ref.frame.assign(msg.data, msg.data + msg.datalen); // full frame
+    ref.num_deltas = 0;
+    return msg.data;
+}
+
+
+bool Broadcaster::ThreadSendFrame(int type, int uid, unsigned int streamid, unsigned int len, const char *data) {
+    if (m_compressor == nullptr && m_tick_interval.count() == 0) {
+        int res = Messaging::SWSendMessage(m_client->GetTransport(), type, uid, streamid, len, data);
+        return res == 0;
+    }
+
+    char buffer[sizeof(RoRnet::Header) + RORNET_MAX_MESSAGE_LENGTH];
+    RoRnet::Header head;
+    std::memset(&head, 0, sizeof(RoRnet::Header));
+    head.command = type;
+    head.source = uid;
+    head.size = len;
+    head.streamid = streamid;
+    std::memcpy(buffer, &head, sizeof(RoRnet::Header));
+    std::memcpy(buffer + sizeof(RoRnet::Header), data, len);
+    return this->ThreadSend(buffer, (int) (sizeof(RoRnet::Header) + len));
+}
+
+
+bool Broadcaster::ThreadSend(const char *data, int len) {
+    if (m_tick_interval.count() == 0)
+        return this->ThreadWrite(data, len);
+
+    m_batch.insert(m_batch.end(), data, data + len);
+    return m_batch.size() < TICK_BATCH_LIMIT || this->ThreadFlush();
+}
+
+
+bool Broadcaster::ThreadFlush() {
+    if (m_batch.empty())
+        return true;
+    const bool ok = this->ThreadWrite(m_batch.data(), (int) m_batch.size());
+    m_batch.clear();
+    return ok;
+}
+
+
+bool Broadcaster::ThreadWrite(const char *data, int len) {
+    Transport *transport = m_client->GetTransport();
+    if (m_compressor != nullptr) {
+        return m_compressor->Compress(data, len, [transport](const char *payload, unsigned int payload_len) {
+            return Messaging::SWSendMessage(transport, RoRnet::MSG2_COMPRESSED, 0, 0, payload_len, payload) == 0;
+        });
+    }
+
+    if (!transport->SendAll(data, len)) {
+        Logger::Log(LOG_ERROR, "send error -1: %s", transport->GetLastError().c_str());
+        return false;
+    }
+    Messaging::StatsAddOutgoing(len);
+    return true;
+}
+
+
+bool Broadcaster::ThreadTransmitBundled(std::deque<QueueEntry> const& messages) {
+    int num_bundled = 0;
+    Messaging::BeginBundle(m_bundle);
+
+    auto flush = [this, &num_bundled]() -> bool {
+        bool ok = true;
+        if (num_bundled == 1) {
+            // a bundle of one only adds overhead; the message is already encoded
+            RoRnet::BundleHeader head;
+            const char *bundled = m_bundle.data() + sizeof(RoRnet::Header);
+            std::memcpy(&head, bundled, sizeof(RoRnet::BundleHeader));
+            ok = this->ThreadSendFrame(head.command, head.source, head.streamid, head.size,
+                                       bundled + sizeof(RoRnet::BundleHeader));
+        } else if (num_bundled > 1) {
+            Messaging::FinishBundle(m_bundle);
+            ok = this->ThreadSend(m_bundle.data(), (int) m_bundle.size());
+        }
+        num_bundled = 0;
+        Messaging::BeginBundle(m_bundle);
+        return ok;
+    };
+
+    auto transmit = [this, &flush, &num_bundled](QueueEntry const& msg) -> bool {
+        if (msg.snapshot != nullptr)
+            return flush() && this->ThreadTransmitSnapshot(*msg.snapshot);
+        if (msg.type == RoRnet::MSG2_INVALID)
+            return true;
+
+        int type;
+        unsigned int len;
+        const char *data = this->ThreadEncode(msg, type, len);
+        if (Messaging::AppendToBundle(m_bundle, type, msg.uid, msg.streamid, len, data)) {
+            num_bundled++;
+            return true;
+        }
+        if (!flush())
+            return false;
+        if (Messaging::AppendToBundle(m_bundle, type, msg.uid, msg.streamid, len, data)) {
+            num_bundled++;
+            return true;
+        }
+        return this->ThreadSendFrame(type, msg.uid, msg.streamid, len, data); // cannot be bundled
+    };
+
+    for (QueueEntry const& msg : messages) {
+        if (!transmit(msg))
+            return false;
+    }
+    return flush();
+}
+
+
+bool Broadcaster::ThreadTransmitSnapshot(WorldSnapshot const& snapshot) {
+    // Frame all messages into one buffer and send it at once
+    std::vector<char> buffer;
+    auto append = [&buffer](int type, int uid, unsigned int streamid, unsigned int len, const void *data) {
+        RoRnet::Header head;
+        std::memset(&head, 0, sizeof(RoRnet::Header));
+        head.command = type;
+        head.source = uid;
+        head.size = len;
+        head.streamid = streamid;
+        const char *head_bytes = (const char *) &head;
+        buffer.insert(buffer.end(), head_bytes, head_bytes + sizeof(RoRnet::Header));
+        buffer.insert(buffer.end(), (const char *) data, (const char *) data + len);
+    };
+
+    const bool use_delta = m_client->HasCapability(RoRnet::CAP_DELTA);
+    for (const WorldSnapshot::User& user : snapshot.users) {
+        const int uid = (int) user.info.uniqueid;
+        append(RoRnet::MSG2_USER_INFO, uid, 0, sizeof(RoRnet::UserInfo), &user.info);
+        for (const auto& stream : user.streams) {
+            append(RoRnet::MSG2_STREAM_REGISTER, uid, stream.first, sizeof(RoRnet::StreamRegister), &stream.second);
+            if (use_delta)
+                m_delta_refs.erase(StreamKey(uid, stream.first));
+        }
+        // last known state, so parked vehicles don't stay invisible until their owner sends again
+        for (const auto& frame : user.last_frames) {
+            append(RoRnet::MSG2_STREAM_DATA, uid, frame.first, (unsigned int) frame.second->size(), frame.second->data());
+            if (use_delta)
+                m_delta_refs[StreamKey(uid, frame.first)].frame = *frame.second;
+        }
+    }
+
+    if (buffer.empty())
+        return true;
+    return this->ThreadSend(buffer.data(), (int) buffer.size());
+}
+
+
+bool Broadcaster::IsHoldingUdp(int uid, unsigned int streamid) {
+    std::lock_guard<std::mutex> scoped_lock(m_mutex);
+    return m_udp_holds.find(StreamKey(uid, streamid)) != m_udp_holds.end();
+}
+
+
+void Broadcaster::UpdateUdpHolds(QueueEntry const& msg, int change) {
+    auto update = [this, change](StreamKey const& key) {
+        const int count = (m_udp_holds[key] += change);
+        if (count <= 0)
+            m_udp_holds.erase(key);
+    };
+    if (msg.snapshot != nullptr) {
+        for (const WorldSnapshot::User& user : msg.snapshot->users) {
+            for (const auto& stream : user.streams)
+                update(StreamKey((int) user.info.uniqueid, stream.first));
+        }
+    } else if (msg.type == RoRnet::MSG2_STREAM_REGISTER) {
+        update(StreamKey(msg.uid, msg.streamid));
+    }
+}
+
+
+void Broadcaster::QueueSnapshot(std::shared_ptr<const WorldSnapshot> snapshot) {
+    QueueEntry msg;
+    msg.snapshot = snapshot;
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_mutex);
+        this->UpdateUdpHolds(msg, +1);
+        m_msg_queue.push_back(msg);
+    }
+    m_queue_cond.notify_one();
 }
 
 
@@ -143,6 +420,27 @@ void Broadcaster::QueueMessage(int type, int uid, unsigned int streamid, unsigne
 
     {
         std::lock_guard<std::mutex> scoped_lock(m_mutex);
+        this->UpdateUdpHolds(msg, +1);
+        if (m_tick_interval.count() > 0) {
+            // Tick mode: a newer frame replaces the queued one of its stream, the thread wakes up on its own
+            const StreamKey key(uid, streamid);
+            if (type == RoRnet::MSG2_STREAM_DATA || type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE) {
+                auto found = m_tick_frames.find(key);
+                if (found != m_tick_frames.end()) {
+                    QueueEntry &replaced = m_msg_queue[found->second];
+                    Messaging::StatsAddOutgoingDrop(sizeof(RoRnet::Header) + replaced.datalen); // Statistics
+                    replaced = msg;
+                    return;
+                }
+                m_tick_frames[key] = m_msg_queue.size();
+            } else if (type == RoRnet::MSG2_STREAM_REGISTER || type == RoRnet::MSG2_STREAM_UNREGISTER) {
+                m_tick_frames.erase(key); // later frames must not overtake this
+            } else if (type == RoRnet::MSG2_USER_LEAVE) {
+                m_tick_frames.erase(m_tick_frames.lower_bound(StreamKey(uid, 0)), m_tick_frames.upper_bound(StreamKey(uid, UINT_MAX)));
+            }
+            m_msg_queue.push_back(msg);
+            return;
+        }
         if (m_msg_queue.empty()) {
             m_packet_drop_counter = 0;
             m_is_dropping_packets = (++m_packet_good_counter > 3) ? false : m_is_dropping_packets;
@@ -22,17 +22,38 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "rornet.h"
 #include "prerequisites.h"
+#include "compression.h"
 
+#include <chrono>
 #include <condition_variable>
 #include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
+
+/// Payload of the newest MSG2_STREAM_DATA of a stream. Never modified once stored:
+/// snapshots and scripts share it, the next frame goes into a new buffer.
+typedef std::shared_ptr<const std::vector<char>> StreamFrame;
+
+/// Everything a joining client needs to know about the others, copied while the
+/// clients are locked and turned into messages by the newcomer's broadcaster.
+struct WorldSnapshot {
+    struct User {
+        RoRnet::UserInfo info; //!< Token and GUID already blanked out
+        std::map<unsigned int, RoRnet::StreamRegister> streams;
+        std::map<unsigned int, StreamFrame> last_frames; //!< By stream id
+    };
+    std::vector<User> users;
+};
 
 struct QueueEntry {
     RoRnet::MessageType type = RoRnet::MSG2_INVALID;
     int uid;
     unsigned int streamid;
     unsigned int datalen;
+    std::shared_ptr<const WorldSnapshot> snapshot; //!< If set, the entry stands for the whole snapshot
     char data[RORNET_MAX_MESSAGE_LENGTH];
 };
 
@@ -41,6 +62,8 @@ class Broadcaster {
 public:
     static const int QUEUE_SOFT_LIMIT = 100;
     static const int QUEUE_HARD_LIMIT = 300;
+    static const int DELTA_KEYFRAME_INTERVAL = 100; //!< Full stream data frame after this many deltas
+    static const size_t TICK_BATCH_LIMIT = 64 * 1024; //!< Tick mode: written out early beyond this many bytes
 
     enum class ThreadState
     {
@@ -56,12 +79,30 @@ public:
     void Stop();
 
     void QueueMessage(int msg_type, int client_id, unsigned int streamid, unsigned int payload_len, const char *payload);
+    void QueueSnapshot(std::shared_ptr<const WorldSnapshot> snapshot);
     bool IsDroppingPackets() const { return m_is_dropping_packets; }
+    bool IsHoldingUdp(int uid, unsigned int streamid); //!< True until the stream's MSG2_STREAM_REGISTER is written to the client
 
 private:
     void  ThreadMain();
-    ThreadState ThreadWaitForMessage(QueueEntry& out_message);
+    ThreadState ThreadWaitForMessages(std::deque<QueueEntry>& out_messages);
+    bool  ThreadTransmitMessages(std::deque<QueueEntry> const& messages); //!< Returns false on error.
     bool  ThreadTransmitMessage(QueueEntry const& message); //!< Returns false on error.
+    bool  ThreadTransmitSnapshot(WorldSnapshot const& snapshot); //!< Returns false on error.
+    bool  ThreadTransmitBundled(std::deque<QueueEntry> const& messages); //!< Returns false on error.
+    bool  ThreadSend(const char *data, int len); //!< Complete frames; collected until the end of the tick in tick mode. False on error.
+    bool  ThreadFlush(); //!< Writes out the frames of the tick; false on error.
+    bool  ThreadWrite(const char *data, int len); //!< Compressed if negotiated; false on error.
+    bool  ThreadSendFrame(int type, int uid, unsigned int streamid, unsigned int len, const char *data); //!< False on error.
+    const char *ThreadEncode(QueueEntry const& msg, int &out_type, unsigned int &out_len); //!< Delta if negotiated; valid until the next call
+    void  UpdateUdpHolds(QueueEntry const& msg, int change); //!< For stream registers in `msg`; caller locks m_mutex
+
+    struct DeltaReference {
+        std::vector<char> frame;          //!< Last stream data sent to this client
+        int               num_deltas = 0; //!< Since the last full frame
+    };
+    typedef std::pair<int, unsigned int> StreamKey; //!< uid, streamid
+    typedef std::chrono::steady_clock Clock;
 
     // Thread context
     std::thread              m_thread;
@@ -71,6 +112,17 @@ private:
     // Queue
     std::deque<QueueEntry>   m_msg_queue;
     std::condition_variable  m_queue_cond;
+    std::vector<char>        m_bundle;      //!< Thread context, MSG2_BUNDLE being assembled
+    std::unique_ptr<StreamCompressor> m_compressor; //!< Thread context, only if negotiated
+    std::map<StreamKey, DeltaReference> m_delta_refs; //!< Thread context, only if negotiated
+    std::vector<char>        m_delta;       //!< Thread context, output of ThreadEncode()
+    std::map<StreamKey, int> m_udp_holds;   //!< Stream registers queued but not written yet; their discardable data stays on TCP
+
+    // Tick mode (relay-tick-rate), otherwise messages are sent as soon as they are queued
+    std::chrono::microseconds m_tick_interval{0}; //!< 0 = no tick mode; constant while the thread runs
+    Clock::time_point        m_next_tick;
+    std::map<StreamKey, size_t> m_tick_frames; //!< Queue position of the pending stream data of each stream
+    std::vector<char>        m_batch;       //!< Thread context, frames of the current tick
 
     // Broadcaster state
     Sequencer*               m_sequencer = nullptr;
@@ -0,0 +1,411 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "capture.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// One pre-sized, memory-mapped capture file.
+struct CaptureSegment {
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int    fd = -1;
+#endif
+    char  *data = nullptr;
+    size_t size = 0;
+    size_t used = 0;
+};
+
+/// The segment being written. Writers reserve their bytes with a fetch-add on `reserved`;
+/// only opening the next segment, once this one is full, takes the capture mutex.
+struct ActiveSegment {
+    CaptureSegment      seg;             //!< `seg.used` is only set when the segment is retired
+    std::atomic<size_t> reserved;        //!< End of the last reservation, may run past `seg.size`
+    std::atomic<size_t> full_at;         //!< Offset of the first reservation that didn't fit, SIZE_MAX while there's room
+    std::atomic<int>    writers;         //!< Copying into `seg` right now
+
+    ActiveSegment() : reserved(0), full_at(SIZE_MAX), writers(0) {}
+};
+
+/// A joined client, its join record is repeated at the start of every segment
+struct LiveUser {
+    CaptureRecordHeader rec;
+    RoRnet::UserInfo    info;
+};
+
+// ============================== Variables ===================================
+
+static std::mutex        s_capture_mutex;  //!< Protects everything below except the atomics
+static std::atomic<bool> s_active(false);
+static ActiveSegment     s_slots[2];       //!< Alternately active; never freed, late writers may still look at the old one
+static std::atomic<ActiveSegment*> s_current(nullptr);
+static std::map<std::pair<unsigned int, int>, LiveUser> s_live_users; //!< By session and uid
+static std::string       s_base_path;
+static size_t            s_segment_size = 0;
+static unsigned int      s_max_segments = 0;
+static unsigned int      s_segment_index = 0;
+static uint64_t          s_start_time_unix_ms = 0;
+static std::chrono::steady_clock::time_point s_start_time;
+
+// ============================== Functions ===================================
+
+static std::string GetSegmentPath(unsigned int index) {
+    return s_base_path + "." + std::to_string(index);
+}
+
+static bool MapSegment(CaptureSegment &seg, const std::string &path, size_t size) {
+#ifdef _WIN32
+    seg.file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (seg.file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    seg.mapping = CreateFileMappingA(seg.file, NULL, PAGE_READWRITE,
+                                     (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    if (seg.mapping == NULL) {
+        CloseHandle(seg.file);
+        seg.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    seg.data = (char *)MapViewOfFile(seg.mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (seg.data == nullptr) {
+        CloseHandle(seg.mapping);
+        CloseHandle(seg.file);
+        seg.mapping = NULL;
+        seg.file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+#else
+    seg.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (seg.fd < 0) {
+        return false;
+    }
+    if (ftruncate(seg.fd, (off_t)size) != 0) {
+        close(seg.fd);
+        seg.fd = -1;
+        return false;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, seg.fd, 0);
+    if (addr == MAP_FAILED) {
+        close(seg.fd);
+        seg.fd = -1;
+        return false;
+    }
+    seg.data = (char *)addr;
+#endif
+    seg.size = size;
+    seg.used = 0;
+    return true;
+}
+
+/// Unmaps the segment and trims the file to the bytes actually written.
+static void UnmapSegment(CaptureSegment &seg) {
+    if (seg.data == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    FlushViewOfFile(seg.data, seg.used);
+    UnmapViewOfFile(seg.data);
+    CloseHandle(seg.mapping);
+    LARGE_INTEGER pos;
+    pos.QuadPart = (LONGLONG)seg.used;
+    SetFilePointerEx(seg.file, pos, NULL, FILE_BEGIN);
+    SetEndOfFile(seg.file);
+    CloseHandle(seg.file);
+    seg.mapping = NULL;
+    seg.file = INVALID_HANDLE_VALUE;
+#else
+    munmap(seg.data, seg.size);
+    if (ftruncate(seg.fd, (off_t)seg.used) != 0) {
+        Logger::Log(LOG_WARN, "Capture: failed to trim segment file");
+    }
+    close(seg.fd);
+    seg.fd = -1;
+#endif
+    seg.data = nullptr;
+    seg.size = 0;
+    seg.used = 0;
+}
+
+static uint64_t GetTimestampUs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - s_start_time).count();
+}
+
+/// Waits for the writers still copying into the segment, then closes it.
+static void RetireSegment(ActiveSegment *active) {
+    if (active == nullptr) {
+        return;
+    }
+    while (active->writers.load() != 0) {
+        std::this_thread::yield();
+    }
+    active->seg.used = std::min(active->reserved.load(), active->full_at.load());
+    UnmapSegment(active->seg);
+}
+
+// Capture mutex must be locked
+static bool OpenNextSegment() {
+    ActiveSegment *previous = s_current.load();
+    ActiveSegment *next = (previous == &s_slots[0]) ? &s_slots[1] : &s_slots[0];
+
+    ++s_segment_index;
+    std::string path = GetSegmentPath(s_segment_index);
+    if (!MapSegment(next->seg, path, s_segment_size)) {
+        Logger::Log(LOG_ERROR, "Capture: failed to create segment '%s', capture stopped", path.c_str());
+        s_active = false;
+        RetireSegment(s_current.exchange(nullptr));
+        return false;
+    }
+
+    CaptureFileHeader head;
+    std::memset(&head, 0, sizeof(CaptureFileHeader));
+    std::strncpy(head.magic, CAPTURE_MAGIC, sizeof(head.magic) - 1);
+    std::strncpy(head.protocolversion, RORNET_VERSION, sizeof(head.protocolversion) - 1);
+    head.segment_index = s_segment_index;
+    head.start_time_unix_ms = s_start_time_unix_ms;
+    std::memcpy(next->seg.data, &head, sizeof(CaptureFileHeader));
+    size_t used = sizeof(CaptureFileHeader);
+
+    // The clients connected now, so the segment can be replayed without the ones before it.
+    // Room for one maximum-size frame is left, so the segment that triggered this can proceed.
+    const size_t join_size = sizeof(CaptureRecordHeader) + sizeof(RoRnet::UserInfo);
+    const size_t reserve = sizeof(CaptureRecordHeader) + RORNET_MAX_MESSAGE_LENGTH;
+    const uint64_t now_us = GetTimestampUs();
+    for (auto &live_user : s_live_users) {
+        if (used + join_size + reserve > next->seg.size) {
+            Logger::Log(LOG_WARN, "Capture: segment too small to repeat all joins, use a larger capture-segment-size");
+            break;
+        }
+        live_user.second.rec.timestamp_us = now_us;
+        std::memcpy(next->seg.data + used, &live_user.second.rec, sizeof(CaptureRecordHeader));
+        std::memcpy(next->seg.data + used + sizeof(CaptureRecordHeader), &live_user.second.info, sizeof(RoRnet::UserInfo));
+        used += join_size;
+    }
+
+    next->reserved = used;
+    next->full_at = SIZE_MAX;
+    s_current = next;
+    RetireSegment(previous);
+
+    // Keep the disk usage bounded
+    if (s_max_segments > 0 && s_segment_index > s_max_segments) {
+        std::remove(GetSegmentPath(s_segment_index - s_max_segments).c_str());
+    }
+
+    Logger::Log(LOG_VERBOSE, "Capture: writing segment '%s'", path.c_str());
+    return true;
+}
+
+namespace Capture {
+
+    bool Start(const std::string &path, size_t segment_size, unsigned int max_segments) {
+        std::lock_guard<std::mutex> lock(s_capture_mutex);
+        if (s_active) {
+            return true;
+        }
+
+        // A segment must hold at least one maximum-size frame
+        const size_t min_size = sizeof(CaptureFileHeader) + sizeof(CaptureRecordHeader) + RORNET_MAX_MESSAGE_LENGTH;
+        s_base_path = path;
+        s_segment_size = (segment_size < min_size) ? min_size : segment_size;
+        s_max_segments = max_segments;
+        s_segment_index = 0;
+        s_live_users.clear();
+        s_start_time = std::chrono::steady_clock::now();
+        s_start_time_unix_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+
+        if (!OpenNextSegment()) {
+            return false;
+        }
+        s_active = true;
+        Logger::Log(LOG_INFO, "Capture: recording inbound traffic to '%s.*'", path.c_str());
+        return true;
+    }
+
+    void Stop() {
+        std::lock_guard<std::mutex> lock(s_capture_mutex);
+        if (!s_active) {
+            return;
+        }
+        s_active = false;
+        RetireSegment(s_current.exchange(nullptr));
+        s_live_users.clear();
+        Logger::Log(LOG_INFO, "Capture: stopped after %u segment(s)", s_segment_index);
+    }
+
+    bool IsActive() {
+        return s_active;
+    }
+
+    void Record(unsigned int session, int uid, const RoRnet::Header &header, const char *payload) {
+        if (!s_active) {
+            return;
+        }
+
+        CaptureRecordHeader rec;
+        rec.timestamp_us = GetTimestampUs();
+        rec.session = session;
+        rec.uid = uid;
+        rec.header = header;
+        const size_t rec_size = sizeof(CaptureRecordHeader) + header.size;
+
+        if (header.command == RoRnet::MSG2_USER_INFO || header.command == RoRnet::MSG2_USER_LEAVE) {
+            std::lock_guard<std::mutex> lock(s_capture_mutex);
+            if (header.command == RoRnet::MSG2_USER_LEAVE) {
+                s_live_users.erase(std::make_pair(session, uid));
+            } else if (header.size == sizeof(RoRnet::UserInfo)) {
+                LiveUser &live_user = s_live_users[std::make_pair(session, uid)];
+                live_user.rec = rec;
+                std::memcpy(&live_user.info, payload, sizeof(RoRnet::UserInfo));
+            }
+        }
+
+        while (true) {
+            ActiveSegment *active = s_current.load();
+            if (active == nullptr) {
+                return; // Stopped
+            }
+            active->writers++;
+            if (s_current.load() != active) {
+                active->writers--; // Retired meanwhile
+                continue;
+            }
+
+            const size_t offset = active->reserved.fetch_add(rec_size);
+            if (offset + rec_size <= active->seg.size) {
+                char *dest = active->seg.data + offset;
+                std::memcpy(dest, &rec, sizeof(CaptureRecordHeader));
+                if (header.size > 0) {
+                    std::memcpy(dest + sizeof(CaptureRecordHeader), payload, header.size);
+                }
+                active->writers--;
+                return;
+            }
+            if (offset <= active->seg.size) {
+                active->full_at = offset; // Later reservations start beyond the end
+            }
+            active->writers--;
+
+            std::lock_guard<std::mutex> lock(s_capture_mutex);
+            if (s_current.load() == active && !OpenNextSegment()) {
+                return;
+            }
+        }
+    }
+
+    void Record(unsigned int session, int uid, int type, unsigned int streamid, unsigned int len, const char *payload) {
+        RoRnet::Header header;
+        std::memset(&header, 0, sizeof(RoRnet::Header));
+        header.command = type;
+        header.source = uid;
+        header.streamid = streamid;
+        header.size = len;
+        Record(session, uid, header, payload);
+    }
+
+} // namespace Capture
+
+CaptureReader::CaptureReader() :
+        m_file(nullptr) {
+    std::memset(&m_file_header, 0, sizeof(CaptureFileHeader));
+}
+
+CaptureReader::~CaptureReader() {
+    this->Close();
+}
+
+bool CaptureReader::Open(const std::string &filename) {
+    this->Close();
+
+    m_file = fopen(filename.c_str(), "rb");
+    if (m_file == nullptr) {
+        Logger::Log(LOG_ERROR, "Capture: cannot open '%s'", filename.c_str());
+        return false;
+    }
+
+    if (fread(&m_file_header, sizeof(CaptureFileHeader), 1, m_file) != 1 ||
+        std::strncmp(m_file_header.magic, CAPTURE_MAGIC, sizeof(m_file_header.magic)) != 0) {
+        Logger::Log(LOG_ERROR, "Capture: '%s' is not a capture file", filename.c_str());
+        this->Close();
+        return false;
+    }
+
+    if (std::strncmp(m_file_header.protocolversion, RORNET_VERSION, strlen(RORNET_VERSION)) != 0) {
+        Logger::Log(LOG_WARN, "Capture: '%s' was recorded with protocol %.20s", filename.c_str(),
+                    m_file_header.protocolversion);
+    }
+    return true;
+}
+
+void CaptureReader::Close() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool CaptureReader::ReadNext(CaptureRecordHeader &out_record, char *out_payload, size_t payload_buf_len) {
+    if (m_file == nullptr) {
+        return false;
+    }
+
+    if (fread(&out_record, sizeof(CaptureRecordHeader), 1, m_file) != 1) {
+        return false; // End of segment
+    }
+
+    if (out_record.header.command == RoRnet::MSG2_INVALID) {
+        return false; // Unused tail of a segment that was not closed cleanly
+    }
+
+    if (out_record.header.size > payload_buf_len) {
+        Logger::Log(LOG_ERROR, "Capture: damaged record (payload %u bytes)", out_record.header.size);
+        return false;
+    }
+
+    if (out_record.header.size > 0 &&
+        fread(out_payload, out_record.header.size, 1, m_file) != 1) {
+        Logger::Log(LOG_ERROR, "Capture: truncated record");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,97 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   capture.h
+/// @brief  Recording of inbound traffic for later replay (see tool `rorreplay`).
+///
+/// Layout of a capture segment file:
+///   CaptureFileHeader, then any number of [CaptureRecordHeader + payload].
+/// Segments are pre-sized and memory-mapped; a record whose header command is
+/// zero (MSG2_INVALID) marks the unused tail of a segment that was not closed cleanly.
+/// Every segment starts with the joins (MSG2_USER_INFO) of the clients connected when it
+/// was opened, so it can be replayed after older segments were deleted.
+
+#pragma once
+
+#include "rornet.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#define CAPTURE_MAGIC "RORCAP2"
+
+#pragma pack(push, 1)
+
+struct CaptureFileHeader {
+    char     magic[8];                   //!< CAPTURE_MAGIC
+    char     protocolversion[20];        //!< RORNET_VERSION of the recording server
+    uint32_t segment_index;              //!< Sequence number of this segment
+    uint64_t start_time_unix_ms;         //!< Wall clock at capture start, informative only
+};
+
+struct CaptureRecordHeader {
+    uint64_t       timestamp_us;         //!< Monotonic time since capture start
+    uint32_t       session;              //!< SessionConfig::index of the client; uids are only unique per session
+    int32_t        uid;                  //!< Client the frame was received from
+    RoRnet::Header header;               //!< As received; `header.size` bytes of payload follow
+};
+
+#pragma pack(pop)
+
+namespace Capture {
+
+    /// Opens the first segment; `path` is the base name, segments are written as `<path>.<index>`.
+    /// @param segment_size Bytes per segment file.
+    /// @param max_segments Older segments are deleted when exceeded; 0 keeps all.
+    bool Start(const std::string &path, size_t segment_size, unsigned int max_segments);
+
+    void Stop();
+
+    bool IsActive();
+
+    /// Appends one frame. Safe to call from any thread; only takes a lock for joins,
+    /// leaves and when the segment is full.
+    /// @param session SessionConfig::index of the client's session.
+    void Record(unsigned int session, int uid, const RoRnet::Header &header, const char *payload);
+
+    /// Convenience for frames that do not arrive through the Receiver (handshake, leave).
+    void Record(unsigned int session, int uid, int type, unsigned int streamid, unsigned int len, const char *payload);
+
+} // namespace Capture
+
+/// Sequential reader for capture segments, used by the replay tool.
+class CaptureReader {
+public:
+    CaptureReader();
+    ~CaptureReader();
+
+    bool Open(const std::string &filename);
+    void Close();
+
+    /// @return false at end of segment or on a damaged record.
+    bool ReadNext(CaptureRecordHeader &out_record, char *out_payload, size_t payload_buf_len);
+
+    const CaptureFileHeader &GetFileHeader() const { return m_file_header; }
+
+private:
+    FILE             *m_file;
+    CaptureFileHeader m_file_header;
+};
@@ -0,0 +1,633 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "cluster.h"
+
+#include "broadcaster.h"
+#include "config.h"
+#include "logger.h"
+#include "messaging.h"
+#include "rornet.h"
+#include "sequencer.h"
+#include "sha1.h"
+#include "transport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+
+#define CLUSTER_MAGIC "RoRcluster/" RORNET_VERSION
+
+static const int LINK_TIMEOUT_SEC      = 30; //!< A link without any traffic (not even keepalives) is dead
+static const int HANDSHAKE_TIMEOUT_SEC = 5;  //!< A node which connects must prove itself this quickly
+static const int MAX_HANDSHAKES        = 16; //!< Accepted connections handshaking at once; more are dropped
+static const int MAINTENANCE_INTERVAL  = 5;  //!< Seconds; keepalives, reconnects
+static const size_t NONCE_LEN          = 16; //!< Random bytes in the hello
+static const size_t MAC_LEN            = 20; //!< HMAC-SHA1
+
+/// What both sides of a link agreed on in the handshake; every MAC of the link covers it,
+/// so nothing recorded on one link is of use on another.
+struct LinkTranscript {
+    char    initiator_nonce[NONCE_LEN]; //!< Of the node which connected
+    char    acceptor_nonce[NONCE_LEN];
+    int32_t initiator_id;
+    int32_t acceptor_id;
+};
+
+/// HMAC-SHA1(cluster-key, label, transcript); the label tells the proofs and keys of a link apart
+static void ComputeLinkMac(const char *label, const LinkTranscript &transcript, unsigned char mac[MAC_LEN]) {
+    const std::string &key = Config::getClusterKey();
+    sha1_context ctx;
+    sha1_hmac_starts(&ctx, (unsigned char *) key.data(), (int) key.size());
+    sha1_hmac_update(&ctx, (unsigned char *) label, (int) strlen(label) + 1);
+    sha1_hmac_update(&ctx, (unsigned char *) &transcript, (int) sizeof(LinkTranscript));
+    sha1_hmac_finish(&ctx, mac);
+}
+
+/// MAC of one frame of a link; `keyed` is the direction's context right after sha1_hmac_starts()
+static void ComputeFrameMac(const sha1_context &keyed, uint64_t seq, const char *frame, size_t len,
+                            unsigned char mac[MAC_LEN]) {
+    sha1_context ctx = keyed;
+    sha1_hmac_update(&ctx, (unsigned char *) &seq, (int) sizeof(seq));
+    sha1_hmac_update(&ctx, (unsigned char *) frame, (int) len);
+    sha1_hmac_finish(&ctx, mac);
+}
+
+/// Constant time, so the comparison doesn't tell how much of a forged MAC was right
+static bool IsSameMac(const char *a, const unsigned char *b) {
+    unsigned char diff = 0;
+    for (size_t i = 0; i < MAC_LEN; i++) {
+        diff |= (unsigned char) a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+// ============================== ClusterLink =================================
+
+/// Connection to one other node, with its own send queue so a slow peer
+/// never blocks the Sequencer.
+///
+/// Every frame is followed by its MAC, over a sequence number and the frame, with a key
+/// per direction derived from the handshake; a frame which doesn't match drops the link.
+class ClusterLink {
+public:
+    static const size_t QUEUE_LIMIT = 1000;
+
+    ClusterLink(Cluster *cluster, Sequencer *sequencer, Transport *transport, int node_id,
+                const std::string &peer_address, const LinkTranscript &transcript) :
+            m_cluster(cluster),
+            m_sequencer(sequencer),
+            m_transport(transport),
+            m_node_id(node_id),
+            m_peer_address(peer_address) {
+        unsigned char key[MAC_LEN];
+        ComputeLinkMac(this->IsOutbound() ? "initiator frames" : "acceptor frames", transcript, key);
+        sha1_hmac_starts(&m_send_mac, key, (int) MAC_LEN);
+        ComputeLinkMac(this->IsOutbound() ? "acceptor frames" : "initiator frames", transcript, key);
+        sha1_hmac_starts(&m_recv_mac, key, (int) MAC_LEN);
+    }
+
+    ~ClusterLink() {
+        delete m_transport;
+    }
+
+    void Start() {
+        m_send_thread = std::thread(&ClusterLink::SendThreadMain, this);
+        m_recv_thread = std::thread(&ClusterLink::RecvThreadMain, this);
+    }
+
+    /// Must not be called from the link's own threads.
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_closing = true;
+        }
+        m_queue_cond.notify_one();
+        m_transport->Disconnect();
+        m_send_thread.join();
+        m_recv_thread.join();
+    }
+
+    void QueueMessage(int type, int uid, unsigned int streamid, unsigned int len, const char *data) {
+        QueueEntry msg;
+        msg.type = (RoRnet::MessageType) type;
+        msg.uid = uid;
+        msg.streamid = streamid;
+        msg.datalen = len;
+        std::memcpy(msg.data, data, len);
+
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            if (type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE) {
+                // Like the Broadcaster, only the newest discardable frame of a stream is worth sending
+                auto search = std::find_if(m_queue.begin(), m_queue.end(), [&](const QueueEntry &m)
+                        { return m.type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE && m.uid == uid && m.streamid == streamid; });
+                if (search != m_queue.end()) {
+                    (*search) = msg;
+                    Messaging::StatsAddOutgoingDrop(sizeof(RoRnet::Header) + msg.datalen);
+                    return;
+                }
+            }
+            if (m_queue.size() >= QUEUE_LIMIT) {
+                Logger::Log(LOG_ERROR, "Cluster: send queue to node %d overflows, dropping the link", m_node_id);
+                m_transport->Disconnect(); // The receive thread reports the loss
+                return;
+            }
+            m_queue.push_back(msg);
+        }
+        m_queue_cond.notify_one();
+    }
+
+    /// Drops the connection; the receive thread reports the loss, Close() still has to be called.
+    void Disconnect() {
+        m_transport->Disconnect();
+    }
+
+    int                GetNodeId() const { return m_node_id; }
+    const std::string &GetPeerAddress() const { return m_peer_address; }
+    bool               IsOutbound() const { return !m_peer_address.empty(); }
+
+    bool is_active = false; //!< Protected by Cluster::m_links_mutex
+
+private:
+    void SendThreadMain() {
+        while (true) {
+            QueueEntry msg;
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                m_queue_cond.wait(lock, [this] { return m_closing || !m_queue.empty(); });
+                if (m_closing) {
+                    return;
+                }
+                msg = m_queue.front();
+                m_queue.pop_front();
+            }
+            if (!this->SendFrame(msg)) {
+                m_transport->Disconnect(); // The receive thread reports the loss
+                return;
+            }
+        }
+    }
+
+    void RecvThreadMain() {
+        char buffer[RORNET_MAX_MESSAGE_LENGTH];
+        while (true) {
+            RoRnet::Header head;
+            if (!this->ReceiveFrame(head, buffer)) {
+                break;
+            }
+            if (head.command == RoRnet::MSG2_HELLO) {
+                continue; // Keepalive
+            }
+            m_sequencer->queueClusterMessage(m_node_id, head.command, head.source, head.streamid, buffer, head.size);
+        }
+        m_cluster->OnLinkLost(this);
+    }
+
+    bool SendFrame(const QueueEntry &msg) {
+        const size_t msgsize = sizeof(RoRnet::Header) + msg.datalen;
+        if (msgsize >= RORNET_MAX_MESSAGE_LENGTH) {
+            Logger::Log(LOG_ERROR, "Cluster: attempt to send too long message to node %d", m_node_id);
+            return false;
+        }
+
+        char buffer[RORNET_MAX_MESSAGE_LENGTH + MAC_LEN];
+        RoRnet::Header head;
+        memset(&head, 0, sizeof(RoRnet::Header));
+        head.command = msg.type;
+        head.source = msg.uid;
+        head.size = msg.datalen;
+        head.streamid = msg.streamid;
+        memcpy(buffer, &head, sizeof(RoRnet::Header));
+        memcpy(buffer + sizeof(RoRnet::Header), msg.data, msg.datalen);
+        ComputeFrameMac(m_send_mac, m_send_seq++, buffer, msgsize, (unsigned char *) buffer + msgsize);
+
+        if (!m_transport->SendAll(buffer, (int) (msgsize + MAC_LEN))) {
+            Logger::Log(LOG_WARN, "Cluster: cannot send to node %d: %s", m_node_id, m_transport->GetLastError().c_str());
+            return false;
+        }
+        Messaging::StatsAddOutgoing((int) (msgsize + MAC_LEN));
+        return true;
+    }
+
+    /// @param payload Buffer of RORNET_MAX_MESSAGE_LENGTH bytes
+    bool ReceiveFrame(RoRnet::Header &head, char *payload) {
+        char frame[RORNET_MAX_MESSAGE_LENGTH];
+        char mac[MAC_LEN];
+        if (!m_transport->RecvAll(frame, (int) sizeof(RoRnet::Header))) {
+            return false;
+        }
+        memcpy(&head, frame, sizeof(RoRnet::Header));
+        if (head.size >= RORNET_MAX_MESSAGE_LENGTH - sizeof(RoRnet::Header)) {
+            Logger::Log(LOG_ERROR, "Cluster: node %d sent a frame of %u bytes", m_node_id, head.size);
+            return false;
+        }
+        const size_t msgsize = sizeof(RoRnet::Header) + head.size;
+        if ((head.size > 0 && !m_transport->RecvAll(frame + sizeof(RoRnet::Header), (int) head.size)) ||
+            !m_transport->RecvAll(mac, (int) MAC_LEN)) {
+            return false;
+        }
+
+        unsigned char expected[MAC_LEN];
+        ComputeFrameMac(m_recv_mac, m_recv_seq++, frame, msgsize, expected);
+        if (!IsSameMac(mac, expected)) {
+            Logger::Log(LOG_ERROR, "Cluster: frame from node %d failed authentication", m_node_id);
+            return false;
+        }
+        memcpy(payload, frame + sizeof(RoRnet::Header), head.size);
+        Messaging::StatsAddIncoming((int) (msgsize + MAC_LEN));
+        return true;
+    }
+
+    Cluster                *m_cluster;
+    Sequencer              *m_sequencer;
+    Transport              *m_transport;
+    int                     m_node_id;
+    std::string             m_peer_address; //!< "host:port" if we connected out, empty if accepted
+    std::thread             m_send_thread;
+    std::thread             m_recv_thread;
+    std::deque<QueueEntry>  m_queue;
+    std::mutex              m_queue_mutex;
+    std::condition_variable m_queue_cond;
+    bool                    m_closing = false;
+    sha1_context            m_send_mac;     //!< Keyed for our direction; used by the send thread only
+    sha1_context            m_recv_mac;     //!< Keyed for the peer's direction; used by the receive thread only
+    uint64_t                m_send_seq = 0;
+    uint64_t                m_recv_seq = 0;
+};
+
+// ============================== Cluster =====================================
+
+Cluster::Cluster(Sequencer *sequencer, int node_id) :
+        m_sequencer(sequencer),
+        m_node_id(node_id) {
+}
+
+Cluster::~Cluster() {
+    this->Stop();
+}
+
+bool Cluster::Start(unsigned int listen_port, const std::vector<std::string> &peers) {
+    m_listen_port = listen_port;
+    m_peers = peers;
+
+    if (m_listen_port != 0) {
+        SWBaseSocket::SWBaseError error;
+        m_listen_socket.bind(m_listen_port, &error);
+        if (error != SWBaseSocket::ok) {
+            Logger::Log(LOG_ERROR, "Cluster: cannot listen on port %u: %s", m_listen_port, error.get_error().c_str());
+            return false;
+        }
+        m_listen_socket.listen();
+        m_accept_thread = std::thread(&Cluster::AcceptThreadMain, this);
+    }
+    m_maintenance_thread = std::thread(&Cluster::MaintenanceThreadMain, this);
+
+    Logger::Log(LOG_INFO, "Cluster: node %d started, %zu peer(s) to connect to", m_node_id, m_peers.size());
+    return true;
+}
+
+void Cluster::Stop() {
+    std::vector<ClusterLink*> links;
+    {
+        std::lock_guard<std::mutex> lock(m_links_mutex);
+        if (m_stop_requested) {
+            return;
+        }
+        m_stop_requested = true;
+        links.swap(m_links);
+    }
+    m_stop_cond.notify_all();
+
+    if (m_accept_thread.joinable()) {
+        m_listen_socket.disconnect(); // Unblocks accept()
+        m_accept_thread.join();
+    }
+    {
+        // They end within HANDSHAKE_TIMEOUT_SEC, without adding a link now
+        std::unique_lock<std::mutex> lock(m_links_mutex);
+        m_handshakes_cond.wait(lock, [this] { return m_handshakes == 0; });
+    }
+    if (m_maintenance_thread.joinable()) {
+        m_maintenance_thread.join();
+    }
+
+    for (ClusterLink *link : links) {
+        link->Close();
+        delete link;
+    }
+    this->ReapDeadLinks();
+}
+
+void Cluster::Forward(int type, int uid, unsigned int streamid, unsigned int len, const char *data) {
+    std::lock_guard<std::mutex> lock(m_links_mutex);
+    for (ClusterLink *link : m_links) {
+        if (link->is_active) {
+            link->QueueMessage(type, uid, streamid, len, data);
+        }
+    }
+}
+
+void Cluster::SendToNode(int node_id, int type, int uid, unsigned int streamid, unsigned int len, const char *data) {
+    std::lock_guard<std::mutex> lock(m_links_mutex);
+    for (ClusterLink *link : m_links) {
+        if (link->GetNodeId() == node_id) {
+            link->QueueMessage(type, uid, streamid, len, data);
+            return;
+        }
+    }
+}
+
+void Cluster::ActivateLink(int node_id) {
+    std::lock_guard<std::mutex> lock(m_links_mutex);
+    for (ClusterLink *link : m_links) {
+        if (link->GetNodeId() == node_id) {
+            link->is_active = true;
+        }
+    }
+}
+
+void Cluster::OnLinkLost(ClusterLink *link) {
+    {
+        std::lock_guard<std::mutex> lock(m_links_mutex);
+        auto itor = std::find(m_links.begin(), m_links.end(), link);
+        if (itor == m_links.end()) {
+            return; // Shutting down
+        }
+        m_links.erase(itor);
+        m_dead_links.push_back(link); // Its threads can't join themselves
+    }
+    Logger::Log(LOG_WARN, "Cluster: lost link to node %d", link->GetNodeId());
+    m_sequencer->ClusterNodeLost(link->GetNodeId());
+}
+
+bool Cluster::AddLink(Transport *transport, const std::string &peer_address) {
+    transport->SetTimeout(HANDSHAKE_TIMEOUT_SEC);
+
+    // Both sides introduce themselves with a hello carrying their node id and a nonce. Then the
+    // connecting side (initiator) proves it knows the cluster-key, and only once that checked
+    // out does the accepting side prove it too. The proofs cover both nonces, both node ids and
+    // the role, so one side's proof can't be relayed to a third node, nor reflected back.
+    const bool initiator = !peer_address.empty();
+    LinkTranscript transcript;
+    char *own_nonce = initiator ? transcript.initiator_nonce : transcript.acceptor_nonce;
+    char *peer_nonce = initiator ? transcript.acceptor_nonce : transcript.initiator_nonce;
+    std::random_device random;
+    for (size_t i = 0; i < NONCE_LEN; i++) {
+        own_nonce[i] = (char) random();
+    }
+    const size_t magic_len = strlen(CLUSTER_MAGIC);
+    char hello[sizeof(CLUSTER_MAGIC) - 1 + NONCE_LEN];
+    memcpy(hello, CLUSTER_MAGIC, magic_len);
+    memcpy(hello + magic_len, own_nonce, NONCE_LEN);
+
+    int type = 0;
+    int source = 0;
+    unsigned int streamid = 0;
+    unsigned int len = 0;
+    char buffer[RORNET_MAX_MESSAGE_LENGTH];
+    std::string error;
+    auto send = [&](const char *data, unsigned int data_len) {
+        if (Messaging::SWSendMessage(transport, RoRnet::MSG2_HELLO, m_node_id, 0, data_len, data)) {
+            error = transport->GetLastError();
+            return false;
+        }
+        return true;
+    };
+    auto receive = [&](unsigned int expected_len) {
+        if (Messaging::SWReceiveMessage(transport, &type, &source, &streamid, &len, buffer, RORNET_MAX_MESSAGE_LENGTH)) {
+            error = transport->GetLastError();
+            return false;
+        }
+        if (type != RoRnet::MSG2_HELLO || len != expected_len) {
+            error = "not a cluster node of the same version";
+            return false;
+        }
+        return true;
+    };
+
+    bool ok = (!initiator || send(hello, (unsigned int) sizeof(hello))) && receive((unsigned int) sizeof(hello));
+    const int node_id = source;
+    if (ok) {
+        if (strncmp(buffer, CLUSTER_MAGIC, magic_len) != 0) {
+            error = "not a cluster node of the same version";
+            ok = false;
+        } else if (node_id == m_node_id || node_id < 1 || node_id > MAX_NODE_ID) {
+            error = "invalid node id " + std::to_string(node_id);
+            ok = false;
+        } else {
+            memcpy(peer_nonce, buffer + magic_len, NONCE_LEN);
+            transcript.initiator_id = initiator ? m_node_id : node_id;
+            transcript.acceptor_id = initiator ? node_id : m_node_id;
+            ok = initiator || send(hello, (unsigned int) sizeof(hello));
+        }
+    }
+
+    unsigned char mac[MAC_LEN];
+    if (ok && initiator) {
+        ComputeLinkMac("initiator", transcript, mac);
+        ok = send((char *) mac, (unsigned int) MAC_LEN) && receive((unsigned int) MAC_LEN);
+        ComputeLinkMac("acceptor", transcript, mac);
+        if (ok && (source != node_id || !IsSameMac(buffer, mac))) {
+            error = "wrong cluster-key";
+            ok = false;
+        }
+    } else if (ok) {
+        ok = receive((unsigned int) MAC_LEN);
+        ComputeLinkMac("initiator", transcript, mac);
+        if (ok && (source != node_id || !IsSameMac(buffer, mac))) {
+            error = "wrong cluster-key"; // Nothing to learn from us then
+            ok = false;
+        }
+        if (ok) {
+            ComputeLinkMac("acceptor", transcript, mac);
+            ok = send((char *) mac, (unsigned int) MAC_LEN);
+        }
+    }
+
+    if (!ok) {
+        Logger::Log(LOG_WARN, "Cluster: handshake with %s failed: %s", transport->GetPeerAddress().c_str(),
+                    error.c_str());
+        transport->Disconnect();
+        delete transport;
+        return false;
+    }
+    transport->SetTimeout(LINK_TIMEOUT_SEC);
+
+    // If both nodes connected, the link opened by the lower node id is kept on both sides
+    bool replaced = false;
+    {
+        std::lock_guard<std::mutex> lock(m_links_mutex);
+        if (initiator) {
+            m_peer_nodes[peer_address] = node_id;
+        }
+        const bool keep_outbound = (m_node_id < node_id);
+        auto existing = std::find_if(m_links.begin(), m_links.end(),
+                                     [node_id](ClusterLink *l) { return l->GetNodeId() == node_id; });
+        if (existing != m_links.end() && (*existing)->IsOutbound() != keep_outbound && initiator == keep_outbound) {
+            (*existing)->Disconnect();
+            m_dead_links.push_back(*existing); // Its threads can't join themselves
+            m_links.erase(existing);
+            replaced = true;
+        }
+    }
+    if (replaced) {
+        // The other node drops it too; its users are introduced again over the new link
+        Logger::Log(LOG_VERBOSE, "Cluster: replacing the link to node %d", node_id);
+        m_sequencer->ClusterNodeLost(node_id);
+    }
+
+    ClusterLink *link = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_links_mutex);
+        for (ClusterLink *existing : m_links) {
+            if (existing->GetNodeId() == node_id) {
+                error = "already linked to node " + std::to_string(node_id);
+            }
+        }
+        if (m_stop_requested) {
+            error = "shutting down";
+        }
+        if (error.empty()) {
+            link = new ClusterLink(this, m_sequencer, transport, node_id, peer_address, transcript);
+            m_links.push_back(link);
+            link->Start();
+        }
+    }
+
+    if (link == nullptr) {
+        Logger::Log(LOG_WARN, "Cluster: rejecting link from %s: %s", transport->GetPeerAddress().c_str(),
+                    error.c_str());
+        transport->Disconnect();
+        delete transport;
+        return false;
+    }
+
+    Logger::Log(LOG_INFO, "Cluster: linked to node %d (%s)", node_id, transport->GetPeerAddress().c_str());
+    m_sequencer->ClusterNodeConnected(node_id); // Sends our snapshot, then activates the link
+    return true;
+}
+
+bool Cluster::IsConnectedTo(const std::string &peer_address) {
+    std::lock_guard<std::mutex> lock(m_links_mutex);
+    auto known = m_peer_nodes.find(peer_address);
+    for (ClusterLink *link : m_links) {
+        if (link->GetPeerAddress() == peer_address ||
+            (known != m_peer_nodes.end() && link->GetNodeId() == known->second)) {
+            return true; // Maybe through the link the peer opened
+        }
+    }
+    return false;
+}
+
+void Cluster::ReapDeadLinks() {
+    std::vector<ClusterLink*> dead_links;
+    {
+        std::lock_guard<std::mutex> lock(m_links_mutex);
+        dead_links.swap(m_dead_links);
+    }
+    for (ClusterLink *link : dead_links) {
+        link->Close();
+        delete link;
+    }
+}
+
+void Cluster::AcceptThreadMain() {
+    Logger::Log(LOG_DEBUG, "Cluster: accepting links on port %u", m_listen_port);
+    while (true) {
+        SWBaseSocket::SWBaseError error;
+        SWInetSocket *socket = (SWInetSocket *) m_listen_socket.accept(&error);
+        {
+            std::lock_guard<std::mutex> lock(m_links_mutex);
+            if (m_stop_requested) {
+                delete socket;
+                break;
+            }
+        }
+        if (error != SWBaseSocket::ok) {
+            Logger::Log(LOG_ERROR, "Cluster: accept failed: %s", error.get_error().c_str());
+            continue;
+        }
+        bool busy = false;
+        {
+            std::lock_guard<std::mutex> lock(m_links_mutex);
+            busy = (m_handshakes >= MAX_HANDSHAKES);
+            if (!busy) {
+                m_handshakes++;
+            }
+        }
+        if (busy) {
+            Logger::Log(LOG_WARN, "Cluster: %d handshakes going on already, dropping a connection", MAX_HANDSHAKES);
+            delete socket;
+            continue;
+        }
+        // A node which stays silent must not hold up the others
+        std::thread(&Cluster::HandshakeThreadMain, this, (Transport *) new SocketTransport(socket)).detach();
+    }
+}
+
+void Cluster::HandshakeThreadMain(Transport *transport) {
+    this->AddLink(transport, "");
+
+    std::lock_guard<std::mutex> lock(m_links_mutex);
+    m_handshakes--;
+    m_handshakes_cond.notify_all(); // Under the lock: once Stop() sees 0, the Cluster may be gone
+}
+
+void Cluster::MaintenanceThreadMain() {
+    while (true) {
+        this->ReapDeadLinks();
+
+        // (Re)connect to the configured peers
+        for (const std::string &peer : m_peers) {
+            if (this->IsConnectedTo(peer)) {
+                continue;
+            }
+            size_t colon = peer.rfind(':');
+            std::string host = peer.substr(0, colon);
+            int port = (colon != std::string::npos) ? atoi(peer.c_str() + colon + 1) : 0;
+
+            SWBaseSocket::SWBaseError error;
+            SWInetSocket *socket = new SWInetSocket();
+            if (!socket->connect(port, host, &error)) {
+                Logger::Log(LOG_VERBOSE, "Cluster: cannot connect to %s: %s", peer.c_str(), error.get_error().c_str());
+                delete socket;
+                continue;
+            }
+            this->AddLink(new SocketTransport(socket), peer);
+        }
+
+        // Keep idle links from timing out
+        {
+            std::lock_guard<std::mutex> lock(m_links_mutex);
+            for (ClusterLink *link : m_links) {
+                link->QueueMessage(RoRnet::MSG2_HELLO, m_node_id, 0, 0, "");
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(m_links_mutex);
+        if (m_stop_cond.wait_for(lock, std::chrono::seconds(MAINTENANCE_INTERVAL), [this] { return m_stop_requested; })) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   cluster.h
+/// @brief  Several server nodes sharing one session.
+///
+/// Every node owns the clients connected to it. Whatever a node's Sequencer broadcasts
+/// to its own clients is also sent once over each link to the other nodes, which fan it
+/// out to their clients. Links are RoRnet frames over a `Transport`; the nodes form a
+/// full mesh, each pair connected once (a node connects to the peers it lists in
+/// `cluster-peers` and accepts the others on `cluster-port`). Links are authenticated
+/// with the shared `cluster-key`: the connecting node proves it knows the key for both
+/// sides' nonces and node ids first, then the accepting node does; every frame after
+/// that carries an HMAC with a key derived from the handshake.
+///
+/// User ids of node N are allocated from N * USER_ID_RANGE, so the owning node of
+/// any user can be derived from its id. Once a node used up its range it starts over
+/// at the beginning, skipping the ids still in use.
+
+#pragma once
+
+#include "SocketW.h"
+#include "prerequisites.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ClusterLink;
+
+class Cluster {
+public:
+    static const int USER_ID_RANGE = 100000;
+    static const int MAX_NODE_ID = 255;
+
+    Cluster(Sequencer *sequencer, int node_id);
+    ~Cluster();
+
+    /// @param listen_port Port to accept links from other nodes on, 0 = only connect out.
+    /// @param peers       Nodes to connect to, as "host:port".
+    bool Start(unsigned int listen_port, const std::vector<std::string> &peers);
+    void Stop();
+
+    int GetNodeId() const { return m_node_id; }
+    int GetFirstUserId() const { return m_node_id * USER_ID_RANGE + 1; }
+    int GetLastUserId() const { return (m_node_id + 1) * USER_ID_RANGE - 1; } //!< Then the ids wrap around
+    static int GetNodeOfUser(int uid) { return uid / USER_ID_RANGE; }
+
+    // Called by the Sequencer with its clients-mutex locked
+    void Forward(int type, int uid, unsigned int streamid, unsigned int len, const char *data); //!< To all active links
+    void SendToNode(int node_id, int type, int uid, unsigned int streamid, unsigned int len, const char *data);
+    void ActivateLink(int node_id); //!< Once the node got our snapshot, it also gets live traffic
+
+    // Called by links
+    void OnLinkLost(ClusterLink *link);
+
+private:
+    void AcceptThreadMain();
+    void HandshakeThreadMain(Transport *transport); //!< One per accepted connection
+    void MaintenanceThreadMain();
+    bool AddLink(Transport *transport, const std::string &peer_address); //!< Handshake, takes ownership
+    bool IsConnectedTo(const std::string &peer_address); //!< Through any link to the node there
+    void ReapDeadLinks();
+
+    Sequencer*                m_sequencer;
+    int                       m_node_id;
+    std::vector<std::string>  m_peers;
+    unsigned int              m_listen_port = 0;
+    SWInetSocket              m_listen_socket;
+
+    std::thread               m_accept_thread;
+    std::thread               m_maintenance_thread;
+    std::condition_variable   m_stop_cond;
+    bool                      m_stop_requested = false;
+    int                       m_handshakes = 0; //!< Of accepted connections, still going on
+    std::condition_variable   m_handshakes_cond;
+
+    std::mutex                m_links_mutex; //!< Protects: m_links, m_dead_links, m_peer_nodes, m_stop_requested, m_handshakes
+    std::vector<ClusterLink*> m_links;
+    std::vector<ClusterLink*> m_dead_links;
+    std::map<std::string, int> m_peer_nodes; //!< Node id behind each of `m_peers`, once a handshake told it
+};
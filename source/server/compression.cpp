@@ -0,0 +1,157 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compression.h"
+
+#include "logger.h"
+#include "rornet.h"
+
+#include <atomic>
+#include <chrono>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif // WITH_ZSTD
+
+static std::atomic<uint64_t> s_raw_bytes_out(0);
+static std::atomic<uint64_t> s_compressed_bytes_out(0);
+static std::atomic<uint64_t> s_raw_bytes_in(0);
+static std::atomic<uint64_t> s_compressed_bytes_in(0);
+static std::atomic<uint64_t> s_time_us(0);
+
+#ifdef WITH_ZSTD
+static uint64_t MicrosSince(std::chrono::steady_clock::time_point start) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+#endif // WITH_ZSTD
+
+namespace Compression {
+
+    bool IsAvailable() {
+#ifdef WITH_ZSTD
+        return true;
+#else
+        return false;
+#endif // WITH_ZSTD
+    }
+
+    Stats GetStats() {
+        Stats stats;
+        stats.raw_bytes_out = s_raw_bytes_out;
+        stats.compressed_bytes_out = s_compressed_bytes_out;
+        stats.raw_bytes_in = s_raw_bytes_in;
+        stats.compressed_bytes_in = s_compressed_bytes_in;
+        stats.time_us = s_time_us;
+        return stats;
+    }
+
+} // namespace Compression
+
+StreamCompressor::StreamCompressor(int level) {
+#ifdef WITH_ZSTD
+    m_ctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(m_ctx, ZSTD_c_windowLog, Compression::WINDOW_LOG);
+    // one MSG2_COMPRESSED frame, within the limit of Messaging::SWSendMessage()
+    m_out.resize(RORNET_MAX_MESSAGE_LENGTH - sizeof(RoRnet::Header) - 1);
+#endif // WITH_ZSTD
+}
+
+StreamCompressor::~StreamCompressor() {
+#ifdef WITH_ZSTD
+    ZSTD_freeCCtx(m_ctx);
+#endif // WITH_ZSTD
+}
+
+bool StreamCompressor::Compress(const char *data, size_t len, const FrameSink &sink) {
+#ifdef WITH_ZSTD
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t compressed_len = 0;
+    ZSTD_inBuffer input = {data, len, 0};
+    size_t remaining = 0;
+    do {
+        ZSTD_outBuffer output = {m_out.data(), m_out.size(), 0};
+        remaining = ZSTD_compressStream2(m_ctx, &output, &input, ZSTD_e_flush);
+        if (ZSTD_isError(remaining)) {
+            Logger::Log(LOG_ERROR, "compression failed: %s", ZSTD_getErrorName(remaining));
+            return false;
+        }
+        if (output.pos > 0 && !sink(m_out.data(), (unsigned int) output.pos)) {
+            return false;
+        }
+        compressed_len += output.pos;
+    } while (remaining != 0);
+
+    s_raw_bytes_out += len;
+    s_compressed_bytes_out += compressed_len;
+    s_time_us += MicrosSince(start);
+    return true;
+#else
+    return false;
+#endif // WITH_ZSTD
+}
+
+StreamDecompressor::StreamDecompressor() {
+#ifdef WITH_ZSTD
+    m_ctx = ZSTD_createDCtx();
+    ZSTD_DCtx_setParameter(m_ctx, ZSTD_d_windowLogMax, Compression::WINDOW_LOG);
+#endif // WITH_ZSTD
+}
+
+StreamDecompressor::~StreamDecompressor() {
+#ifdef WITH_ZSTD
+    ZSTD_freeDCtx(m_ctx);
+#endif // WITH_ZSTD
+}
+
+bool StreamDecompressor::Decompress(const char *data, size_t len, std::vector<char> &out) {
+#ifdef WITH_ZSTD
+    const size_t CHUNK_SIZE = 16 * 1024;
+    const auto start = std::chrono::steady_clock::now();
+    const size_t initial_size = out.size();
+    ZSTD_inBuffer input = {data, len, 0};
+    while (true) {
+        const size_t used = out.size();
+        if (used >= Compression::MAX_INFLATED_PENDING) {
+            Logger::Log(LOG_WARN, "decompression exceeds %zu bytes", Compression::MAX_INFLATED_PENDING);
+            return false;
+        }
+        out.resize(used + CHUNK_SIZE);
+        ZSTD_outBuffer output = {out.data() + used, CHUNK_SIZE, 0};
+        size_t result = ZSTD_decompressStream(m_ctx, &output, &input);
+        out.resize(used + output.pos);
+        if (ZSTD_isError(result)) {
+            Logger::Log(LOG_WARN, "decompression failed: %s", ZSTD_getErrorName(result));
+            return false;
+        }
+        if (input.pos == input.size && output.pos < CHUNK_SIZE) {
+            break; // all consumed and nothing left to flush
+        }
+    }
+
+    s_compressed_bytes_in += len;
+    s_raw_bytes_in += out.size() - initial_size;
+    s_time_us += MicrosSince(start);
+    return true;
+#else
+    return false;
+#endif // WITH_ZSTD
+}
@@ -0,0 +1,83 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   compression.h
+/// @brief  zstd streams carried in MSG2_COMPRESSED frames, see RoRnet::CAP_COMPRESS.
+///
+/// Once negotiated, either side may send MSG2_COMPRESSED frames. Their payloads, put
+/// together, form one zstd stream per direction, and that stream decompresses to plain
+/// RoRnet frames, which may span several MSG2_COMPRESSED frames. Every send is flushed.
+/// The context lives as long as the connection, so vehicle state compresses against
+/// the frames sent before it.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace Compression {
+
+    static const int    WINDOW_LOG = 17;                //!< 128 KiB history per direction and connection
+    static const size_t MAX_INFLATED_PENDING = 256 * 1024; //!< Decompressed but not yet processed
+
+    struct Stats {
+        uint64_t raw_bytes_out;
+        uint64_t compressed_bytes_out;
+        uint64_t raw_bytes_in;
+        uint64_t compressed_bytes_in;
+        uint64_t time_us;             //!< Spent compressing and decompressing
+    };
+
+    bool IsAvailable(); //!< False if built without zstd
+
+    Stats GetStats();
+
+} // namespace Compression
+
+class StreamCompressor {
+public:
+    typedef std::function<bool(const char *payload, unsigned int len)> FrameSink; //!< Gets MSG2_COMPRESSED payloads
+
+    explicit StreamCompressor(int level);
+    ~StreamCompressor();
+
+    bool Compress(const char *data, size_t len, const FrameSink &sink); //!< False on error or if the sink fails
+
+private:
+    ZSTD_CCtx_s*      m_ctx = nullptr;
+    std::vector<char> m_out;
+};
+
+class StreamDecompressor {
+public:
+    StreamDecompressor();
+    ~StreamDecompressor();
+
+    /// Appends to `out`; false on corrupt data or if `out` would grow beyond MAX_INFLATED_PENDING
+    bool Decompress(const char *data, size_t len, std::vector<char> &out);
+
+private:
+    ZSTD_DCtx_s* m_ctx = nullptr;
+};
@@ -26,8 +26,12 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "spamfilter.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <map>
+#include <set>
+#include <utility>
 
 #ifdef __GNUC__
 
@@ -79,6 +83,21 @@ static bool s_ranked_only(false);
 static size_t s_max_vehicles(20);
 static int    s_spawn_interval_sec(0);
 static int    s_max_spawn_rate(0);
+static int    s_idle_keepalive_ms(0); // 0 disables idle-stream suppression
+
+static int s_compression_level(1); // 0 = don't offer compression to clients
+
+static unsigned int s_udp_port(0); // 0 = don't offer the UDP channel to clients
+
+static int s_relay_tick_rate(0); // 0 = relay every message immediately
+
+static int s_script_time_budget_ms(500); // 0 = script callbacks may run as long as they like
+static int s_script_max_overruns(3);     // 0 = never disable a callback
+static int s_script_profiling(0);        // 0 = off, 1 = time callbacks, 2 = also sample script lines
+static std::string s_script_profile_file; // empty = report only on request (!scriptprofile)
+static std::string s_script_cache_dir;    // empty = always build scripts from source
+static int s_script_frame_step_ms(200);  // 0 = never call frameStep()
+static int s_script_http_timeout_sec(30); // 0 = curlRequestAsync() may wait forever
 
 static ServerType s_server_mode(SERVER_AUTO);
 
@@ -86,6 +105,25 @@ static int s_spamfilter_msg_interval_sec(0); // 0 disables spamfilter
 static int s_spamfilter_msg_count(0); // 0 disables spamfilter
 static int s_spamfilter_gag_duration_sec(10);
 
+// Traffic capture
+static std::string  s_capture_file; // empty disables capture
+static unsigned int s_capture_segment_size_mib(64);
+static unsigned int s_capture_max_segments(4);
+
+// Cluster
+static int                      s_cluster_node_id(0); // 0 disables clustering
+static unsigned int             s_cluster_port(0);
+static std::vector<std::string> s_cluster_peers;
+static std::string              s_cluster_key;
+
+// Additional sessions; entries are kept raw and applied on top of the global
+// settings in getSessions(), so the order of lines in the config file doesn't matter.
+struct SessionEntries {
+    std::string id;
+    std::vector<std::pair<std::string, std::string>> values;
+};
+static std::vector<SessionEntries> s_session_entries;
+
 // ============================== Functions ===================================
 
 namespace Config {
@@ -129,6 +167,12 @@ namespace Config {
                         " -website <URL>               Sets the website of this server (for the !website command) (optional)\n"
                         " -irc <URL>                   Sets the IRC url for this server (for the !irc command) (optional)\n"
                         " -voip <URL>                  Sets the voip url for this server (for the !voip command) (optional)\n"
+                        " -capture-file <path>         Records all inbound traffic to <path>.N for replay (optional)\n"
+                        " -cluster-node-id <1-255>     Shares the session with other nodes, see README (optional)\n"
+                        " -cluster-port <port>         Port to accept links from other nodes on (optional)\n"
+                        " -cluster-peers <host:port,...> Nodes to link to (optional)\n"
+                        " -cluster-key <secret>        Shared by all nodes, links are authenticated with it (required for clusters)\n"
+                        " -udp-port <port>             Offers clients a UDP channel for vehicle updates (optional)\n"
                         " -help                        Show this list\n");
     }
 
@@ -189,6 +233,46 @@ namespace Config {
             return 0;
         }
 
+        if (getIdleKeepaliveMs() < 0) {
+            Logger::Log(LOG_ERROR, "idle-vehicle-keepalive cannot be negative.");
+            return 0;
+        }
+
+        if (getCompressionLevel() < 0 || getCompressionLevel() > 19) {
+            Logger::Log(LOG_ERROR, "compression-level needs to be between 0 and 19.");
+            return 0;
+        }
+
+        if (getUdpPort() > 65535) {
+            Logger::Log(LOG_ERROR, "udp-port needs to be 65535 or less.");
+            return 0;
+        }
+
+        if (getRelayTickRate() < 0 || getRelayTickRate() > 1000) {
+            Logger::Log(LOG_ERROR, "relay-tick-rate needs to be between 0 and 1000.");
+            return 0;
+        }
+
+        if (getScriptTimeBudgetMs() < 0 || getScriptMaxOverruns() < 0) {
+            Logger::Log(LOG_ERROR, "script-time-budget and script-max-overruns cannot be negative.");
+            return 0;
+        }
+
+        if (getScriptFrameStepMs() < 0) {
+            Logger::Log(LOG_ERROR, "script-frame-step cannot be negative.");
+            return 0;
+        }
+
+        if (getScriptHttpTimeoutSec() < 0) {
+            Logger::Log(LOG_ERROR, "script-http-timeout cannot be negative.");
+            return 0;
+        }
+
+        if (getScriptProfiling() < 0 || getScriptProfiling() > 2) {
+            Logger::Log(LOG_ERROR, "script-profiling needs to be 0, 1 or 2.");
+            return 0;
+        }
+
         SpamFilter::CheckConfig();
 
         Logger::Log(LOG_INFO, "server is%s password protected",
@@ -197,6 +281,57 @@ namespace Config {
         Logger::Log(LOG_INFO, "server is%s ranked-only mode",
                     getRankedOnly() ? "" : " NOT");
 
+        if (getClusterNodeId() != 0) {
+            if (getClusterNodeId() < 1 || getClusterNodeId() > 255) {
+                Logger::Log(LOG_ERROR, "cluster-node-id needs to be 1 or more, and 255 or less.");
+                return 0;
+            }
+            if (getClusterPort() == 0 && getClusterPeers().empty()) {
+                Logger::Log(LOG_ERROR, "cluster node needs a cluster-port, cluster-peers or both.");
+                return 0;
+            }
+            if (getClusterKey().empty()) {
+                Logger::Log(LOG_ERROR, "cluster node needs a cluster-key, the same on all nodes.");
+                return 0;
+            }
+            Logger::Log(LOG_INFO, "cluster:    node %d, port %u, %zu peer(s)", getClusterNodeId(), getClusterPort(),
+                        getClusterPeers().size());
+        }
+
+        std::set<std::string> session_ids;
+        std::map<unsigned int, SessionConfig> first_session_of_port;
+        for (const SessionConfig &session : getSessions()) {
+            if (!session_ids.insert(session.id).second) {
+                Logger::Log(LOG_ERROR, "session '%s' is defined more than once", session.id.c_str());
+                return 0;
+            }
+            // Clients are greeted with the first session of the port, including whether it has a password
+            auto first = first_session_of_port.insert(std::make_pair(session.listen_port, session)).first;
+            if (first->second.public_password != session.public_password) {
+                Logger::Log(LOG_ERROR, "session '%s' shares port %u with session '%s', it needs the same password.",
+                            session.id.c_str(), session.listen_port, first->second.id.c_str());
+                return 0;
+            }
+            if (session.id == "default") {
+                continue; // Checked above
+            }
+            if (session.terrain_name.empty()) {
+                Logger::Log(LOG_ERROR, "session '%s': terrain not specified", session.id.c_str());
+                return 0;
+            }
+            if (session.max_clients < 2 || session.max_clients > 64) {
+                Logger::Log(LOG_ERROR, "session '%s': max clients need to 2 or more, and 64 or less.",
+                            session.id.c_str());
+                return 0;
+            }
+            if (session.max_vehicles < 1) {
+                Logger::Log(LOG_ERROR, "session '%s': the vehicle-limit cannot be less than 1!", session.id.c_str());
+                return 0;
+            }
+            Logger::Log(LOG_INFO, "session:    %s (terrain %s, port %u, %u clients)", session.id.c_str(),
+                        session.terrain_name.c_str(), session.listen_port, session.max_clients);
+        }
+
         return getMaxClients() && getListenPort() && !getIPAddr().empty() &&
                !getTerrainName().empty();
     }
@@ -262,6 +397,12 @@ namespace Config {
             HANDLE_ARG_VALUE("website", { setWebsite(value); });
             HANDLE_ARG_VALUE("irc", { setIRC(value); });
             HANDLE_ARG_VALUE("voip", { setVoIP(value); });
+            HANDLE_ARG_VALUE("capture-file", { setCaptureFile(value); });
+            HANDLE_ARG_VALUE("cluster-node-id", { setClusterNodeId(atoi(value)); });
+            HANDLE_ARG_VALUE("cluster-port", { setClusterPort(atoi(value)); });
+            HANDLE_ARG_VALUE("cluster-peers", { setClusterPeers(value); });
+            HANDLE_ARG_VALUE("cluster-key", { setClusterKey(value); });
+            HANDLE_ARG_VALUE("udp-port", { setUdpPort(atoi(value)); });
             HANDLE_ARG_VALUE("config-file", { config_file = value; });
             HANDLE_ARG_VALUE("c", { config_file = value; });
 
@@ -359,12 +500,117 @@ namespace Config {
 
     int getMaxSpawnRate() { return s_max_spawn_rate; }
 
+    int getIdleKeepaliveMs() { return s_idle_keepalive_ms; }
+
+    int getCompressionLevel() { return s_compression_level; }
+
+    unsigned int getUdpPort() { return s_udp_port; }
+
+    int getRelayTickRate() { return s_relay_tick_rate; }
+
+    int getScriptTimeBudgetMs() { return s_script_time_budget_ms; }
+
+    int getScriptMaxOverruns() { return s_script_max_overruns; }
+
+    int getScriptProfiling() { return s_script_profiling; }
+
+    const std::string &getScriptProfileFile() { return s_script_profile_file; }
+
+    const std::string &getScriptCacheDir() { return s_script_cache_dir; }
+
+    int getScriptFrameStepMs() { return s_script_frame_step_ms; }
+
+    int getScriptHttpTimeoutSec() { return s_script_http_timeout_sec; }
+
     int getSpamFilterMsgIntervalSec() { return s_spamfilter_msg_interval_sec; }
 
     int getSpamFilterMsgCount() { return s_spamfilter_msg_count; }
 
     int getSpamFilterGagDurationSec() { return s_spamfilter_gag_duration_sec; }
 
+    const std::string &getCaptureFile() { return s_capture_file; }
+
+    unsigned int getCaptureSegmentSizeMiB() { return s_capture_segment_size_mib; }
+
+    unsigned int getCaptureMaxSegments() { return s_capture_max_segments; }
+
+    int getClusterNodeId() { return s_cluster_node_id; }
+
+    unsigned int getClusterPort() { return s_cluster_port; }
+
+    const std::vector<std::string> &getClusterPeers() { return s_cluster_peers; }
+
+    const std::string &getClusterKey() { return s_cluster_key; }
+
+    SessionConfig getDefaultSession() {
+        SessionConfig session;
+        session.id                 = "default";
+        session.server_name        = s_server_name;
+        session.terrain_name       = s_terrain_name;
+        session.public_password    = s_public_password;
+        session.script_name        = s_scriptname;
+        session.motd_file          = s_motdfile;
+        session.rules_file         = s_rulesfile;
+        session.blacklist_file     = s_blacklistfile;
+        session.listen_port        = s_listen_port;
+        session.max_clients        = s_max_clients;
+        session.max_vehicles       = s_max_vehicles;
+        session.spawn_interval_sec = s_spawn_interval_sec;
+        session.max_spawn_rate     = s_max_spawn_rate;
+        session.idle_keepalive_ms  = s_idle_keepalive_ms;
+        return session;
+    }
+
+    static bool ApplySessionValue(SessionConfig &session, const std::string &key, const std::string &value) {
+        if (key == "name") { session.server_name = value; }
+        else if (key == "terrain") { session.terrain_name = value; }
+        else if (key == "scriptname") { session.script_name = value; }
+        else if (key == "motdfile") { session.motd_file = value; }
+        else if (key == "rulesfile") { session.rules_file = value; }
+        else if (key == "blacklistfile") { session.blacklist_file = value; }
+        else if (key == "port") { session.listen_port = atoi(value.c_str()); }
+        else if (key == "slots") { session.max_clients = atoi(value.c_str()); }
+        else if (key == "vehiclelimit") { session.max_vehicles = atoi(value.c_str()); }
+        else if (key == "vehicle-spawn-interval") { session.spawn_interval_sec = atoi(value.c_str()); }
+        else if (key == "vehicle-max-spawn-rate") { session.max_spawn_rate = atoi(value.c_str()); }
+        else if (key == "idle-vehicle-keepalive") { session.idle_keepalive_ms = atoi(value.c_str()); }
+        else if (key == "password") {
+            session.public_password.clear();
+            if (!value.empty() && !SHA1FromString(session.public_password, value)) {
+                Logger::Log(LOG_ERROR, "could not generate SHA1 password hash for session '%s'!", session.id.c_str());
+                return false;
+            }
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<SessionConfig> getSessions() {
+        std::vector<SessionConfig> sessions;
+        sessions.push_back(getDefaultSession());
+        for (const SessionEntries &entries : s_session_entries) {
+            SessionConfig session = sessions.front(); // Inherit the global settings
+            session.id = entries.id;
+            if (!session.blacklist_file.empty()) {
+                session.blacklist_file += "." + entries.id; // Bans are per session
+            }
+            for (const auto &entry : entries.values) {
+                if (!ApplySessionValue(session, entry.first, entry.second)) {
+                    Logger::Log(LOG_WARN, "Unknown key 'session.%s.%s' (value: '%s') in config file.",
+                                entries.id.c_str(), entry.first.c_str(), entry.second.c_str());
+                }
+            }
+            if (session.listen_port == 0) {
+                session.listen_port = s_listen_port; // Shares the main port, routed by `session=<id>`
+            }
+            session.index = (unsigned int) sessions.size();
+            sessions.push_back(session);
+        }
+        return sessions;
+    }
+
     bool setScriptName(const std::string &name) {
         if (name.empty()) return false;
         s_scriptname = name;
@@ -428,6 +674,28 @@ namespace Config {
 
     void setMaxSpawnRate(int num) { s_max_spawn_rate = num; }
 
+    void setIdleKeepaliveMs(int ms) { s_idle_keepalive_ms = ms; }
+
+    void setCompressionLevel(int level) { s_compression_level = level; }
+
+    void setUdpPort(unsigned int port) { s_udp_port = port; }
+
+    void setRelayTickRate(int hz) { s_relay_tick_rate = hz; }
+
+    void setScriptTimeBudgetMs(int ms) { s_script_time_budget_ms = ms; }
+
+    void setScriptMaxOverruns(int num) { s_script_max_overruns = num; }
+
+    void setScriptProfiling(int level) { s_script_profiling = level; }
+
+    void setScriptProfileFile(const std::string &file) { s_script_profile_file = file; }
+
+    void setScriptCacheDir(const std::string &dir) { s_script_cache_dir = dir; }
+
+    void setScriptFrameStepMs(int ms) { s_script_frame_step_ms = ms; }
+
+    void setScriptHttpTimeoutSec(int sec) { s_script_http_timeout_sec = sec; }
+
     void setOwner(const std::string &owner) { s_owner = owner; }
 
     void setForeground(bool value) { s_foreground = value; }
@@ -446,6 +714,23 @@ namespace Config {
 
     void setSpamFilterGagDurationSec(int sec) { s_spamfilter_gag_duration_sec = sec; }
 
+    void setCaptureFile(const std::string &file) { s_capture_file = file; }
+
+    void setCaptureSegmentSizeMiB(unsigned int mib) { s_capture_segment_size_mib = mib; }
+
+    void setCaptureMaxSegments(unsigned int num) { s_capture_max_segments = num; }
+
+    void setClusterNodeId(int id) { s_cluster_node_id = id; }
+
+    void setClusterPort(unsigned int port) { s_cluster_port = port; }
+
+    void setClusterPeers(const std::string &peers) {
+        s_cluster_peers.clear();
+        tokenize(peers, s_cluster_peers, ", ");
+    }
+
+    void setClusterKey(const std::string &key) { s_cluster_key = key; }
+
     void setHeartbeatIntervalSec(unsigned sec) {
         s_heartbeat_interval_sec = sec;
         Logger::Log(LOG_VERBOSE, "Hearbeat interval is %d seconds", sec);
@@ -490,6 +775,25 @@ namespace Config {
 #define VAL_INT(_STR_) (atoi(value)) // Cloned from RudeConfig we used before. #compatibility
 #define VAL_BOOL(_STR_)(RudeStrToBool(value))
 
+    void ProcessSessionEntry(const char *key, const char *value) {
+        // Format: `session.<id>.<key>`
+        const char *id_start = key + strlen("session.");
+        const char *id_end = strchr(id_start, '.');
+        if (id_end == nullptr || id_end == id_start || id_end[1] == '\0') {
+            Logger::Log(LOG_WARN, "Invalid session key '%s' (value: '%s') in config file.", key, value);
+            return;
+        }
+
+        const std::string id(id_start, id_end);
+        auto itor = std::find_if(s_session_entries.begin(), s_session_entries.end(),
+                                 [&id](const SessionEntries &entries) { return entries.id == id; });
+        if (itor == s_session_entries.end()) {
+            itor = s_session_entries.insert(s_session_entries.end(), SessionEntries());
+            itor->id = id;
+        }
+        itor->values.push_back(std::make_pair(std::string(id_end + 1), VAL_STR(value)));
+    }
+
     void ProcessConfigEntry(const char *key, const char *value) {
         if (strcmp(key, "baseconfig") == 0) { LoadConfigFile(VAL_STR (value)); }
         else if (strcmp(key, "slots") == 0) { setMaxClients(VAL_INT (value)); }
@@ -523,12 +827,37 @@ namespace Config {
         else if (strcmp(key, "vehiclelimit") == 0) { setMaxVehicles(VAL_INT (value)); }
         else if (strcmp(key, "vehicle-spawn-interval") == 0) { setSpawnIntervalSec(VAL_INT (value)); }
         else if (strcmp(key, "vehicle-max-spawn-rate") == 0) { setMaxSpawnRate(VAL_INT (value)); }
+        else if (strcmp(key, "idle-vehicle-keepalive") == 0) { setIdleKeepaliveMs(VAL_INT (value)); }
+        else if (strcmp(key, "compression-level") == 0) { setCompressionLevel(VAL_INT (value)); }
+        else if (strcmp(key, "udp-port") == 0) { setUdpPort(VAL_INT (value)); }
+        else if (strcmp(key, "relay-tick-rate") == 0) { setRelayTickRate(VAL_INT (value)); }
+        else if (strcmp(key, "script-time-budget") == 0) { setScriptTimeBudgetMs(VAL_INT (value)); }
+        else if (strcmp(key, "script-max-overruns") == 0) { setScriptMaxOverruns(VAL_INT (value)); }
+        else if (strcmp(key, "script-profiling") == 0) { setScriptProfiling(VAL_INT (value)); }
+        else if (strcmp(key, "script-profile-file") == 0) { setScriptProfileFile(VAL_STR (value)); }
+        else if (strcmp(key, "script-cache-dir") == 0) { setScriptCacheDir(VAL_STR (value)); }
+        else if (strcmp(key, "script-frame-step") == 0) { setScriptFrameStepMs(VAL_INT (value)); }
+        else if (strcmp(key, "script-http-timeout") == 0) { setScriptHttpTimeoutSec(VAL_INT (value)); }
 
         // Spam filter
         else if (strcmp(key, "spamfilter-msg-interval") == 0) { setSpamFilterMsgIntervalSec(VAL_INT(value)); }
         else if (strcmp(key, "spamfilter-msg-count")    == 0) { setSpamFilterMsgCount(VAL_INT(value)); }
         else if (strcmp(key, "spamfilter-gag-duration") == 0) { setSpamFilterGagDurationSec(VAL_INT(value)); }
 
+        // Traffic capture
+        else if (strcmp(key, "capture-file")         == 0) { setCaptureFile(VAL_STR(value)); }
+        else if (strcmp(key, "capture-segment-size") == 0) { setCaptureSegmentSizeMiB(VAL_INT(value)); }
+        else if (strcmp(key, "capture-segments")     == 0) { setCaptureMaxSegments(VAL_INT(value)); }
+
+        // Cluster
+        else if (strcmp(key, "cluster-node-id") == 0) { setClusterNodeId(VAL_INT(value)); }
+        else if (strcmp(key, "cluster-port")    == 0) { setClusterPort(VAL_INT(value)); }
+        else if (strcmp(key, "cluster-peers")   == 0) { setClusterPeers(VAL_STR(value)); }
+        else if (strcmp(key, "cluster-key")     == 0) { setClusterKey(VAL_STR(value)); }
+
+        // Sessions
+        else if (strncmp(key, "session.", strlen("session.")) == 0) { ProcessSessionEntry(key, value); }
+
         else {
             Logger::Log(LOG_WARN, "Unknown key '%s' (value: '%s') in config file.", key, value);
         }
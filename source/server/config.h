@@ -22,6 +22,8 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "UnicodeStrings.h"
 
+#include <vector>
+
 // server modes
 enum ServerType {
     SERVER_LAN = 0,
@@ -29,6 +31,30 @@ enum ServerType {
     SERVER_AUTO
 };
 
+/// Settings of one session (terrain room) hosted by the process.
+/// The first session is built from the global settings, additional ones are
+/// declared in the config file as `session.<id>.<key> = <value>`.
+struct SessionConfig {
+    std::string  id;                        //!< Clients select it with `session=<id>` in UserInfo::sessionoptions
+    unsigned int index = 0;                 //!< Position in Config::getSessions(), 0 = default; tells sessions apart in captures
+    std::string  server_name;
+    std::string  terrain_name;
+    std::string  public_password;           //!< SHA1 hash, empty if none
+    std::string  script_name;               //!< Empty disables scripting
+    std::string  motd_file;
+    std::string  rules_file;
+    std::string  blacklist_file;
+    unsigned int listen_port = 0;
+    unsigned int max_clients = 16;
+    unsigned int max_vehicles = 20;
+    int          spawn_interval_sec = 0;
+    int          max_spawn_rate = 0;
+    int          idle_keepalive_ms = 0;     //!< 0 = relay every frame of parked vehicles
+
+    bool isPublic() const { return !public_password.empty(); }
+    bool getEnableScripting() const { return !script_name.empty(); }
+};
+
 namespace Config {
 
 //! runs a check that all the required fields are present
@@ -106,10 +132,41 @@ namespace Config {
     int getSpawnIntervalSec();
     int getMaxSpawnRate();
 
+    int getIdleKeepaliveMs();
+
+    int getCompressionLevel();
+
+    unsigned int getUdpPort();
+
+    int getRelayTickRate();
+
+    int getScriptTimeBudgetMs();
+    int getScriptMaxOverruns();
+    int getScriptProfiling();
+    const std::string &getScriptProfileFile();
+    const std::string &getScriptCacheDir();
+    int getScriptFrameStepMs();
+    int getScriptHttpTimeoutSec();
+
     // Spam filter
     int getSpamFilterMsgIntervalSec();
     int getSpamFilterMsgCount();
     int getSpamFilterGagDurationSec();
+
+    // Traffic capture
+    const std::string &getCaptureFile();
+    unsigned int getCaptureSegmentSizeMiB();
+    unsigned int getCaptureMaxSegments();
+
+    // Cluster
+    int getClusterNodeId(); //!< 0 = not clustered
+    unsigned int getClusterPort();
+    const std::vector<std::string> &getClusterPeers();
+    const std::string &getClusterKey(); //!< Shared secret of the nodes
+
+    // Sessions
+    SessionConfig getDefaultSession(); //!< The session described by the global settings
+    std::vector<SessionConfig> getSessions(); //!< Default session first, then the ones from `session.*` entries
 //!@}
 
 //! setter functions
@@ -163,10 +220,37 @@ namespace Config {
     void setSpawnIntervalSec(int sec);
     void setMaxSpawnRate(int num);
 
+    void setIdleKeepaliveMs(int ms);
+
+    void setCompressionLevel(int level);
+
+    void setUdpPort(unsigned int port);
+
+    void setRelayTickRate(int hz);
+
+    void setScriptTimeBudgetMs(int ms);
+    void setScriptMaxOverruns(int num);
+    void setScriptProfiling(int level);
+    void setScriptProfileFile(const std::string &file);
+    void setScriptCacheDir(const std::string &dir);
+    void setScriptFrameStepMs(int ms);
+    void setScriptHttpTimeoutSec(int sec);
+
     // Spam filter
     void setSpamFilterMsgIntervalSec(int sec);
     void setSpamFilterMsgCount(int count);
     void setSpamFilterGagDurationSec(int sec);
+
+    // Traffic capture
+    void setCaptureFile(const std::string &file);
+    void setCaptureSegmentSizeMiB(unsigned int mib);
+    void setCaptureMaxSegments(unsigned int num);
+
+    // Cluster
+    void setClusterNodeId(int id);
+    void setClusterPort(unsigned int port);
+    void setClusterPeers(const std::string &peers); //!< Comma separated "host:port" list
+    void setClusterKey(const std::string &key);
 //!@}
 
 } // namespace Config
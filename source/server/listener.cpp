@@ -24,6 +24,7 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "messaging.h"
 #include "sequencer.h"
 #include "SocketW.h"
+#include "transport.h"
 #include "logger.h"
 #include "config.h"
 #include "UnicodeStrings.h"
@@ -40,8 +41,46 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #endif
 
 
-Listener::Listener(Sequencer *sequencer) :
-        m_sequencer(sequencer) {
+static void FillServerInfo(const SessionConfig &config, RoRnet::ServerInfo &settings) {
+    std::string motd_str;
+    {
+        std::vector<std::string> lines;
+        if (!Utils::ReadLinesFromFile(config.motd_file, lines))
+        {
+            for (const auto& line : lines)
+                motd_str += line + "\n";
+        }
+    }
+
+    memset(&settings, 0, sizeof(RoRnet::ServerInfo));
+    settings.has_password = config.isPublic();
+    strncpy(settings.info, motd_str.c_str(), sizeof(settings.info) - 1);
+    strncpy(settings.protocolversion, RORNET_VERSION, strlen(RORNET_VERSION));
+    strncpy(settings.servername, config.server_name.c_str(), sizeof(settings.servername) - 1);
+    strncpy(settings.terrain, config.terrain_name.c_str(), sizeof(settings.terrain) - 1);
+}
+
+Listener::Listener(Sequencer *sequencer) {
+    m_sessions.push_back(sequencer);
+}
+
+void Listener::AddSession(Sequencer *sequencer) {
+    m_sessions.push_back(sequencer);
+}
+
+Sequencer* Listener::FindSession(const RoRnet::UserInfo &user) {
+    auto options = Utils::ParseSessionOptions(user.sessionoptions, sizeof(user.sessionoptions));
+    auto found = options.find("session");
+    if (found == options.end()) {
+        return m_sessions.front();
+    }
+    for (Sequencer *session : m_sessions) {
+        if (session->GetConfig().id == found->second) {
+            return session;
+        }
+    }
+    Logger::Log(LOG_WARN, "Listener: unknown session '%s' requested, using the default one", found->second.c_str());
+    return m_sessions.front();
 }
 
 bool Listener::Initialize() {
@@ -54,7 +93,7 @@ bool Listener::Initialize() {
 
     // Start listening on the socket
     SWBaseSocket::SWBaseError error;
-    m_listen_socket.bind(Config::getListenPort(), &error);
+    m_listen_socket.bind(m_sessions.front()->GetConfig().listen_port, &error);
     if (error != SWBaseSocket::ok) {
         Logger::Log(LOG_ERROR, "FATAL Listerer: %s", error.get_error().c_str());
         return false;
@@ -97,137 +136,139 @@ void Listener::ThreadMain() {
             } else {
                 Logger::Log(LOG_ERROR, "ERROR Listener: %s", error.get_error().c_str());
             }
+            continue;
         }
 
         Logger::Log(LOG_VERBOSE, "Listener got a new connection");
+        this->HandleConnection(new SocketTransport(ts));
+    }
+}
 
-        ts->set_timeout(5, 0);
-
-        //receive a magic
-        int type;
-        int source;
-        unsigned int len;
-        unsigned int streamid;
-        char buffer[RORNET_MAX_MESSAGE_LENGTH];
-
-        try {
-            // this is the start of it all, it all starts with a simple hello
-            if (Messaging::SWReceiveMessage(ts, &type, &source, &streamid, &len,
-                                            buffer, RORNET_MAX_MESSAGE_LENGTH))
-                throw std::runtime_error("ERROR Listener: receiving first message");
-
-            // make sure our first message is a hello message
-            if (type != RoRnet::MSG2_HELLO) {
-                Messaging::SWSendMessage(ts, RoRnet::MSG2_WRONG_VER, 0, 0, 0, 0);
-                throw std::runtime_error("ERROR Listener: protocol error");
-            }
+void Listener::HandleConnection(Transport *transport) {
+    transport->SetTimeout(5);
+
+    //receive a magic
+    int type;
+    int source;
+    unsigned int len;
+    unsigned int streamid;
+    char buffer[RORNET_MAX_MESSAGE_LENGTH];
+
+    try {
+        // this is the start of it all, it all starts with a simple hello
+        if (Messaging::SWReceiveMessage(transport, &type, &source, &streamid, &len,
+                                        buffer, RORNET_MAX_MESSAGE_LENGTH))
+            throw std::runtime_error("ERROR Listener: receiving first message");
+
+        // make sure our first message is a hello message
+        if (type != RoRnet::MSG2_HELLO) {
+            Messaging::SWSendMessage(transport, RoRnet::MSG2_WRONG_VER, 0, 0, 0, 0);
+            throw std::runtime_error("ERROR Listener: protocol error");
+        }
 
-            // check client version
-            if (source == 5000 && (std::string(buffer) == "MasterServer")) {
-                Logger::Log(LOG_VERBOSE, "Master Server knocked ...");
-                // send back some information, then close socket
-                char tmp[2048] = "";
-                sprintf(tmp, "protocol:%s\nrev:%s\nbuild_on:%s_%s\n", RORNET_VERSION, VERSION, __DATE__, __TIME__);
-                if (Messaging::SWSendMessage(ts, RoRnet::MSG2_MASTERINFO, 0, 0, (unsigned int) strlen(tmp), tmp)) {
-                    throw std::runtime_error("ERROR Listener: sending master info");
-                }
-                // close socket
-                ts->disconnect(&error);
-                delete ts;
-                continue;
+        // check client version
+        if (source == 5000 && (std::string(buffer) == "MasterServer")) {
+            Logger::Log(LOG_VERBOSE, "Master Server knocked ...");
+            // send back some information, then close socket
+            char tmp[2048] = "";
+            sprintf(tmp, "protocol:%s\nrev:%s\nbuild_on:%s_%s\n", RORNET_VERSION, VERSION, __DATE__, __TIME__);
+            if (Messaging::SWSendMessage(transport, RoRnet::MSG2_MASTERINFO, 0, 0, (unsigned int) strlen(tmp), tmp)) {
+                throw std::runtime_error("ERROR Listener: sending master info");
             }
+            // close socket
+            transport->Disconnect();
+            delete transport;
+            return;
+        }
 
-            // compare the versions if they are compatible
-            if (strncmp(buffer, RORNET_VERSION, strlen(RORNET_VERSION))) {
-                // not compatible
-                Messaging::SWSendMessage(ts, RoRnet::MSG2_WRONG_VER, 0, 0, 0, 0);
-                throw std::runtime_error("ERROR Listener: bad version: " + std::string(buffer) + ". rejecting ...");
-            }
+        // compare the versions if they are compatible
+        if (strncmp(buffer, RORNET_VERSION, strlen(RORNET_VERSION))) {
+            // not compatible
+            Messaging::SWSendMessage(transport, RoRnet::MSG2_WRONG_VER, 0, 0, 0, 0);
+            throw std::runtime_error("ERROR Listener: bad version: " + std::string(buffer) + ". rejecting ...");
+        }
 
-            // compatible version, continue to send server settings
-            std::string motd_str;
-            {
-                std::vector<std::string> lines;
-                if (!Utils::ReadLinesFromFile(Config::getMOTDFile(), lines))
-                {
-                    for (const auto& line : lines)
-                        motd_str += line + "\n";
-                }
-            }
+        // compatible version, continue to send server settings (of the default session,
+        // the client only tells us which session it wants in the user info)
+        Logger::Log(LOG_DEBUG, "Listener sending server settings");
+        RoRnet::ServerInfo settings;
+        FillServerInfo(m_sessions.front()->GetConfig(), settings);
+
+        if (Messaging::SWSendMessage(transport, RoRnet::MSG2_HELLO, 0, 0, (unsigned int) sizeof(RoRnet::ServerInfo),
+                                   (char *) &settings))
+            throw std::runtime_error("ERROR Listener: sending version");
+
+        //receive user infos
+        if (Messaging::SWReceiveMessage(transport, &type, &source, &streamid, &len,
+                                        buffer,
+                                        RORNET_MAX_MESSAGE_LENGTH)) {
+            std::stringstream error_msg;
+            error_msg << "ERROR Listener: receiving user infos\n"
+                      << "ERROR Listener: got that: "
+                      << type;
+            throw std::runtime_error(error_msg.str());
+        }
 
-            Logger::Log(LOG_DEBUG, "Listener sending server settings");
-            RoRnet::ServerInfo settings;
-            memset(&settings, 0, sizeof(RoRnet::ServerInfo));
-            settings.has_password = !Config::getPublicPassword().empty();
-            strncpy(settings.info, motd_str.c_str(), motd_str.size());
-            strncpy(settings.protocolversion, RORNET_VERSION, strlen(RORNET_VERSION));
-            strncpy(settings.servername, Config::getServerName().c_str(), Config::getServerName().size());
-            strncpy(settings.terrain, Config::getTerrainName().c_str(), Config::getTerrainName().size());
-
-            if (Messaging::SWSendMessage(ts, RoRnet::MSG2_HELLO, 0, 0, (unsigned int) sizeof(RoRnet::ServerInfo),
-                                       (char *) &settings))
-                throw std::runtime_error("ERROR Listener: sending version");
-
-            //receive user infos
-            if (Messaging::SWReceiveMessage(ts, &type, &source, &streamid, &len,
-                                            buffer,
-                                            RORNET_MAX_MESSAGE_LENGTH)) {
-                std::stringstream error_msg;
-                error_msg << "ERROR Listener: receiving user infos\n"
-                          << "ERROR Listener: got that: "
-                          << type;
-                throw std::runtime_error(error_msg.str());
-            }
+        if (type != RoRnet::MSG2_USER_INFO)
+            throw std::runtime_error("Warning Listener: no user name");
 
-            if (type != RoRnet::MSG2_USER_INFO)
-                throw std::runtime_error("Warning Listener: no user name");
-
-            if (len > sizeof(RoRnet::UserInfo))
-                throw std::runtime_error("Error: did not receive proper user credentials");
-            Logger::Log(LOG_INFO, "Listener creating a new client...");
-
-            RoRnet::UserInfo *user = (RoRnet::UserInfo *) buffer;
-            user->authstatus = RoRnet::AUTH_NONE;
-
-            // authenticate
-            user->username[RORNET_MAX_USERNAME_LEN - 1] = 0;
-            std::string nickname = Str::SanitizeUtf8(user->username);
-            user->authstatus = m_sequencer->AuthorizeNick(std::string(user->usertoken, 40), nickname);
-            strncpy(user->username, nickname.c_str(), RORNET_MAX_USERNAME_LEN - 1);
-
-            if (Config::isPublic()) {
-                Logger::Log(LOG_DEBUG, "password login: %s == %s?",
-                            Config::getPublicPassword().c_str(),
-                            std::string(user->serverpassword, 40).c_str());
-                if (strncmp(Config::getPublicPassword().c_str(), user->serverpassword, 40)) {
-                    Messaging::SWSendMessage(ts, RoRnet::MSG2_WRONG_PW, 0, 0, 0, 0);
-                    throw std::runtime_error("ERROR Listener: wrong password");
-                }
-
-                Logger::Log(LOG_DEBUG, "user used the correct password, "
-                        "creating client!");
-            } else {
-                Logger::Log(LOG_DEBUG, "no password protection, creating client");
-            }
+        if (len > sizeof(RoRnet::UserInfo))
+            throw std::runtime_error("Error: did not receive proper user credentials");
+        Logger::Log(LOG_INFO, "Listener creating a new client...");
+
+        RoRnet::UserInfo *user = (RoRnet::UserInfo *) buffer;
+        user->authstatus = RoRnet::AUTH_NONE;
 
-            if (Config::getRankedOnly()) {
-                Logger::Log(LOG_DEBUG, "ranked-only server: checking user status");
-                if (user->authstatus == RoRnet::AUTH_NONE) {
-                    Logger::Log(LOG_DEBUG, "ranked-only server: rejecting non-ranked user");
-                    Messaging::SWSendMessage(ts, RoRnet::MSG2_NO_RANK, 0, 0, 0, 0);
-                    throw std::runtime_error("ERROR Listener: no auth status");
-                }
+        Sequencer *session = this->FindSession(*user);
+        const SessionConfig &config = session->GetConfig();
+
+        // authenticate
+        user->username[RORNET_MAX_USERNAME_LEN - 1] = 0;
+        std::string nickname = Str::SanitizeUtf8(user->username);
+        user->authstatus = session->AuthorizeNick(std::string(user->usertoken, 40), nickname);
+        strncpy(user->username, nickname.c_str(), RORNET_MAX_USERNAME_LEN - 1);
+
+        if (config.isPublic()) {
+            Logger::Log(LOG_DEBUG, "password login: %s == %s?",
+                        config.public_password.c_str(),
+                        std::string(user->serverpassword, 40).c_str());
+            if (strncmp(config.public_password.c_str(), user->serverpassword, 40)) {
+                Messaging::SWSendMessage(transport, RoRnet::MSG2_WRONG_PW, 0, 0, 0, 0);
+                throw std::runtime_error("ERROR Listener: wrong password");
             }
 
-            //create a new client
-            m_sequencer->createClient(ts, *user); // copy the user info, since the buffer will be cleared soon
-            Logger::Log(LOG_DEBUG, "listener returned!");
+            Logger::Log(LOG_DEBUG, "user used the correct password, "
+                    "creating client!");
+        } else {
+            Logger::Log(LOG_DEBUG, "no password protection, creating client");
+        }
+
+        if (Config::getRankedOnly()) {
+            Logger::Log(LOG_DEBUG, "ranked-only server: checking user status");
+            if (user->authstatus == RoRnet::AUTH_NONE) {
+                Logger::Log(LOG_DEBUG, "ranked-only server: rejecting non-ranked user");
+                Messaging::SWSendMessage(transport, RoRnet::MSG2_NO_RANK, 0, 0, 0, 0);
+                throw std::runtime_error("ERROR Listener: no auth status");
+            }
         }
-        catch (std::runtime_error &e) {
-            Logger::Log(LOG_ERROR, e.what());
-            ts->disconnect(&error);
-            delete ts;
+
+        // the client was greeted with the default session's settings, correct them
+        if (session != m_sessions.front()) {
+            Logger::Log(LOG_DEBUG, "Listener sending settings of session '%s'", config.id.c_str());
+            FillServerInfo(config, settings);
+            if (Messaging::SWSendMessage(transport, RoRnet::MSG2_SERVER_SETTINGS, 0, 0,
+                                         (unsigned int) sizeof(RoRnet::ServerInfo), (char *) &settings))
+                throw std::runtime_error("ERROR Listener: sending session settings");
         }
+
+        //create a new client
+        session->createClient(transport, *user); // copy the user info, since the buffer will be cleared soon
+        Logger::Log(LOG_DEBUG, "listener returned!");
+    }
+    catch (std::runtime_error &e) {
+        Logger::Log(LOG_ERROR, e.what());
+        transport->Disconnect();
+        delete transport;
     }
 }
 
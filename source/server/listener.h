@@ -22,9 +22,11 @@
 
 #include "SocketW.h"
 #include "prerequisites.h"
+#include "rornet.h"
 
 #include <mutex>
 #include <thread>
+#include <vector>
 
 class Listener {
 private:
@@ -39,15 +41,24 @@ private:
     ThreadState  m_thread_state = ThreadState::NOT_RUNNING;
     std::mutex   m_mutex;
     std::thread  m_thread;
-    Sequencer*   m_sequencer = nullptr;
+    std::vector<Sequencer*> m_sessions; //!< Served on this port; the first one is the default
 
     void ThreadMain();
     ThreadState GetThreadState();
+    Sequencer* FindSession(const RoRnet::UserInfo &user);
 
 public:
     Listener(Sequencer *sequencer);
 
+    /// Hosts another session on the same port; clients pick it with `session=<id>`
+    /// in their session options. Must be called before Initialize().
+    void AddSession(Sequencer *sequencer);
+
     bool Initialize();
     void Shutdown();
+
+    /// Performs the handshake and hands the connection over to the sequencer;
+    /// takes ownership of `transport`. Also used by tools to connect in-process clients.
+    void HandleConnection(Transport *transport);
 };
 
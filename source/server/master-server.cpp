@@ -34,15 +34,15 @@ namespace MasterServer {
             m_trust_level(-1),
             m_is_registered(false) {}
 
-    bool Client::Register() {
+    bool Client::Register(const SessionConfig &session) {
         Json::Value data(Json::objectValue);
         data["ip"] = Config::getIPAddr();
-        data["port"] = Config::getListenPort();
-        data["name"] = Config::getServerName();
-        data["terrain-name"] = Config::getTerrainName();
-        data["max-clients"] = Config::getMaxClients();
+        data["port"] = session.listen_port;
+        data["name"] = session.server_name;
+        data["terrain-name"] = session.terrain_name;
+        data["max-clients"] = session.max_clients;
         data["version"] = RORNET_VERSION;
-        data["use-password"] = Config::isPublic();
+        data["use-password"] = session.isPublic();
 
         m_server_path = "/" + Config::GetServerlistPath() + "/server-list";
 
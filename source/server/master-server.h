@@ -20,6 +20,7 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include "config.h"
 #include "prerequisites.h"
 #include "UnicodeStrings.h"
 
@@ -31,7 +32,7 @@ namespace MasterServer {
     public:
         Client();
 
-        bool Register();
+        bool Register(const SessionConfig &session);
 
         bool SendHeatbeat(Json::Value &user_list);
 
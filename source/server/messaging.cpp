@@ -25,6 +25,7 @@ If not, see <http://www.gnu.org/licenses/>.
 #include "rornet.h"
 #include "logger.h"
 #include "SocketW.h"
+#include "transport.h"
 #include "config.h"
 #include "http.h"
 #include "UnicodeStrings.h"
@@ -93,11 +94,10 @@ namespace Messaging {
  * @param content Payload
  * @return 0 on success
  */
-    int SWSendMessage(SWInetSocket *socket, int type, int source, unsigned int streamid, unsigned int len,
+    int SWSendMessage(Transport *transport, int type, int source, unsigned int streamid, unsigned int len,
                     const char *content) {
-        assert(socket != nullptr);
+        assert(transport != nullptr);
 
-        SWBaseSocket::SWBaseError error;
         RoRnet::Header head;
 
         const int msgsize = sizeof(RoRnet::Header) + len;
@@ -120,9 +120,9 @@ namespace Messaging {
         memcpy(buffer, (char *) &head, sizeof(RoRnet::Header));
         memcpy(buffer + sizeof(RoRnet::Header), content, len);
 
-        if (socket->fsend(buffer, msgsize, &error) < msgsize)
+        if (!transport->SendAll(buffer, msgsize))
         {
-            Logger::Log(LOG_ERROR, "send error -1: %s", error.get_error().c_str());
+            Logger::Log(LOG_ERROR, "send error -1: %s", transport->GetLastError().c_str());
             return -1;
         }
         StatsAddOutgoing(msgsize);
@@ -135,23 +135,21 @@ namespace Messaging {
  * @return                0 on success, negative number on error.
  */
     int SWReceiveMessage(
-            SWInetSocket *socket,
+            Transport *transport,
             int *out_type,
             int *out_source,
             unsigned int *out_stream_id,
             unsigned int *out_payload_len,
             char *out_payload,
             unsigned int payload_buf_len) {
-        assert(socket != nullptr);
+        assert(transport != nullptr);
         assert(out_type != nullptr);
         assert(out_source != nullptr);
         assert(out_stream_id != nullptr);
         assert(out_payload != nullptr);
 
-        SWBaseSocket::SWBaseError error;
-
         RoRnet::Header head;
-        if (socket->frecv((char*)&head, sizeof(RoRnet::Header), &error) < sizeof(RoRnet::Header))
+        if (!transport->RecvAll((char*)&head, sizeof(RoRnet::Header)))
         {
             // this also happens when the connection is canceled
             return -2;
@@ -171,7 +169,7 @@ namespace Messaging {
         if (head.size > 0) {
             //read the rest
             std::memset(out_payload, 0, payload_buf_len);
-            if (socket->frecv(out_payload, head.size, &error) < head.size) {
+            if (!transport->RecvAll(out_payload, head.size)) {
                 return -1;
             }
         }
@@ -180,6 +178,121 @@ namespace Messaging {
         return 0;
     }
 
+    void BeginBundle(std::vector<char> &frame) {
+        frame.resize(sizeof(RoRnet::Header));
+    }
+
+    bool AppendToBundle(std::vector<char> &frame, int type, int source, unsigned int streamid, unsigned int len,
+                        const char *content) {
+        // same limit as SWSendMessage() applies to the whole frame
+        if (frame.size() + sizeof(RoRnet::BundleHeader) + len >= RORNET_MAX_MESSAGE_LENGTH ||
+            type < 0 || type > UINT16_MAX || streamid > UINT16_MAX) {
+            return false;
+        }
+
+        RoRnet::BundleHeader head;
+        head.command = (uint16_t) type;
+        head.streamid = (uint16_t) streamid;
+        head.source = source;
+        head.size = (uint16_t) len;
+
+        const char *head_bytes = (const char *) &head;
+        frame.insert(frame.end(), head_bytes, head_bytes + sizeof(RoRnet::BundleHeader));
+        frame.insert(frame.end(), content, content + len);
+        return true;
+    }
+
+    void FinishBundle(std::vector<char> &frame) {
+        RoRnet::Header head;
+        memset(&head, 0, sizeof(RoRnet::Header));
+        head.command = RoRnet::MSG2_BUNDLE;
+        head.size = (uint32_t) (frame.size() - sizeof(RoRnet::Header));
+        memcpy(frame.data(), &head, sizeof(RoRnet::Header));
+    }
+
+    bool UnpackBundle(const char *payload, unsigned int len, const BundleHandler &handler) {
+        unsigned int pos = 0;
+        while (pos < len) {
+            if (len - pos < sizeof(RoRnet::BundleHeader)) {
+                return false;
+            }
+            RoRnet::BundleHeader head;
+            memcpy(&head, payload + pos, sizeof(RoRnet::BundleHeader));
+            pos += sizeof(RoRnet::BundleHeader);
+            if (len - pos < head.size) {
+                return false;
+            }
+            handler(head.command, head.source, head.streamid, head.size, payload + pos);
+            pos += head.size;
+        }
+        return true;
+    }
+
+    bool EncodeDelta(const std::vector<char> &reference, const char *data, unsigned int len, std::vector<char> &out) {
+        out.clear();
+        if (reference.size() != len || len > UINT16_MAX) {
+            return false;
+        }
+
+        // shorter stretches of unchanged bytes are cheaper to XOR along than to start a new run
+        const unsigned int min_gap = sizeof(RoRnet::DeltaRun);
+        unsigned int run_end = 0;
+        unsigned int pos = 0;
+        while (pos < len) {
+            if (data[pos] == reference[pos]) {
+                pos++;
+                continue;
+            }
+            unsigned int end = pos + 1;
+            unsigned int num_equal = 0;
+            for (unsigned int i = pos + 1; i < len && num_equal < min_gap; i++) {
+                if (data[i] == reference[i]) {
+                    num_equal++;
+                } else {
+                    num_equal = 0;
+                    end = i + 1;
+                }
+            }
+
+            RoRnet::DeltaRun run;
+            run.skip = (uint16_t) (pos - run_end);
+            run.length = (uint16_t) (end - pos);
+            if (out.size() + sizeof(RoRnet::DeltaRun) + run.length >= len) {
+                return false;
+            }
+            const char *run_bytes = (const char *) &run;
+            out.insert(out.end(), run_bytes, run_bytes + sizeof(RoRnet::DeltaRun));
+            for (unsigned int i = pos; i < end; i++) {
+                out.push_back(data[i] ^ reference[i]);
+            }
+            run_end = pos = end;
+        }
+        return true;
+    }
+
+    bool ApplyDelta(std::vector<char> &reference, const char *delta, unsigned int len) {
+        size_t pos = 0;
+        unsigned int offset = 0;
+        while (offset < len) {
+            if (len - offset < sizeof(RoRnet::DeltaRun)) {
+                return false;
+            }
+            RoRnet::DeltaRun run;
+            memcpy(&run, delta + offset, sizeof(RoRnet::DeltaRun));
+            offset += sizeof(RoRnet::DeltaRun);
+            if (len - offset < run.length || pos + run.skip + run.length > reference.size()) {
+                return false;
+            }
+            pos += run.skip;
+            for (unsigned int i = 0; i < run.length; i++) {
+                reference[pos + i] ^= delta[offset + i];
+            }
+            pos += run.length;
+            offset += run.length;
+        }
+        return true;
+    }
+
     int getTime() { return (int) time(NULL); }
 
     int broadcastLAN() {
@@ -24,10 +24,13 @@ If not, see <http://www.gnu.org/licenses/>.
 #include "sequencer.h"
 #include "prerequisites.h"
 
+#include <functional>
+#include <vector>
+
 namespace Messaging {
 
     int SWSendMessage(
-            SWInetSocket *socket,
+            Transport *transport,
             int msg_type,
             int msg_client_id,
             unsigned int msg_stream_id,
@@ -35,7 +38,7 @@ namespace Messaging {
             const char *payload);
 
     int SWReceiveMessage(
-            SWInetSocket *socket,
+            Transport *transport,
             int *out_msg_type,
             int *out_client_id,
             unsigned int *out_stream_id,
@@ -43,10 +46,31 @@ namespace Messaging {
             char *out_payload,
             unsigned int payload_buf_len);
 
+    // MSG2_BUNDLE frames: Begin, Append until it returns false, then Finish and send `frame` as it is
+    void BeginBundle(std::vector<char> &frame);
+
+    bool AppendToBundle(std::vector<char> &frame, int msg_type, int msg_client_id, unsigned int msg_stream_id,
+                        unsigned int payload_len, const char *payload); //!< False if it doesn't fit
+
+    void FinishBundle(std::vector<char> &frame);
+
+    typedef std::function<void(int msg_type, int msg_client_id, unsigned int msg_stream_id,
+                               unsigned int payload_len, const char *payload)> BundleHandler;
+
+    bool UnpackBundle(const char *payload, unsigned int payload_len, const BundleHandler &handler); //!< False if malformed
+
+    // MSG2_STREAM_DATA_DELTA payloads; the previous frame of the stream is the reference
+    bool EncodeDelta(const std::vector<char> &reference, const char *payload, unsigned int payload_len,
+                     std::vector<char> &out_delta); //!< False if the full frame is smaller or the sizes differ
+
+    bool ApplyDelta(std::vector<char> &reference, const char *delta, unsigned int delta_len); //!< False if malformed
+
     int broadcastLAN();
 
     void StatsAddIncoming(int bytes);
 
+    void StatsAddOutgoing(int bytes);
+
     void StatsAddIncomingDrop(int bytes);
 
     void StatsAddOutgoingDrop(int bytes);
@@ -8,12 +8,18 @@ class Sequencer;
 
 class SWInetSocket;
 
+class Transport;
+
 class Broadcaster;
 
 class Receiver;
 
 class Listener;
 
+class Cluster;
+
+class UdpChannel;
+
 class UserAuth;
 
 class ScriptEngine;
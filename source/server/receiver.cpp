@@ -20,7 +20,8 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "receiver.h"
 
-#include "SocketW.h"
+#include "capture.h"
+#include "transport.h"
 #include "sequencer.h"
 #include "messaging.h"
 #include "ScriptEngine.h"
@@ -44,6 +45,12 @@ void Receiver::Start(Client* client) {
 
     assert(m_thread_state == ThreadState::NOT_RUNNING);
     m_client = client;
+    m_decompressor.reset();
+    m_inflated.clear();
+    m_inflated_pos = 0;
+    if (client->HasCapability(RoRnet::CAP_COMPRESS)) {
+        m_decompressor.reset(new StreamDecompressor());
+    }
     m_thread = std::thread(&Receiver::ThreadMain, this);
     m_thread_state = ThreadState::RUNNING;
 }
@@ -73,7 +80,7 @@ Receiver::ThreadState Receiver::GetThreadState()
 void Receiver::ThreadMain() {
     Logger::Log(LOG_DEBUG, "Started receiver thread (user ID %d)", m_client->GetUserId());
 
-    m_client->GetSocket()->set_timeout((Uint32)60, 0); // 60sec
+    m_client->GetTransport()->SetTimeout(60); // 60sec
     m_client->SetReceiveData(true);
     Logger::Log(LOG_VERBOSE, "UID %d is switching to FLOW", m_client->GetUserId());
 
@@ -85,6 +92,10 @@ void Receiver::ThreadMain() {
             break;
         }
 
+        if (Capture::IsActive()) {
+            Capture::Record(m_sequencer->GetConfig().index, m_client->GetUserId(), m_recv_header, m_recv_payload);
+        }
+
         if (m_recv_header.command != RoRnet::MSG2_STREAM_DATA &&
             m_recv_header.command != RoRnet::MSG2_STREAM_DATA_DISCARDABLE) {
             Logger::Log(LOG_VERBOSE, "got message: type: %d, source: %d:%d, len: %d",
@@ -105,31 +116,87 @@ void Receiver::ThreadMain() {
 
 bool Receiver::ThreadReceiveMessage()
 {
-    if (!this->ThreadReceiveHeader())
+    while (true)
     {
-        return false; // Stop thread.
-    }
+        if (m_decompressor != nullptr)
+        {
+            bool taken = false;
+            if (!this->ThreadTakeInflated(taken))
+            {
+                return false; // Stop thread.
+            }
+            if (taken)
+            {
+                return true; // Continue receiving.
+            }
+        }
 
-    if (m_recv_header.size > 0)
-    {
-        if (!this->ThreadReceivePayload())
+        if (!this->ThreadReceiveHeader())
+        {
+            return false; // Stop thread.
+        }
+
+        if (m_recv_header.size > 0)
+        {
+            if (!this->ThreadReceivePayload())
+            {
+                return false; // Stop thread.
+            }
+        }
+
+        Messaging::StatsAddIncoming((int)sizeof(RoRnet::Header) + (int)m_recv_header.size);
+
+        if (m_decompressor == nullptr || m_recv_header.command != RoRnet::MSG2_COMPRESSED)
+        {
+            return true; // Continue receiving.
+        }
+
+        // Drop what was processed already, then add the new piece of the stream
+        m_inflated.erase(m_inflated.begin(), m_inflated.begin() + m_inflated_pos);
+        m_inflated_pos = 0;
+        if (!m_decompressor->Decompress(m_recv_payload, m_recv_header.size, m_inflated))
         {
+            Logger::Log(LOG_WARN, "Receiver: invalid compressed data");
             return false; // Stop thread.
         }
     }
+}
 
-    Messaging::StatsAddIncoming((int)sizeof(RoRnet::Header) + (int)m_recv_header.size);
-    return true; // Continue receiving.
+bool Receiver::ThreadTakeInflated(bool &out_taken)
+{
+    out_taken = false;
+    const size_t available = m_inflated.size() - m_inflated_pos;
+    if (available < sizeof(RoRnet::Header))
+    {
+        return true; // continue receiving.
+    }
+
+    RoRnet::Header head;
+    std::memcpy(&head, m_inflated.data() + m_inflated_pos, sizeof(RoRnet::Header));
+    if (head.size > RORNET_MAX_MESSAGE_LENGTH || head.command == RoRnet::MSG2_COMPRESSED)
+    {
+        Logger::Log(LOG_WARN, "Receiver: invalid message in compressed data (type %d, %d bytes)", (int)head.command, (int)head.size);
+        return false; // Stop thread.
+    }
+    if (available < sizeof(RoRnet::Header) + head.size)
+    {
+        return true; // continue receiving.
+    }
+
+    m_recv_header = head;
+    std::memset(m_recv_payload, 0, RORNET_MAX_MESSAGE_LENGTH);
+    std::memcpy(m_recv_payload, m_inflated.data() + m_inflated_pos + sizeof(RoRnet::Header), head.size);
+    m_inflated_pos += sizeof(RoRnet::Header) + head.size;
+    out_taken = true;
+    return true; // continue receiving.
 }
 
 bool Receiver::ThreadReceiveHeader() //!< @return false if thread should be stopped, true to continue.
 {
-    SWBaseSocket::SWBaseError error;
-
     std::memset((void*)&m_recv_header, 0, sizeof(RoRnet::Header));
-    if (m_client->GetSocket()->frecv((char*)&m_recv_header, (int)sizeof(RoRnet::Header), &error) <= 0)
+    if (!m_client->GetTransport()->RecvAll((char*)&m_recv_header, (int)sizeof(RoRnet::Header)))
     {
-        Logger::Log(LOG_WARN, "Receiver: error getting header: %s", error.get_error().c_str());
+        Logger::Log(LOG_WARN, "Receiver: error getting header: %s", m_client->GetTransport()->GetLastError().c_str());
         return false; // stop thread.
     }
 
@@ -145,12 +212,10 @@ bool Receiver::ThreadReceiveHeader() //!< @return false if thread should be stop
 
 bool Receiver::ThreadReceivePayload() //!< @return false if thread should be stopped, true to continue.
 {
-    SWBaseSocket::SWBaseError error;
-
     std::memset(m_recv_payload, 0, RORNET_MAX_MESSAGE_LENGTH);
-    if (m_client->GetSocket()->frecv(m_recv_payload, (int)m_recv_header.size, &error) <= 0)
+    if (!m_client->GetTransport()->RecvAll(m_recv_payload, (int)m_recv_header.size))
     {
-        Logger::Log(LOG_WARN, "Receiver: error getting payload: %s", error.get_error().c_str());
+        Logger::Log(LOG_WARN, "Receiver: error getting payload: %s", m_client->GetTransport()->GetLastError().c_str());
         return false; // stop thread.
     }
 
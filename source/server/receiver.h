@@ -22,9 +22,12 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "rornet.h" // For RORNET_MAX_MESSAGE_LENGTH
 #include "prerequisites.h"
+#include "compression.h"
 
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 /// Provides a receiver thread for a single client.
 class Receiver {
@@ -48,6 +51,7 @@ private:
     bool ThreadReceiveMessage(); //!< @return false if thread should be stopped, true to continue.
     bool ThreadReceiveHeader(); //!< @return false if thread should be stopped, true to continue.
     bool ThreadReceivePayload(); //!< @return false if thread should be stopped, true to continue.
+    bool ThreadTakeInflated(bool &out_taken); //!< Next message of the decompressed stream, if complete. @return false on protocol error.
 
     Sequencer*  m_sequencer = nullptr; // global
     Client*     m_client = nullptr;    // data owner
@@ -58,5 +62,10 @@ private:
     // Received data buffers -- Keep here to be allocated on heap (along with Client)
     RoRnet::Header m_recv_header;
     char           m_recv_payload[RORNET_MAX_MESSAGE_LENGTH];
+
+    // Decompressed stream (only if negotiated), see compression.h
+    std::unique_ptr<StreamDecompressor> m_decompressor;
+    std::vector<char> m_inflated;
+    size_t            m_inflated_pos = 0;
 };
 
@@ -21,7 +21,10 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 // RoRserver.cpp : Defines the entry point for the console application.
 
 #include "rornet.h"
+#include "capture.h"
+#include "cluster.h"
 #include "sequencer.h"
+#include "udp.h"
 #include "logger.h"
 #include "config.h"
 #include "messaging.h"
@@ -31,11 +34,20 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "sha1_util.h"
 #include "sha1.h"
+#include "userauth.h"
+
+#ifdef WITH_CURL
+#include <curl/curl.h>
+#endif // WITH_CURL
 
 #include <iostream>
 #include <cstdlib>
 #include <csignal>
+#include <map>
+#include <memory>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 
 #include <stdio.h>
 #include <string.h>
@@ -56,9 +68,40 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #endif // _WIN32
 
 
-static Sequencer s_sequencer;
-static MasterServer::Client s_master_server;
+/// A listen port with the sessions it serves; listed on the serverlist
+/// with the settings of its first session.
+struct ServerPort {
+    unsigned int            port = 0;
+    Listener               *listener = nullptr;
+    std::vector<Sequencer*> sessions;
+    MasterServer::Client    master_server;
+};
+
+static std::vector<Sequencer*>  s_sessions;
+static std::vector<ServerPort*> s_ports;
+static Cluster *s_cluster = nullptr;
+static UdpChannel *s_udp = nullptr;
 static bool s_exit_requested = false;
+
+static void UnRegisterAll() {
+    for (ServerPort *port : s_ports) {
+        if (port->master_server.IsRegistered()) {
+            port->master_server.UnRegister();
+        }
+    }
+}
+
+static void CloseAllSessions() {
+    if (s_cluster != nullptr) {
+        s_cluster->Stop();
+    }
+    if (s_udp != nullptr) {
+        s_udp->Stop();
+    }
+    for (Sequencer *session : s_sessions) {
+        session->Close();
+    }
+}
 #ifndef _WIN32
 
 void handler(int signalnum) {
@@ -87,18 +130,32 @@ void handler(int signalnum) {
     if (terminate) {
         if (Config::getServerMode() == SERVER_LAN) {
             Logger::Log(LOG_INFO, "closing server ... ");
-            s_sequencer.Close();
+            CloseAllSessions();
         } else {
             Logger::Log(LOG_INFO, "closing server ... unregistering ... ");
-            if (s_master_server.IsRegistered()) {
-                s_master_server.UnRegister();
-            }
-            s_sequencer.Close();
+            UnRegisterAll();
+            CloseAllSessions();
         }
+        Capture::Stop();
         exit(0);
     }
 }
 
+/// SIGUSR1 reloads the session scripts. The signal is blocked in all threads and taken
+/// here instead, so the reload doesn't run in signal handler context.
+static void ReloadSignalThreadMain() {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    int signalnum = 0;
+    while (sigwait(&signals, &signalnum) == 0) {
+        Logger::Log(LOG_INFO, "got USR1 signal, reloading scripts ...");
+        for (Sequencer *session : s_sessions) {
+            session->ReloadScript();
+        }
+    }
+}
+
 #endif // ! _WIN32
 
 #ifdef _WIN32
@@ -124,12 +181,10 @@ BOOL WINAPI WindowsConsoleHandlerRoutine(DWORD ctrl_type)
         return TRUE; // Means 'event handled'
     }
 
-    if (s_master_server.IsRegistered())
-    {
-        Logger::Log(LOG_INFO, "Unregistering...");
-        s_master_server.UnRegister();
-    }
-    s_sequencer.Close(); // TODO: This somehow closes (crashes?) the process on Windows, debugger doesn't intercept anything...
+    Logger::Log(LOG_INFO, "Unregistering...");
+    UnRegisterAll();
+    CloseAllSessions(); // TODO: This somehow closes (crashes?) the process on Windows, debugger doesn't intercept anything...
+    Capture::Stop();
     Logger::Log(LOG_INFO, "Clean exit (Windows)");
     ExitProcess(0); // Recommended by MSDN, see above link.
 }
@@ -239,6 +294,35 @@ void daemonize() {
 
 #endif // ! _WIN32
 
+/// Reports the users of all sessions on the port, retries on failure.
+static bool SendHeartbeat(ServerPort *port) {
+    Logger::Log(LOG_VERBOSE, "Sending heartbeat (port %u)...", port->port);
+    Json::Value user_list(Json::arrayValue);
+    for (Sequencer *session : port->sessions) {
+        session->GetHeartbeatUserList(user_list);
+    }
+    if (port->master_server.SendHeatbeat(user_list)) {
+        Logger::Log(LOG_VERBOSE, "Heartbeat sent OK");
+        return true;
+    }
+
+    unsigned int timeout = Config::GetHeartbeatRetrySeconds();
+    unsigned int max_retries = Config::GetHeartbeatRetryCount();
+    Logger::Log(LOG_WARN, "A heartbeat failed! Retry in %d seconds.", timeout);
+    for (unsigned int i = 0; i < max_retries; ++i) {
+        Utils::SleepSeconds(timeout);
+        bool success = port->master_server.SendHeatbeat(user_list);
+
+        LogLevel log_level = (success ? LOG_INFO : LOG_ERROR);
+        const char *log_result = (success ? "successful." : "failed.");
+        Logger::Log(log_level, "Heartbeat retry %d/%d %s", i + 1, max_retries, log_result);
+        if (success) {
+            return true;
+        }
+    }
+    return false;
+}
+
 int main(int argc, char *argv[]) {
     // set default verbose levels
     Logger::SetLogLevel(LOGTYPE_DISPLAY, LOG_INFO);
@@ -291,6 +375,14 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    // Open the capture before daemonizing, so relative paths resolve to the working directory
+    if (!Config::getCaptureFile().empty()) {
+        size_t segment_size = (size_t) Config::getCaptureSegmentSizeMiB() * 1024 * 1024;
+        if (!Capture::Start(Config::getCaptureFile(), segment_size, Config::getCaptureMaxSegments())) {
+            return -1;
+        }
+    }
+
 #ifndef _WIN32
     if (!Config::getForeground()) {
         // no output because of background mode
@@ -304,27 +396,89 @@ int main(int argc, char *argv[]) {
     signal(SIGHUP, handler);
     signal(SIGINT, handler);
     signal(SIGTERM, handler);
+
+    // before any other thread starts, they inherit the mask
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
 #else // _WIN32
     SetConsoleCtrlHandler(WindowsConsoleHandlerRoutine, TRUE);
 #endif // ! _WIN32
 
 
-    Listener listener(&s_sequencer);
-    if (!listener.Initialize()) {
-        return -1;
+#ifdef WITH_CURL
+    // before any thread uses curl, it isn't thread safe
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+#endif // WITH_CURL
+
+    // Sessions share the auth cache, sessions with the same port share a listener
+    std::shared_ptr<UserAuth> user_auth = std::make_shared<UserAuth>(Config::getAuthFile());
+    std::map<unsigned int, ServerPort*> ports_by_number;
+    for (const SessionConfig &config : Config::getSessions()) {
+        Sequencer *session = new Sequencer();
+        session->Initialize(config, user_auth);
+        s_sessions.push_back(session);
+
+        ServerPort *&port = ports_by_number[config.listen_port];
+        if (port == nullptr) {
+            port = new ServerPort();
+            port->port = config.listen_port;
+            port->listener = new Listener(session);
+            s_ports.push_back(port);
+        } else {
+            port->listener->AddSession(session);
+        }
+        port->sessions.push_back(session);
+    }
+
+    // The default session can be shared with other server nodes
+    if (Config::getClusterNodeId() != 0) {
+        s_cluster = new Cluster(s_sessions.front(), Config::getClusterNodeId());
+        s_sessions.front()->SetCluster(s_cluster);
+        if (!s_cluster->Start(Config::getClusterPort(), Config::getClusterPeers())) {
+            return -1;
+        }
+    }
+
+    // One channel serves the clients of all sessions, they are told its port when joining
+    if (Config::getUdpPort() != 0) {
+        s_udp = new UdpChannel();
+        if (!s_udp->Start(Config::getUdpPort())) {
+            return -1;
+        }
+        for (Sequencer *session : s_sessions) {
+            session->SetUdpChannel(s_udp);
+        }
     }
-    s_sequencer.Initialize();
 
-    // Listener is ready, let's register ourselves on serverlist (which will contact us back to check).
+    for (ServerPort *port : s_ports) {
+        if (!port->listener->Initialize()) {
+            return -1;
+        }
+    }
+
+#ifndef _WIN32
+    std::thread(ReloadSignalThreadMain).detach();
+#endif // ! _WIN32
+
+    // Listeners are ready, let's register ourselves on serverlist (which will contact us back to check).
     if (server_mode != SERVER_LAN) {
-        bool registered = s_master_server.Register();
+        bool registered = true;
+        for (ServerPort *port : s_ports) {
+            registered = port->master_server.Register(port->sessions.front()->GetConfig()) && registered;
+        }
         if (!registered && (server_mode == SERVER_INET)) {
             Logger::Log(LOG_ERROR, "Failed to register on serverlist. Exit");
-            listener.Shutdown();
+            UnRegisterAll();
+            for (ServerPort *port : s_ports) {
+                port->listener->Shutdown();
+            }
             return -1;
         } else if (!registered) // server_mode == SERVER_AUTO
         {
             Logger::Log(LOG_WARN, "Failed to register on serverlist, continuing in LAN mode");
+            UnRegisterAll();
             server_mode = SERVER_LAN;
         } else {
             Logger::Log(LOG_INFO, "Registration successful");
@@ -337,46 +491,29 @@ int main(int argc, char *argv[]) {
         //heartbeat
         while (!s_exit_requested) {
             Messaging::UpdateMinuteStats();
-            s_sequencer.UpdateMinuteStats();
+            for (Sequencer *session : s_sessions) {
+                session->UpdateMinuteStats();
+            }
 
             //every minute
             Utils::SleepSeconds(Config::GetHeartbeatIntervalSec());
 
-            Logger::Log(LOG_VERBOSE, "Sending heartbeat...");
-            Json::Value user_list(Json::arrayValue);
-            s_sequencer.GetHeartbeatUserList(user_list);
-            if (!s_master_server.SendHeatbeat(user_list)) {
-                unsigned int timeout = Config::GetHeartbeatRetrySeconds();
-                unsigned int max_retries = Config::GetHeartbeatRetryCount();
-                Logger::Log(LOG_WARN, "A heartbeat failed! Retry in %d seconds.", timeout);
-                bool success = false;
-                for (unsigned int i = 0; i < max_retries; ++i) {
-                    Utils::SleepSeconds(timeout);
-                    success = s_master_server.SendHeatbeat(user_list);
-
-                    LogLevel log_level = (success ? LOG_INFO : LOG_ERROR);
-                    const char *log_result = (success ? "successful." : "failed.");
-                    Logger::Log(log_level, "Heartbeat retry %d/%d %s", i + 1, max_retries, log_result);
-                    if (success) {
-                        break;
-                    }
-                }
-                if (!success) {
+            for (ServerPort *port : s_ports) {
+                if (!SendHeartbeat(port)) {
                     Logger::Log(LOG_ERROR, "Unable to send heartbeats, exit");
                     s_exit_requested = true;
+                    break;
                 }
-            } else {
-                Logger::Log(LOG_VERBOSE, "Heartbeat sent OK");
             }
         }
 
-        if (s_master_server.IsRegistered()) {
-            s_master_server.UnRegister();
-        }
+        UnRegisterAll();
     } else {
         while (!s_exit_requested) {
             Messaging::UpdateMinuteStats();
-            s_sequencer.UpdateMinuteStats();
+            for (Sequencer *session : s_sessions) {
+                session->UpdateMinuteStats();
+            }
 
             // broadcast our "i'm here" signal
             Messaging::broadcastLAN();
@@ -386,7 +523,8 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    s_sequencer.Close();
+    CloseAllSessions();
+    Capture::Stop();
     return 0;
 }
 
@@ -24,13 +24,18 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "sha1_util.h"
 #include "receiver.h"
 #include "broadcaster.h"
+#include "capture.h"
+#include "cluster.h"
+#include "compression.h"
 #include "userauth.h"
-#include "SocketW.h"
+#include "transport.h"
+#include "udp.h"
 #include "logger.h"
 #include "config.h"
 #include "utils.h"
 #include "ScriptEngine.h"
 
+#include <climits>
 #include <stdio.h>
 #include <time.h>
 #include <chrono>
@@ -45,8 +50,27 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #endif
 
-Client::Client(Sequencer *sequencer, SWInetSocket *socket) :
-        m_socket(socket),
+static const size_t SCRIPT_PROFILE_CHAT_ROWS = 5; // per table, for !scriptprofile
+
+static void StoreLastFrame(std::map<unsigned int, StreamFrame> &frames, unsigned int streamid,
+                           const char *data, unsigned int len) {
+    // readers may still hold the previous frame, it stays as it is
+    frames[streamid] = std::make_shared<const std::vector<char>>(data, data + len);
+}
+
+/// True if the frame equals the stream's previous one in everything but the VehicleState time
+static bool IsIdleVehicleFrame(const std::map<unsigned int, StreamFrame> &frames, unsigned int streamid,
+                               const char *data, unsigned int len) {
+    auto found = frames.find(streamid);
+    if (found == frames.end() || found->second->size() != len || len < sizeof(RoRnet::VehicleState)) {
+        return false;
+    }
+    const size_t skip = sizeof(int32_t); // VehicleState::time
+    return memcmp(found->second->data() + skip, data + skip, len - skip) == 0;
+}
+
+Client::Client(Sequencer *sequencer, Transport *transport) :
+        m_transport(transport),
         m_receiver(sequencer),
         m_broadcaster(sequencer),
         m_sequencer(sequencer),
@@ -67,15 +91,13 @@ void Client::Disconnect() {
     m_receiver.Stop();
 
     // Disconnect the socket
-    SWBaseSocket::SWBaseError result;
-    bool disconnected_ok = m_socket->disconnect(&result);
-    if (!disconnected_ok || (result != SWBaseSocket::base_error::ok)) {
+    if (!m_transport->Disconnect()) {
         Logger::Log(
                 LOG_ERROR,
                 "Internal: Error while disconnecting client - failed to disconnect socket. Message: %s",
-                result.get_error().c_str());
+                m_transport->GetLastError().c_str());
     }
-    delete m_socket;
+    delete m_transport;
 }
 
 bool Client::CheckSpawnRate()
@@ -83,8 +105,9 @@ bool Client::CheckSpawnRate()
     // CAUTION - called by Sequencer with clients-mutex locked
     // -------------------------------------------------------    
 
-    std::chrono::seconds spawn_interval(Config::getSpawnIntervalSec());
-    if (spawn_interval.count() == 0 || Config::getMaxSpawnRate() == 0) {
+    const SessionConfig &config = m_sequencer->GetConfig();
+    std::chrono::seconds spawn_interval(config.spawn_interval_sec);
+    if (spawn_interval.count() == 0 || config.max_spawn_rate == 0) {
         return true; // Spawn rate not limited
     }
 
@@ -102,34 +125,40 @@ bool Client::CheckSpawnRate()
     }
 
     // Evaluate current rate
-    float rate_f = (float)rate / (float)Config::getMaxSpawnRate();
+    float rate_f = (float)rate / (float)config.max_spawn_rate;
     if (rate_f > 0.7) {
         char msg[400];
         snprintf(msg, 400, "Do not spawn more than %d vehicles in %d seconds. Already spawned %d",
-            Config::getMaxSpawnRate(), Config::getSpawnIntervalSec(), rate);
+            config.max_spawn_rate, config.spawn_interval_sec, rate);
         m_sequencer->serverSay(msg, this->user.uniqueid, FROM_SERVER);
     }
 
     // Add current time
     m_stream_reg_timestamps.push_back(std::chrono::system_clock::now());
 
-    return rate <= Config::getMaxSpawnRate();
+    return rate <= config.max_spawn_rate;
 }
 
 std::string Client::GetIpAddress() {
-    SWBaseSocket::SWBaseError result;
-    std::string ip = m_socket->get_peerAddr(&result);
-    if (result != SWBaseSocket::base_error::ok) {
+    std::string ip = m_transport->GetPeerAddress();
+    if (ip.empty()) {
         Logger::Log(
                 LOG_ERROR,
                 "Internal: Error while getting client IP address. Message: %s",
-                result.get_error().c_str());
+                m_transport->GetLastError().c_str());
     }
     return ip;
 }
 
 void Client::QueueMessage(int msg_type, int client_id, unsigned int stream_id, unsigned int payload_len,
                           const char *payload) {
+    // Datagrams bypass the broadcaster, so they never become its delta reference; the client keeps the last TCP frame too.
+    // Until the stream's register is written out they stay on TCP, they would overtake it otherwise.
+    if (msg_type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE && m_udp_token != 0 &&
+        !m_broadcaster.IsHoldingUdp(client_id, stream_id) &&
+        m_sequencer->m_udp->Send(m_udp_token, msg_type, client_id, stream_id, payload_len, payload)) {
+        return;
+    }
     m_broadcaster.QueueMessage(msg_type, client_id, stream_id, payload_len, payload);
 }
 
@@ -146,31 +175,34 @@ void Client::NotifyAllVehicles(Sequencer *sequencer) {
 
 Sequencer::Sequencer() :
         m_script_engine(nullptr),
-        m_auth_resolver(nullptr),
         m_num_disconnects_total(0),
         m_num_disconnects_crash(0),
         m_blacklist(this),
         m_bot_count(0),
-        m_free_user_id(1) {
+        m_free_user_id(1),
+        m_first_user_id(1),
+        m_last_user_id(INT_MAX) {
     m_start_time = static_cast<int>(time(nullptr));
 }
 
 /**
  * Initialize, needs to be called before the class is used
  */
-void Sequencer::Initialize() {
-    m_clients.reserve(Config::getMaxClients());
+void Sequencer::Initialize(const SessionConfig &config, std::shared_ptr<UserAuth> auth) {
+    m_config = config;
+    m_clients.reserve(m_config.max_clients);
 
 #ifdef WITH_ANGELSCRIPT
-    if (Config::getEnableScripting()) {
+    if (m_config.getEnableScripting()) {
         m_script_engine = new ScriptEngine(this);
-        m_script_engine->loadScript(Config::getScriptName());
+        m_script_engine->loadScript(m_config.script_name);
+        m_script_engine->StartScriptThread();
     }
 #endif //WITH_ANGELSCRIPT
 
     this->StartKillerThread();
 
-    m_auth_resolver = new UserAuth(Config::getAuthFile());
+    m_auth_resolver = (auth != nullptr) ? auth : std::make_shared<UserAuth>(Config::getAuthFile());
 
     m_blacklist.LoadBlacklistFromFile();
 }
@@ -186,7 +218,7 @@ void Sequencer::Close() {
     for (unsigned int i = 0; i < m_clients.size(); i++) {
         // HACK-ISH override all thread stuff and directly send it!
         Client *client = m_clients[i];
-        Messaging::SWSendMessage(client->GetSocket(), RoRnet::MSG2_USER_LEAVE, client->user.uniqueid, 0, strlen(str),
+        Messaging::SWSendMessage(client->GetTransport(), RoRnet::MSG2_USER_LEAVE, client->user.uniqueid, 0, strlen(str),
                                str);
     }
     Logger::Log(LOG_INFO, "all clients disconnected. exiting.");
@@ -198,10 +230,7 @@ void Sequencer::Close() {
     }
 #endif //WITH_ANGELSCRIPT
 
-    if (m_auth_resolver != nullptr) {
-        delete m_auth_resolver;
-        m_auth_resolver = nullptr;
-    }
+    m_auth_resolver.reset();
 
     this->StopKillerThread();
 }
@@ -270,7 +299,7 @@ int Sequencer::GetFreePlayerColour() {
     }
 }
 
-void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
+void Sequencer::createClient(Transport *transport, RoRnet::UserInfo user) {
     //we have a confirmed client that wants to play
     //try to find a place for him
     Logger::Log(LOG_DEBUG, "got instance in createClient()");
@@ -279,25 +308,38 @@ void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
 
 	std::string nick = Str::SanitizeUtf8(user.username);
     // check if banned
-    SWBaseSocket::SWBaseError error;
-    if (Sequencer::IsBanned(sock->get_peerAddr(&error).c_str())) {
-        Logger::Log(LOG_WARN, "rejected banned client '%s' with IP %s", nick.c_str(), sock->get_peerAddr(&error).c_str());
-        Messaging::SWSendMessage(sock, RoRnet::MSG2_BANNED, 0, 0, 0, 0);
+    if (Sequencer::IsBanned(transport->GetPeerAddress().c_str())) {
+        Logger::Log(LOG_WARN, "rejected banned client '%s' with IP %s", nick.c_str(), transport->GetPeerAddress().c_str());
+        Messaging::SWSendMessage(transport, RoRnet::MSG2_BANNED, 0, 0, 0, 0);
         return;
     }
 
     // check if server is full
     Logger::Log(LOG_DEBUG, "searching free slot for new client...");
-    if (m_clients.size() >= (Config::getMaxClients() + m_bot_count)) {
+    if (m_clients.size() >= (m_config.max_clients + m_bot_count)) {
         Logger::Log(LOG_WARN, "join request from '%s' on full server: rejecting!",
                     Str::SanitizeUtf8(user.username).c_str());
         // set a low time out because we don't want to cause a back up of
         // connecting clients
-        sock->set_timeout(10, 0);
-        Messaging::SWSendMessage(sock, RoRnet::MSG2_FULL, 0, 0, 0, 0);
+        transport->SetTimeout(10);
+        Messaging::SWSendMessage(transport, RoRnet::MSG2_FULL, 0, 0, 0, 0);
         throw std::runtime_error("Server is full");
     }
 
+    // pick a unique userid
+    std::set<unsigned int> uids_in_use;
+    for (Client *client : m_clients) {
+        uids_in_use.insert(client->user.uniqueid);
+    }
+    const unsigned int client_id = Sequencer::AllocateUserId(m_free_user_id, m_first_user_id, m_last_user_id, uids_in_use);
+    if (client_id == 0) {
+        Logger::Log(LOG_ERROR, "join request from '%s', but no user id is left: rejecting!",
+                    Str::SanitizeUtf8(user.username).c_str());
+        transport->SetTimeout(10);
+        Messaging::SWSendMessage(transport, RoRnet::MSG2_FULL, 0, 0, 0, 0);
+        throw std::runtime_error("No user id left");
+    }
+
     if (nick.empty())
     {
         nick = "Anonymous";
@@ -324,12 +366,32 @@ void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
         m_bot_count++;
 
     //okay, create the client slot
-    Client *to_add = new Client(this, sock);
+    Client *to_add = new Client(this, transport);
     to_add->user = user;
     to_add->user.colournum = Sequencer::GetFreePlayerColour();
     to_add->user.authstatus = user.authstatus;
     std::string ip = to_add->GetIpAddress();
 
+    // protocol extensions, see RoRnet::Capability
+    RoRnet::UserInfo welcome_info = to_add->user;
+    auto options = Utils::ParseSessionOptions(user.sessionoptions, sizeof(user.sessionoptions));
+    auto requested_caps = options.find("caps");
+    if (requested_caps != options.end()) {
+        uint32_t caps = Utils::ParseCapabilities(requested_caps->second);
+        if (Config::getCompressionLevel() == 0) {
+            caps &= ~RoRnet::CAP_COMPRESS;
+        }
+        if (m_udp == nullptr) {
+            caps &= ~RoRnet::CAP_UDP;
+        }
+        to_add->SetCapabilities(caps);
+        std::string accepted = Utils::FormatCapabilities(to_add->GetCapabilities());
+        memset(welcome_info.sessionoptions, 0, sizeof(welcome_info.sessionoptions));
+        snprintf(welcome_info.sessionoptions, sizeof(welcome_info.sessionoptions), "caps-ok=%s", accepted.c_str());
+        Logger::Log(LOG_VERBOSE, "client '%s' asked for capabilities '%s', accepted '%s'",
+                    Str::SanitizeUtf8(user.username).c_str(), requested_caps->second.c_str(), accepted.c_str());
+    }
+
     // log some info about this client (in UTF8)
     char buf[3000];
     if (strlen(user.usertoken) > 0)
@@ -341,11 +403,25 @@ void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
     Logger::Log(LOG_INFO, Str::SanitizeUtf8(buf));
 
     // assign unique userid
-    unsigned int client_id = m_free_user_id;
     to_add->user.uniqueid = client_id;
+    welcome_info.uniqueid = client_id;
 
-    // count up unique id
-    m_free_user_id++;
+    if (to_add->HasCapability(RoRnet::CAP_UDP)) {
+        to_add->SetUdpToken(m_udp->AddClient(this, client_id, ip));
+        size_t used = strlen(welcome_info.sessionoptions);
+        snprintf(welcome_info.sessionoptions + used, sizeof(welcome_info.sessionoptions) - used,
+                 " udp-port=%u udp-token=%016llx", m_udp->GetPort(), (unsigned long long) to_add->GetUdpToken());
+    }
+
+    if (Capture::IsActive()) {
+        // record the join so a replay can recreate the client, without credentials
+        RoRnet::UserInfo info_for_capture = to_add->user;
+        memset(info_for_capture.usertoken, 0, 40);
+        memset(info_for_capture.serverpassword, 0, 40);
+        memset(info_for_capture.clientGUID, 0, 40);
+        Capture::Record(m_config.index, client_id, RoRnet::MSG2_USER_INFO, 0, sizeof(RoRnet::UserInfo),
+                        (char *) &info_for_capture);
+    }
 
     // add the client to the vector
     m_clients.push_back(to_add);
@@ -354,8 +430,8 @@ void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
     to_add->StartThreads();
 
     Logger::Log(LOG_VERBOSE, "Sending welcome message to uid %i", client_id);
-    if (Messaging::SWSendMessage(sock, RoRnet::MSG2_WELCOME, client_id, 0, sizeof(RoRnet::UserInfo),
-                               (char *) &to_add->user)) {
+    if (Messaging::SWSendMessage(transport, RoRnet::MSG2_WELCOME, client_id, 0, sizeof(RoRnet::UserInfo),
+                               (char *) &welcome_info)) {
         this->QueueClientForDisconnect(client_id, "error sending welcome message");
         return;
     }
@@ -363,7 +439,7 @@ void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
     // Do script callback
 #ifdef WITH_ANGELSCRIPT
     if (m_script_engine != nullptr) {
-        m_script_engine->playerAdded(client_id);
+        m_script_engine->QueuePlayerAdded(client_id);
     }
 #endif //WITH_ANGELSCRIPT
 
@@ -376,6 +452,9 @@ void Sequencer::createClient(SWInetSocket *sock, RoRnet::UserInfo user) {
         m_clients[i]->QueueMessage(RoRnet::MSG2_USER_JOIN, client_id, 0, sizeof(RoRnet::UserInfo),
                                    (char *) &info_for_others);
     }
+    if (m_cluster != nullptr) {
+        m_cluster->Forward(RoRnet::MSG2_USER_JOIN, client_id, 0, sizeof(RoRnet::UserInfo), (char *) &info_for_others);
+    }
 
     printStats();
 
@@ -400,12 +479,13 @@ void Sequencer::broadcastUserInfo(int client_id) {
     RoRnet::UserInfo info_for_others = client->user;
     memset(info_for_others.usertoken, 0, 40);
     memset(info_for_others.clientGUID, 0, 40);
-    { // Lock scope
-        std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
-        for (unsigned int i = 0; i < m_clients.size(); i++) {
-            m_clients[i]->QueueMessage(RoRnet::MSG2_USER_INFO, info_for_others.uniqueid, 0, sizeof(RoRnet::UserInfo),
-                                       (char *) &info_for_others);
-        }
+    for (unsigned int i = 0; i < m_clients.size(); i++) {
+        m_clients[i]->QueueMessage(RoRnet::MSG2_USER_INFO, info_for_others.uniqueid, 0, sizeof(RoRnet::UserInfo),
+                                   (char *) &info_for_others);
+    }
+    if (m_cluster != nullptr) {
+        m_cluster->Forward(RoRnet::MSG2_USER_INFO, info_for_others.uniqueid, 0, sizeof(RoRnet::UserInfo),
+                           (char *) &info_for_others);
     }
 }
 
@@ -507,7 +587,7 @@ void Sequencer::QueueClientForDisconnect(int uid, const char *errormsg, bool isE
 
 #ifdef WITH_ANGELSCRIPT
     if (m_script_engine != nullptr && doScriptCallback) {
-        m_script_engine->playerDeleted(client->user.uniqueid, isError ? 1 : 0);
+        m_script_engine->QueuePlayerDeleted(client->user.uniqueid, isError ? 1 : 0);
     }
 #endif //WITH_ANGELSCRIPT
 
@@ -516,6 +596,10 @@ void Sequencer::QueueClientForDisconnect(int uid, const char *errormsg, bool isE
         m_bot_count--;
     }
 
+    if (Capture::IsActive()) {
+        Capture::Record(m_config.index, uid, RoRnet::MSG2_USER_LEAVE, 0, (int) strlen(errormsg), errormsg);
+    }
+
     //notify the others
     int pos = 0;
     for (unsigned int i = 0; i < m_clients.size(); i++) {
@@ -525,6 +609,14 @@ void Sequencer::QueueClientForDisconnect(int uid, const char *errormsg, bool isE
         }
     }
     m_clients.erase(m_clients.begin() + pos);
+    m_stream_data_subs.erase(m_stream_data_subs.lower_bound(std::make_pair(uid, INT_MIN)),
+                             m_stream_data_subs.upper_bound(std::make_pair(uid, INT_MAX)));
+    if (client->GetUdpToken() != 0) {
+        m_udp->RemoveClient(client->GetUdpToken());
+    }
+    if (m_cluster != nullptr) {
+        m_cluster->Forward(RoRnet::MSG2_USER_LEAVE, uid, 0, (int) strlen(errormsg), errormsg);
+    }
 
     printStats();
 
@@ -554,7 +646,7 @@ void Sequencer::sendMOTDSynchronized(int uid)
 
 void Sequencer::sendMOTD(int uid) {
     std::vector<std::string> lines;
-    int res = Utils::ReadLinesFromFile(Config::getMOTDFile(), lines);
+    int res = Utils::ReadLinesFromFile(m_config.motd_file, lines);
     if (res)
     {
         Logger::Log(LOG_ERROR, "Could not read MOTD file, error code: %d", res);
@@ -567,12 +659,17 @@ void Sequencer::sendMOTD(int uid) {
     }
 }
 
-//this is called from the listener thread initial handshake
+//this is called by the receiver thread of the new client, with clients-mutex locked
 void Sequencer::IntroduceNewClientToAllVehicles(Client *new_client) {
     RoRnet::UserInfo info_for_others = new_client->user;
     memset(info_for_others.usertoken, 0, 40);
     memset(info_for_others.clientGUID, 0, 40);
 
+    // Only copy the state here; the newcomer's broadcaster turns the snapshot
+    // into messages and sends them in one go, outside of the lock.
+    std::shared_ptr<WorldSnapshot> snapshot = std::make_shared<WorldSnapshot>();
+    snapshot->users.reserve(m_clients.size() + m_remote_users.size());
+
     for (unsigned int i = 0; i < m_clients.size(); i++) {
         Client *client = m_clients[i];
         if (client->GetStatus() == Client::STATUS_USED) {
@@ -581,25 +678,193 @@ void Sequencer::IntroduceNewClientToAllVehicles(Client *new_client) {
                                  (char *) &info_for_others);
 
             // all others to new user
-            RoRnet::UserInfo info_for_newcomer = m_clients[i]->user;
-            memset(info_for_newcomer.usertoken, 0, 40);
-            memset(info_for_newcomer.clientGUID, 0, 40);
-            new_client->QueueMessage(RoRnet::MSG2_USER_INFO, client->user.uniqueid, 0, sizeof(RoRnet::UserInfo),
-                                     (char *) &info_for_newcomer);
-
-            Logger::Log(LOG_VERBOSE, " * %d streams registered for user %d", m_clients[i]->streams.size(),
-                        m_clients[i]->user.uniqueid);
-
-            auto itor = client->streams.begin();
-            auto endi = client->streams.end();
-            for (; itor != endi; ++itor) {
-                Logger::Log(LOG_VERBOSE, "sending stream registration %d:%d to user %d", client->user.uniqueid,
-                            itor->first, new_client->user.uniqueid);
-                new_client->QueueMessage(RoRnet::MSG2_STREAM_REGISTER, client->user.uniqueid, itor->first,
-                                         sizeof(RoRnet::StreamRegister), (char *) &itor->second);
+            snapshot->users.emplace_back();
+            WorldSnapshot::User &entry = snapshot->users.back();
+            entry.info = client->user;
+            memset(entry.info.usertoken, 0, 40);
+            memset(entry.info.clientGUID, 0, 40);
+            entry.streams = client->streams;
+            entry.last_frames.insert(client->last_frames.begin(), client->last_frames.end());
+        }
+    }
+
+    // users of the other cluster nodes
+    for (auto &remote : m_remote_users) {
+        snapshot->users.emplace_back();
+        snapshot->users.back().info = remote.second.user;
+        snapshot->users.back().streams = remote.second.streams;
+        snapshot->users.back().last_frames.insert(remote.second.last_frames.begin(), remote.second.last_frames.end());
+    }
+
+    Logger::Log(LOG_VERBOSE, "sending %zu users to new user %d", snapshot->users.size(), new_client->user.uniqueid);
+    new_client->QueueSnapshot(snapshot);
+}
+
+void Sequencer::SetCluster(Cluster *cluster) {
+    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+    m_cluster = cluster;
+    m_first_user_id = cluster->GetFirstUserId();
+    m_last_user_id = cluster->GetLastUserId();
+    m_free_user_id = m_first_user_id;
+}
+
+unsigned int Sequencer::AllocateUserId(unsigned int &next, unsigned int first, unsigned int last,
+                                       const std::set<unsigned int> &in_use) {
+    unsigned int uid = (next < first || next > last) ? first : next;
+    for (unsigned int tries = last - first + 1; tries > 0; tries--) {
+        if (in_use.find(uid) == in_use.end()) {
+            next = (uid == last) ? first : uid + 1;
+            return uid;
+        }
+        uid = (uid == last) ? first : uid + 1;
+    }
+    return 0;
+}
+
+void Sequencer::SetUdpChannel(UdpChannel *udp) {
+    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+    m_udp = udp;
+}
+
+void Sequencer::SampleStreamData(Client *client, const RoRnet::StreamRegister &reg, unsigned int streamid) {
+#ifdef WITH_ANGELSCRIPT
+    if (m_script_engine == nullptr)
+        return;
+
+    // the most specific subscription counts
+    const int uid = (int) client->user.uniqueid;
+    const std::pair<int, int> keys[] = {{uid, (int) streamid}, {uid, -1}, {-1, -1}};
+    std::map<std::pair<int, int>, int>::const_iterator sub = m_stream_data_subs.end();
+    for (const std::pair<int, int> &key : keys) {
+        sub = m_stream_data_subs.find(key);
+        if (sub != m_stream_data_subs.end())
+            break;
+    }
+    if (sub == m_stream_data_subs.end())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point &next_sample = client->next_stream_sample[streamid];
+    if (now < next_sample)
+        return;
+    next_sample = now + std::chrono::milliseconds(sub->second);
+
+    ScriptStreamSample sample;
+    sample.uid = uid;
+    sample.streamid = (int) streamid;
+    sample.type = reg.type;
+    sample.payload = client->last_frames[streamid]; // immutable, see StreamFrame
+    if (reg.type == STREAM_REG_TYPE_VEHICLE && sample.payload->size() >= sizeof(RoRnet::VehicleState)) {
+        memcpy(&sample.state, sample.payload->data(), sizeof(RoRnet::VehicleState));
+    }
+    m_script_engine->QueueStreamData(sample);
+#endif //WITH_ANGELSCRIPT
+}
+
+void Sequencer::ReloadScript() {
+#ifdef WITH_ANGELSCRIPT
+    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+    if (m_script_engine != nullptr) {
+        m_script_engine->QueueReload(-1);
+    }
+#endif //WITH_ANGELSCRIPT
+}
+
+void Sequencer::ClusterNodeConnected(int node_id) {
+    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+
+    // introduce our users and their streams, the link carries live traffic afterwards
+    for (Client *client : m_clients) {
+        RoRnet::UserInfo info_for_others = client->user;
+        memset(info_for_others.usertoken, 0, 40);
+        memset(info_for_others.clientGUID, 0, 40);
+        m_cluster->SendToNode(node_id, RoRnet::MSG2_USER_JOIN, client->user.uniqueid, 0, sizeof(RoRnet::UserInfo),
+                              (char *) &info_for_others);
+        for (auto &stream : client->streams) {
+            m_cluster->SendToNode(node_id, RoRnet::MSG2_STREAM_REGISTER, client->user.uniqueid, stream.first,
+                                  sizeof(RoRnet::StreamRegister), (char *) &stream.second);
+        }
+        for (auto &frame : client->last_frames) {
+            m_cluster->SendToNode(node_id, RoRnet::MSG2_STREAM_DATA, client->user.uniqueid, frame.first,
+                                  (unsigned int) frame.second->size(), frame.second->data());
+        }
+    }
+    m_cluster->ActivateLink(node_id);
+}
+
+void Sequencer::ClusterNodeLost(int node_id) {
+    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+
+    const char *msg = "lost connection to the server hosting this user";
+    auto itor = m_remote_users.begin();
+    while (itor != m_remote_users.end()) {
+        if (itor->second.node_id == node_id) {
+            for (Client *client : m_clients) {
+                client->QueueMessage(RoRnet::MSG2_USER_LEAVE, itor->first, 0, (int) strlen(msg), msg);
+            }
+            itor = m_remote_users.erase(itor);
+        } else {
+            ++itor;
+        }
+    }
+}
+
+//this is called by the cluster link threads
+void Sequencer::queueClusterMessage(int node_id, int type, int uid, unsigned int streamid, char *data,
+                                    unsigned int len) {
+    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+
+    if (type == RoRnet::MSG2_STREAM_REGISTER_RESULT) {
+        // one of our clients registered the stream, forward the result to it
+        if (len < sizeof(RoRnet::StreamRegister)) {
+            return;
+        }
+        RoRnet::StreamRegister *reg = (RoRnet::StreamRegister *) data;
+        Client *origin_client = this->FindClientById(reg->origin_sourceid);
+        if (origin_client != nullptr) {
+            origin_client->QueueMessage(type, uid, streamid, len, data);
+        }
+        return;
+    }
+
+    // keep track of the remote users, for our newcomers and in case the link drops
+    bool to_all = false; // also to clients which don't receive stream data yet
+    if (type == RoRnet::MSG2_USER_JOIN || type == RoRnet::MSG2_USER_INFO) {
+        if (len < sizeof(RoRnet::UserInfo) || Cluster::GetNodeOfUser(uid) != node_id) {
+            return;
+        }
+        RemoteUser &remote = m_remote_users[uid];
+        remote.node_id = node_id;
+        memcpy(&remote.user, data, sizeof(RoRnet::UserInfo));
+        to_all = true;
+    } else {
+        auto found = m_remote_users.find(uid);
+        if (found == m_remote_users.end() || found->second.node_id != node_id) {
+            return; // unknown or already gone
+        }
+        if (type == RoRnet::MSG2_USER_LEAVE) {
+            m_remote_users.erase(found);
+            to_all = true;
+        } else if (type == RoRnet::MSG2_STREAM_REGISTER) {
+            if (len < sizeof(RoRnet::StreamRegister)) {
+                return;
+            }
+            found->second.streams[streamid] = *(RoRnet::StreamRegister *) data;
+        } else if (type == RoRnet::MSG2_STREAM_UNREGISTER) {
+            found->second.streams.erase(streamid);
+            found->second.last_frames.erase(streamid);
+        } else if (type == RoRnet::MSG2_STREAM_DATA || type == RoRnet::MSG2_STREAM_DATA_DISCARDABLE) {
+            if (found->second.streams.find(streamid) != found->second.streams.end()) {
+                StoreLastFrame(found->second.last_frames, streamid, data, len);
             }
         }
     }
+
+    for (Client *client : m_clients) {
+        if (to_all || (client->GetStatus() == Client::STATUS_USED && client->IsReceivingData())) {
+            client->QueueMessage(type, uid, streamid, len, data);
+        }
+    }
 }
 
 int Sequencer::sendGameCommand(int uid, std::string cmd) {
@@ -844,7 +1109,7 @@ void Sequencer::streamDebug() {
 
 //this is called by the receivers threads, like crazy & concurrently
 void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *data, unsigned int len) {
-    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
+    std::unique_lock<std::mutex> scoped_lock(m_clients_mutex);
 
     Client *client = this->FindClientById(static_cast<unsigned int>(uid));
     if (client == nullptr) {
@@ -875,14 +1140,32 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
         publishMode = BROADCAST_NORMAL;
 
         // Simple data validation (needed due to bug in RoR 0.38)
-        {
-            std::map<unsigned int, RoRnet::StreamRegister>::iterator it = client->streams.find(streamid);
-            if (it == client->streams.end())
-                publishMode = BROADCAST_BLOCK;
+        std::map<unsigned int, RoRnet::StreamRegister>::iterator it = client->streams.find(streamid);
+        if (it == client->streams.end()) {
+            publishMode = BROADCAST_BLOCK;
+        } else {
+            // Parked vehicles: only relay a keep-alive now and then while nothing but the time changes
+            const bool idle = m_config.idle_keepalive_ms > 0 && it->second.type == STREAM_REG_TYPE_VEHICLE &&
+                              IsIdleVehicleFrame(client->last_frames, streamid, data, len);
+            StoreLastFrame(client->last_frames, streamid, data, len);
+            if (!m_stream_data_subs.empty()) {
+                this->SampleStreamData(client, it->second, streamid);
+            }
+
+            if (m_config.idle_keepalive_ms > 0) {
+                const auto now = std::chrono::steady_clock::now();
+                auto relayed = client->last_relayed.find(streamid);
+                if (idle && relayed != client->last_relayed.end() &&
+                    now - relayed->second < std::chrono::milliseconds(m_config.idle_keepalive_ms)) {
+                    publishMode = BROADCAST_BLOCK;
+                } else {
+                    client->last_relayed[streamid] = now;
+                }
+            }
         }
     } else if (type == RoRnet::MSG2_STREAM_REGISTER) {
         RoRnet::StreamRegister *reg = (RoRnet::StreamRegister *) data;
-        if (client->streams.size() >= Config::getMaxVehicles() + NON_VEHICLE_STREAMS) {
+        if (client->streams.size() >= m_config.max_vehicles + NON_VEHICLE_STREAMS) {
             // This user has too many vehicles, we drop the stream and then disconnect the user
             Logger::Log(LOG_INFO, "%s(%d) has too many streams. Stream dropped, user kicked.",
                         Str::SanitizeUtf8(client->user.username).c_str(), client->user.uniqueid);
@@ -894,7 +1177,7 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
             // broadcast a general message that this user was auto-kicked
             char sayMsg[128] = "";
             sprintf(sayMsg, "%s was auto-kicked for having too many vehicles (limit: %d)",
-                    Str::SanitizeUtf8(client->user.username).c_str(), Config::getMaxVehicles());
+                    Str::SanitizeUtf8(client->user.username).c_str(), m_config.max_vehicles);
             serverSay(sayMsg, TO_ALL, FROM_SERVER);
 
             QueueClientForDisconnect(client->user.uniqueid, "You have too many vehicles. Please rejoin.", false);
@@ -907,12 +1190,12 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
             // broadcast a general message that this user was auto-kicked
             char sayMsg[300] = "";
             snprintf(sayMsg, 300, "%s was auto-kicked for spawning vehicles too fast (limit: %d spawns per %d sec)",
-                    client->GetUsername().c_str(), Config::getMaxSpawnRate(), Config::getSpawnIntervalSec());
+                    client->GetUsername().c_str(), m_config.max_spawn_rate, m_config.spawn_interval_sec);
             serverSay(sayMsg, TO_ALL, FROM_SERVER);
 
             // disconnect the user with a message
             snprintf(sayMsg, 300, "You were auto-kicked for spawning vehicles too fast (limit: %d spawns per %d sec). Please rejoin.",
-                    Config::getMaxSpawnRate(), Config::getSpawnIntervalSec());
+                    m_config.max_spawn_rate, m_config.spawn_interval_sec);
             QueueClientForDisconnect(client->user.uniqueid, sayMsg, false);
             publishMode = BROADCAST_BLOCK; // drop
         } else if (reg->type == STREAM_REG_TYPE_VEHICLE && !Utils::isValidVehicleFileName(reg->name)) {
@@ -934,9 +1217,15 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
             publishMode = BROADCAST_NORMAL;
 
 #ifdef WITH_ANGELSCRIPT
-            // Do a script callback
-            if (m_script_engine) {
-                int scriptpub = m_script_engine->streamAdded(client->user.uniqueid, reg);
+            // Do a script callback; the script may need the clients meanwhile
+            if (m_script_engine && m_script_engine->HasCallbacks(CALLBACK_STREAM_ADDED)) {
+                scoped_lock.unlock();
+                int scriptpub = m_script_engine->RequestStreamAdded(uid, *reg);
+                scoped_lock.lock();
+                client = this->FindClientById(static_cast<unsigned int>(uid));
+                if (client == nullptr) {
+                    return; // left while the script decided
+                }
 
                 // We only support blocking and normal at the moment. Other modes are not supported.
                 switch (scriptpub) {
@@ -971,7 +1260,7 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
                                                    std::string(reg->name), std::string());
 
                 // Notify the user about the vehicle limit
-                if ((client->streams.size() >= Config::getMaxVehicles() + NON_VEHICLE_STREAMS - 3) &&
+                if ((client->streams.size() >= m_config.max_vehicles + NON_VEHICLE_STREAMS - 3) &&
                     (client->streams.size() > NON_VEHICLE_STREAMS)) {
                     // we start warning the user as soon as he has only 3 vehicles left before he will get kicked (that's why we do minus three in the 'if' statement above).
                     char sayMsg[128] = "";
@@ -979,10 +1268,10 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
                     // special case if the user has exactly 1 vehicle
                     if (client->streams.size() == NON_VEHICLE_STREAMS + 1)
                         sprintf(sayMsg, "You now have 1 vehicle. The vehicle limit on this server is set to %d.",
-                                Config::getMaxVehicles());
+                                m_config.max_vehicles);
                     else
                         sprintf(sayMsg, "You now have %lu vehicles. The vehicle limit on this server is set to %d.",
-                                (client->streams.size() - NON_VEHICLE_STREAMS), Config::getMaxVehicles());
+                                (client->streams.size() - NON_VEHICLE_STREAMS), m_config.max_vehicles);
 
                     serverSay(sayMsg, client->user.uniqueid, FROM_SERVER);
                 }
@@ -1007,10 +1296,17 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
             origin_client->QueueMessage(type, uid, streamid, sizeof(RoRnet::StreamRegister), (char *) reg);
             Logger::Log(LOG_VERBOSE, "stream registration result for stream %03d:%03d from user %03d: %d",
                         reg->origin_sourceid, reg->origin_streamid, uid, reg->status);
+        } else if (m_cluster != nullptr && m_remote_users.count(reg->origin_sourceid) > 0) {
+            m_cluster->SendToNode(m_remote_users[reg->origin_sourceid].node_id, type, uid, streamid,
+                                  sizeof(RoRnet::StreamRegister), (char *) reg);
         }
         publishMode = BROADCAST_BLOCK;
     } else if (type == RoRnet::MSG2_STREAM_UNREGISTER) {
         // Remove the stream
+        client->last_frames.erase(streamid);
+        client->last_relayed.erase(streamid);
+        client->next_stream_sample.erase(streamid);
+        m_stream_data_subs.erase(std::make_pair((int) client->user.uniqueid, (int) streamid));
         if (client->streams.erase(streamid) > 0) {
             Logger::Log(LOG_VERBOSE, " * stream deregistered: %d:%d", client->user.uniqueid, streamid);
             publishMode = BROADCAST_ALL;
@@ -1032,15 +1328,21 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
         }
 
 #ifdef WITH_ANGELSCRIPT
-        if (m_script_engine) {
-            int scriptpub = m_script_engine->playerChat(client->user.uniqueid, str);
+        if (m_script_engine && m_script_engine->HasCallbacks(CALLBACK_PLAYER_CHAT)) {
+            scoped_lock.unlock(); // the script may need the clients meanwhile
+            int scriptpub = m_script_engine->RequestPlayerChat(uid, str);
+            scoped_lock.lock();
+            client = this->FindClientById(static_cast<unsigned int>(uid));
+            if (client == nullptr) {
+                return; // left while the script decided
+            }
             if (scriptpub != BROADCAST_AUTO) publishMode = scriptpub;
         }
 #endif //WITH_ANGELSCRIPT
         if (str == "!help") {
             serverSay(std::string("builtin commands:"), uid);
             serverSay(std::string("!version, !list, !say, !bans, !ban, !unban, !unbanip, !kick, !vehiclelimit"), uid);
-            serverSay(std::string("!website, !irc, !owner, !voip, !rules, !motd"), uid);
+            serverSay(std::string("!website, !irc, !owner, !voip, !rules, !motd, !scriptprofile, !reloadscript"), uid);
         }
 
         if (str == "!version") {
@@ -1243,8 +1545,48 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
             }
         } else if (str == "!vehiclelimit") {
             char sayMsg[128] = "";
-            sprintf(sayMsg, "The vehicle-limit on this server is set on %d", Config::getMaxVehicles());
+            sprintf(sayMsg, "The vehicle-limit on this server is set on %d", m_config.max_vehicles);
             serverSay(sayMsg, uid, FROM_SERVER);
+        } else if (str == "!reloadscript") {
+            if (client->user.authstatus & RoRnet::AUTH_ADMIN) {
+#ifdef WITH_ANGELSCRIPT
+                if (m_script_engine) {
+                    serverSay(std::string("Reloading the script ..."), uid);
+                    m_script_engine->QueueReload(uid);
+                } else {
+                    serverSay(std::string("This session runs no script."), uid);
+                }
+#else
+                serverSay(std::string("This server was built without scripting support."), uid);
+#endif //WITH_ANGELSCRIPT
+            } else {
+                // not allowed
+                serverSay(std::string("You are not authorized to use this command!"), uid);
+            }
+        } else if (str == "!scriptprofile" || str == "!scriptprofile reset") {
+            if (client->user.authstatus & RoRnet::AUTH_MOD || client->user.authstatus & RoRnet::AUTH_ADMIN) {
+#ifdef WITH_ANGELSCRIPT
+                std::vector<std::string> report;
+                if (m_script_engine) {
+                    report = m_script_engine->GetProfileReport(SCRIPT_PROFILE_CHAT_ROWS);
+                }
+                if (report.empty()) {
+                    serverSay(std::string("Script profiling is off, see script-profiling in the server config."), uid);
+                } else if (str == "!scriptprofile reset") {
+                    m_script_engine->ResetProfile();
+                    serverSay(std::string("Script profile reset."), uid);
+                } else {
+                    for (const std::string &line : report) {
+                        serverSay(line, uid);
+                    }
+                }
+#else
+                serverSay(std::string("This server was built without scripting support."), uid);
+#endif //WITH_ANGELSCRIPT
+            } else {
+                // not allowed
+                serverSay(std::string("You are not authorized to use this command!"), uid);
+            }
         } else if (str.substr(0, 5) == "!say ") {
             if (client->user.authstatus & RoRnet::AUTH_MOD || client->user.authstatus & RoRnet::AUTH_ADMIN) {
                 int kuid = -2;
@@ -1289,9 +1631,9 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
                 serverSay(sayMsg, uid, FROM_SERVER);
             }
         } else if (str == "!rules") {
-            if (!Config::getRulesFile().empty()) {
+            if (!m_config.rules_file.empty()) {
                 std::vector<std::string> lines;
-                int res = Utils::ReadLinesFromFile(Config::getRulesFile(), lines);
+                int res = Utils::ReadLinesFromFile(m_config.rules_file, lines);
                 if (!res) {
                     std::vector<std::string>::iterator it;
                     for (it = lines.begin(); it != lines.end(); it++) {
@@ -1314,7 +1656,7 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
     } else if (type == RoRnet::MSG2_GAME_CMD) {
         // script message
 #ifdef WITH_ANGELSCRIPT
-        if (m_script_engine) m_script_engine->gameCmd(client->user.uniqueid, std::string(data));
+        if (m_script_engine) m_script_engine->QueueGameCmd(client->user.uniqueid, std::string(data));
 #endif //WITH_ANGELSCRIPT
         publishMode = BROADCAST_BLOCK;
     }
@@ -1370,6 +1712,9 @@ void Sequencer::queueMessage(int uid, int type, unsigned int streamid, char *dat
                     curr_client->QueueMessage(type, client->user.uniqueid, streamid, len, data);
                 }
             }
+            if (m_cluster != nullptr) {
+                m_cluster->Forward(type, client->user.uniqueid, streamid, len, data);
+            }
         } else if (publishMode == BROADCAST_AUTHED) {
             // push to all bots and authed users above auth level 1
             for (unsigned int i = 0; i < m_clients.size(); i++) {
@@ -1462,16 +1807,16 @@ void Sequencer::printStats() {
                             "outgoing: %0.1fkB/s",
                     traffic.bandwidthIncomingRate / 1024,
                     traffic.bandwidthOutgoingRate / 1024);
-    }
-}
 
-void Sequencer::frameStepScripts(float dt)
-{
-#ifdef WITH_ANGELSCRIPT
-    // All script callbacks must be invoked while clients-mutex is locked
-    std::lock_guard<std::mutex> scoped_lock(m_clients_mutex);
-    m_script_engine->frameStep(dt);
-#endif // WITH_ANGELSCRIPT
+        Compression::Stats compression = Compression::GetStats();
+        if (compression.raw_bytes_out > 0 || compression.raw_bytes_in > 0) {
+            Logger::Log(LOG_INFO, "- compression: outgoing: %0.2fMB -> %0.2fMB , incoming: %0.2fMB <- %0.2fMB , "
+                                "time spent: %0.1fs",
+                        compression.raw_bytes_out / 1024.0 / 1024, compression.compressed_bytes_out / 1024.0 / 1024,
+                        compression.raw_bytes_in / 1024.0 / 1024, compression.compressed_bytes_in / 1024.0 / 1024,
+                        compression.time_us / 1000000.0);
+        }
+    }
 }
 
 // clients_mutex needs to be locked wen calling this method
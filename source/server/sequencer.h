@@ -21,6 +21,7 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
 #include "blacklist.h"
+#include "config.h"
 #include "prerequisites.h"
 #include "rornet.h"
 #include "broadcaster.h"
@@ -37,10 +38,12 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "UnicodeStrings.h"
 
 #include <chrono>
+#include <memory>
 #include <queue>
 #include <vector>
 #include <mutex>
 #include <map>
+#include <set>
 #include <thread>
 #include <condition_variable>
 
@@ -102,7 +105,7 @@ public:
         STATUS_USED = 2
     };
 
-    Client(Sequencer *sequencer, SWInetSocket *socket);
+    Client(Sequencer *sequencer, Transport *transport);
 
     void StartThreads();
 
@@ -110,13 +113,15 @@ public:
 
     void QueueMessage(int msg_type, int client_id, unsigned int stream_id, unsigned int payload_len, const char *payload);
 
+    void QueueSnapshot(std::shared_ptr<const WorldSnapshot> snapshot) { m_broadcaster.QueueSnapshot(snapshot); }
+
     void NotifyAllVehicles(Sequencer *sequencer);
 
     bool CheckSpawnRate(); //!< True if OK to spawn, false if exceeded maximum
 
     std::string GetIpAddress();
 
-    SWInetSocket *GetSocket() { return m_socket; }
+    Transport *GetTransport() { return m_transport; }
 
     bool IsBroadcasterDroppingPackets() const { return m_broadcaster.IsDroppingPackets(); }
 
@@ -124,6 +129,16 @@ public:
 
     bool IsReceivingData() const { return m_is_receiving_data; }
 
+    void SetCapabilities(uint32_t caps) { m_capabilities = caps; } //!< Before the threads start
+
+    bool HasCapability(RoRnet::Capability cap) const { return (m_capabilities & cap) != 0; }
+
+    uint32_t GetCapabilities() const { return m_capabilities; }
+
+    void SetUdpToken(uint64_t token) { m_udp_token = token; } //!< Before the threads start
+
+    uint64_t GetUdpToken() const { return m_udp_token; }
+
     Status GetStatus() const { return m_status; }
 
     int GetUserId() const { return static_cast<int>(user.uniqueid); }
@@ -140,8 +155,13 @@ public:
 
     std::map<unsigned int, stream_traffic_t> streams_traffic;
 
+    std::map<unsigned int, StreamFrame> last_frames; //!< Newest data per stream, for late joiners
+
+    std::map<unsigned int, std::chrono::steady_clock::time_point> last_relayed; //!< For idle-vehicle-keepalive
+    std::map<unsigned int, std::chrono::steady_clock::time_point> next_stream_sample; //!< See ServerScript::subscribeStreamData()
+
 private:
-    SWInetSocket *m_socket;
+    Transport *m_transport;
     Receiver m_receiver;
     Broadcaster m_broadcaster;
     Status m_status;
@@ -149,6 +169,8 @@ private:
     Sequencer* m_sequencer;
     bool m_is_receiving_data;
     bool m_is_initialized;
+    uint32_t m_capabilities = RoRnet::CAP_NONE; //!< Negotiated at join, see RoRnet::Capability
+    uint64_t m_udp_token = 0; //!< Identifies the client on the UdpChannel, 0 = TCP only
     std::vector<std::chrono::system_clock::time_point> m_stream_reg_timestamps; //!< To limit spawn rate
 };
 
@@ -171,6 +193,14 @@ struct WebserverClientInfo // Needed because Client cannot be trivially copied a
     std::map<unsigned int, stream_traffic_t> streams_traffic;
 };
 
+/// A user connected to another node of the cluster, see cluster.h
+struct RemoteUser {
+    int node_id = 0;
+    RoRnet::UserInfo user;
+    std::map<unsigned int, RoRnet::StreamRegister> streams;
+    std::map<unsigned int, StreamFrame> last_frames;
+};
+
 struct ban_t {
 	unsigned int bid;			//!< id of ban, not the user id
     char ip[40];                //!< ip of banned client
@@ -199,21 +229,25 @@ class Sequencer {
     friend class SpamFilter;
     friend class Client;
     friend class ServerScript;
+    friend class ScriptEngine;
     friend class Blacklist;
 public:
 
     // Startup and shutdown
     Sequencer();
-    void Initialize();
+    /// @param auth Shared by the sessions of one process; created from the auth file if null.
+    void Initialize(const SessionConfig &config = Config::getDefaultSession(),
+                    std::shared_ptr<UserAuth> auth = nullptr);
     void Close();
 
+    const SessionConfig &GetConfig() const { return m_config; } //!< Constant after Initialize()
+
     // Synchronized public interface
-    void createClient(SWInetSocket *sock, RoRnet::UserInfo user);
+    void createClient(Transport *transport, RoRnet::UserInfo user);
     void disconnectClient(int client_id, const char* error, bool isError = true, bool doScriptCallback = true);
     int getNumClients();
     void queueMessage(int uid, int type, unsigned int streamid, char *data, unsigned int len);
     void sendMOTDSynchronized(int uid);
-    void frameStepScripts(float dt);
     void GetHeartbeatUserList(Json::Value &out_array);
     void UpdateMinuteStats();
     int AuthorizeNick(std::string token, std::string &nickname);
@@ -224,6 +258,23 @@ public:
     void StartKillerThread();
     void StopKillerThread();
 
+    // Cluster (see cluster.h)
+    void SetCluster(Cluster *cluster); //!< Before the first client connects
+    void ClusterNodeConnected(int node_id);
+    void ClusterNodeLost(int node_id);
+    void queueClusterMessage(int node_id, int type, int uid, unsigned int streamid, char *data, unsigned int len);
+
+    /// Next free user id in [first, last] from `next` on, wrapping around; 0 if all are in use.
+    /// Advances `next` past it.
+    static unsigned int AllocateUserId(unsigned int &next, unsigned int first, unsigned int last,
+                                       const std::set<unsigned int> &in_use);
+
+    // UDP side channel (see udp.h)
+    void SetUdpChannel(UdpChannel *udp); //!< Before the first client connects
+
+    // Scripting
+    void ReloadScript(); //!< In the background, see ScriptEngine::QueueReload()
+
     static unsigned int connCrash, connCount;
 
 private:
@@ -250,6 +301,7 @@ private:
     void                     streamDebug();
     std::vector<ban_t>       GetBanListCopy();
     void                     broadcastUserInfo(int uid);
+    void                     SampleStreamData(Client *client, const RoRnet::StreamRegister &reg, unsigned int streamid);
 
     // Killer thread
     void                     KillerThreadMain();
@@ -257,16 +309,23 @@ private:
     void                     KillerThreadProcessClient(Client* client);
 
     std::mutex m_clients_mutex;  //!< Protects: m_clients, m_script_engine, m_auth_resolver, m_bot_count, m_num_disconnects_[total/crash]
+    SessionConfig m_config;
     ScriptEngine *m_script_engine;
-    UserAuth *m_auth_resolver;
+    std::shared_ptr<UserAuth> m_auth_resolver;
     int m_bot_count;      //!< Amount of registered bots on the server.
     unsigned int m_free_user_id;
+    unsigned int m_first_user_id; //!< Range of this node's user ids, see Cluster
+    unsigned int m_last_user_id;
     int m_start_time;
     size_t m_num_disconnects_total; //!< Statistic
     size_t m_num_disconnects_crash; //!< Statistic
     Blacklist m_blacklist;
 
     std::vector<Client *> m_clients;
+    std::map<int, RemoteUser> m_remote_users; //!< By uid; protected by m_clients_mutex
+    std::map<std::pair<int, int>, int> m_stream_data_subs; //!< (uid, streamid), -1 = any, to ms between samples; protected by m_clients_mutex
+    Cluster *m_cluster = nullptr;
+    UdpChannel *m_udp = nullptr;
     std::vector<ban_t *> m_bans;
     std::vector<report_t *> m_reports;
 
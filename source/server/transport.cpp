@@ -0,0 +1,183 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "transport.h"
+
+#include "SocketW.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// ============================== SocketTransport =============================
+
+SocketTransport::SocketTransport(SWInetSocket *socket) :
+        m_socket(socket) {
+}
+
+SocketTransport::~SocketTransport() {
+    delete m_socket;
+}
+
+bool SocketTransport::SendAll(const char *buf, int len) {
+    SWBaseSocket::SWBaseError error;
+    if (m_socket->fsend(buf, len, &error) < len) {
+        m_last_error = error.get_error();
+        return false;
+    }
+    return true;
+}
+
+bool SocketTransport::RecvAll(char *buf, int len) {
+    SWBaseSocket::SWBaseError error;
+    if (m_socket->frecv(buf, len, &error) < len) {
+        m_last_error = error.get_error();
+        return false;
+    }
+    return true;
+}
+
+void SocketTransport::SetTimeout(unsigned int sec) {
+    m_socket->set_timeout((Uint32) sec, 0);
+}
+
+std::string SocketTransport::GetPeerAddress() {
+    SWBaseSocket::SWBaseError error;
+    std::string addr = m_socket->get_peerAddr(&error);
+    if (error != SWBaseSocket::ok) {
+        m_last_error = error.get_error();
+    }
+    return addr;
+}
+
+bool SocketTransport::Disconnect() {
+    SWBaseSocket::SWBaseError error;
+    bool disconnected_ok = m_socket->disconnect(&error);
+    if (!disconnected_ok || (error != SWBaseSocket::ok)) {
+        m_last_error = error.get_error();
+        return false;
+    }
+    return true;
+}
+
+// ============================= LoopbackTransport ============================
+
+/// One direction of a loopback connection: a bounded ring buffer.
+struct LoopbackPipe {
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::vector<char>       buffer;
+    size_t                  read_pos = 0;
+    size_t                  used = 0;
+    bool                    closed = false;
+
+    explicit LoopbackPipe(size_t capacity) : buffer(capacity) {}
+};
+
+void LoopbackTransport::CreatePair(LoopbackTransport *&out_a, LoopbackTransport *&out_b, size_t capacity) {
+    std::shared_ptr<LoopbackPipe> a_to_b = std::make_shared<LoopbackPipe>(capacity);
+    std::shared_ptr<LoopbackPipe> b_to_a = std::make_shared<LoopbackPipe>(capacity);
+    out_a = new LoopbackTransport(b_to_a, a_to_b);
+    out_b = new LoopbackTransport(a_to_b, b_to_a);
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<LoopbackPipe> in, std::shared_ptr<LoopbackPipe> out) :
+        m_in(in),
+        m_out(out) {
+}
+
+LoopbackTransport::~LoopbackTransport() {
+    this->Disconnect();
+}
+
+bool LoopbackTransport::SendAll(const char *buf, int len) {
+    LoopbackPipe &pipe = *m_out;
+    std::unique_lock<std::mutex> lock(pipe.mutex);
+    const size_t capacity = pipe.buffer.size();
+    size_t done = 0;
+    while (done < (size_t) len) {
+        pipe.cond.wait(lock, [&] { return pipe.closed || pipe.used < capacity; });
+        if (pipe.closed) {
+            m_last_error = "connection closed";
+            return false;
+        }
+
+        // copy as much as fits, in up to two chunks around the end of the ring
+        size_t count = std::min((size_t) len - done, capacity - pipe.used);
+        while (count > 0) {
+            const size_t write_pos = (pipe.read_pos + pipe.used) % capacity;
+            const size_t chunk = std::min(count, capacity - write_pos);
+            std::memcpy(&pipe.buffer[write_pos], buf + done, chunk);
+            pipe.used += chunk;
+            done += chunk;
+            count -= chunk;
+        }
+        pipe.cond.notify_all();
+    }
+    return true;
+}
+
+bool LoopbackTransport::RecvAll(char *buf, int len) {
+    LoopbackPipe &pipe = *m_in;
+    std::unique_lock<std::mutex> lock(pipe.mutex);
+    const size_t capacity = pipe.buffer.size();
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(m_timeout_sec);
+    size_t done = 0;
+    while (done < (size_t) len) {
+        auto ready = [&] { return pipe.closed || pipe.used > 0; };
+        if (m_timeout_sec == 0) {
+            pipe.cond.wait(lock, ready);
+        } else if (!pipe.cond.wait_until(lock, deadline, ready)) {
+            m_last_error = "timeout";
+            return false;
+        }
+        if (pipe.used == 0) {
+            m_last_error = "connection closed";
+            return false;
+        }
+
+        size_t count = std::min((size_t) len - done, pipe.used);
+        while (count > 0) {
+            const size_t chunk = std::min(count, capacity - pipe.read_pos);
+            std::memcpy(buf + done, &pipe.buffer[pipe.read_pos], chunk);
+            pipe.read_pos = (pipe.read_pos + chunk) % capacity;
+            pipe.used -= chunk;
+            done += chunk;
+            count -= chunk;
+        }
+        pipe.cond.notify_all();
+    }
+    return true;
+}
+
+bool LoopbackTransport::Disconnect() {
+    // Close both directions, the peer notices on its next (or pending) call
+    for (LoopbackPipe *pipe : {m_in.get(), m_out.get()}) {
+        {
+            std::lock_guard<std::mutex> lock(pipe->mutex);
+            pipe->closed = true;
+        }
+        pipe->cond.notify_all();
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   transport.h
+/// @brief  Byte stream between the server and one client.
+///
+/// The relay only talks to `Transport`; `SocketTransport` wraps the TCP sockets
+/// of SocketW, `LoopbackTransport` connects two ends inside one process (tools).
+
+#pragma once
+
+#include "prerequisites.h"
+
+#include <memory>
+#include <string>
+
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    /// Blocks until all bytes are written. @return false on error.
+    virtual bool SendAll(const char *buf, int len) = 0;
+
+    /// Blocks until exactly `len` bytes are read. @return false on error, timeout or disconnect.
+    virtual bool RecvAll(char *buf, int len) = 0;
+
+    /// Receive timeout; 0 waits forever.
+    virtual void SetTimeout(unsigned int sec) = 0;
+
+    virtual std::string GetPeerAddress() = 0;
+
+    /// Also unblocks pending calls. @return false on error.
+    virtual bool Disconnect() = 0;
+
+    /// Description of the last error, for logging.
+    virtual std::string GetLastError() = 0;
+};
+
+/// TCP connection through SocketW.
+class SocketTransport : public Transport {
+public:
+    explicit SocketTransport(SWInetSocket *socket); //!< Takes ownership
+    ~SocketTransport();
+
+    bool        SendAll(const char *buf, int len) override;
+    bool        RecvAll(char *buf, int len) override;
+    void        SetTimeout(unsigned int sec) override;
+    std::string GetPeerAddress() override;
+    bool        Disconnect() override;
+    std::string GetLastError() override { return m_last_error; }
+
+private:
+    SWInetSocket *m_socket;
+    std::string   m_last_error;
+};
+
+struct LoopbackPipe;
+
+/// In-memory connection; both ends are created by `CreatePair()`.
+/// Writes block while the peer has `capacity` bytes unread, like a socket buffer.
+class LoopbackTransport : public Transport {
+public:
+    static const size_t DEFAULT_CAPACITY = 256 * 1024;
+
+    static void CreatePair(LoopbackTransport *&out_a, LoopbackTransport *&out_b,
+                           size_t capacity = DEFAULT_CAPACITY);
+
+    ~LoopbackTransport();
+
+    bool        SendAll(const char *buf, int len) override;
+    bool        RecvAll(char *buf, int len) override;
+    void        SetTimeout(unsigned int sec) override { m_timeout_sec = sec; }
+    std::string GetPeerAddress() override { return "127.0.0.1"; }
+    bool        Disconnect() override;
+    std::string GetLastError() override { return m_last_error; }
+
+private:
+    LoopbackTransport(std::shared_ptr<LoopbackPipe> in, std::shared_ptr<LoopbackPipe> out);
+
+    std::shared_ptr<LoopbackPipe> m_in;
+    std::shared_ptr<LoopbackPipe> m_out;
+    unsigned int                  m_timeout_sec = 0;
+    std::string                   m_last_error;
+};
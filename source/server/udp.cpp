@@ -0,0 +1,283 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "udp.h"
+
+#include "capture.h"
+#include "logger.h"
+#include "messaging.h"
+#include "rornet.h"
+#include "sequencer.h"
+
+#include <cstring>
+#include <errno.h>
+#include <random>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif // _WIN32
+
+static const size_t DATAGRAM_HEADER_LEN = sizeof(RoRnet::UdpHeader) + sizeof(RoRnet::Header);
+
+static void CloseSocket(UdpSocket fd) {
+#ifdef _WIN32
+    closesocket(fd);
+    WSACleanup(); // pairs with the WSAStartup() in UdpChannel::Start()
+#else
+    close(fd);
+#endif // _WIN32
+}
+
+static bool SetNonBlocking(UdpSocket fd) {
+#ifdef _WIN32
+    u_long non_blocking = 1;
+    return ioctlsocket(fd, FIONBIO, &non_blocking) == 0;
+#else
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif // _WIN32
+}
+
+/// True if `sequence` is not newer than `newest`, allowing for wrap-around
+static bool IsStale(uint32_t sequence, uint32_t newest) {
+    return static_cast<int32_t>(sequence - newest) <= 0;
+}
+
+UdpChannel::UdpChannel()
+    : m_stop_requested(false) {
+}
+
+UdpChannel::~UdpChannel() {
+    this->Stop();
+}
+
+bool UdpChannel::Start(unsigned int port) {
+#ifdef _WIN32
+    WSADATA wsd;
+    if (WSAStartup(MAKEWORD(2, 2), &wsd) != 0) {
+        Logger::Log(LOG_ERROR, "udp: error starting up winsock");
+        return false;
+    }
+#endif // _WIN32
+
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket == INVALID_UDP_SOCKET) {
+        Logger::Log(LOG_ERROR, "udp: error creating socket: %s", strerror(errno));
+#ifdef _WIN32
+        WSACleanup();
+#endif // _WIN32
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(m_socket, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        Logger::Log(LOG_ERROR, "udp: error binding port %u: %s", port, strerror(errno));
+        CloseSocket(m_socket);
+        m_socket = INVALID_UDP_SOCKET;
+        return false;
+    }
+
+    // never block a sender; the receive thread waits in select()
+    if (!SetNonBlocking(m_socket)) {
+        Logger::Log(LOG_ERROR, "udp: error making the socket non-blocking: %s", strerror(errno));
+        CloseSocket(m_socket);
+        m_socket = INVALID_UDP_SOCKET;
+        return false;
+    }
+
+    m_port = port;
+    m_stop_requested = false;
+    m_thread = std::thread(&UdpChannel::ThreadMain, this);
+    Logger::Log(LOG_INFO, "udp: channel for discardable stream data on port %u", port);
+    return true;
+}
+
+void UdpChannel::Stop() {
+    if (m_thread.joinable()) {
+        m_stop_requested = true;
+        m_thread.join();
+    }
+    if (m_socket != INVALID_UDP_SOCKET) {
+        CloseSocket(m_socket);
+        m_socket = INVALID_UDP_SOCKET;
+    }
+}
+
+uint64_t UdpChannel::AddClient(Sequencer *sequencer, int uid, const std::string &peer_ip) {
+    // The token authenticates the client's datagrams: straight from the OS entropy source, a seeded
+    // generator would give away every other token once one is known
+    std::random_device random;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t token = 0;
+    while (token == 0 || m_endpoints.find(token) != m_endpoints.end()) {
+        token = ((uint64_t) random() << 32) | (uint32_t) random();
+    }
+    Endpoint &endpoint = m_endpoints[token];
+    endpoint.sequencer = sequencer;
+    endpoint.uid = uid;
+    endpoint.peer_ip = peer_ip;
+    return token;
+}
+
+void UdpChannel::RemoveClient(uint64_t token) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_endpoints.erase(token);
+}
+
+bool UdpChannel::Send(uint64_t token, int type, int uid, unsigned int streamid, unsigned int len, const char *data) {
+    if (len > MAX_PAYLOAD) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_endpoints.find(token);
+    if (found == m_endpoints.end() || !found->second.bound) {
+        return false;
+    }
+    Endpoint &endpoint = found->second;
+    this->SendDatagram(endpoint, token, ++endpoint.send_sequence, type, uid, streamid, len, data);
+    return true;
+}
+
+void UdpChannel::SendDatagram(const Endpoint &endpoint, uint64_t token, uint32_t sequence, int type, int uid,
+                              unsigned int streamid, unsigned int len, const char *data) {
+    char buffer[DATAGRAM_HEADER_LEN + MAX_PAYLOAD];
+    RoRnet::UdpHeader udp_header;
+    udp_header.token = token;
+    udp_header.sequence = sequence;
+    RoRnet::Header header;
+    header.command = type;
+    header.source = uid;
+    header.streamid = streamid;
+    header.size = len;
+    memcpy(buffer, &udp_header, sizeof(udp_header));
+    memcpy(buffer + sizeof(udp_header), &header, sizeof(header));
+    if (len > 0) {
+        memcpy(buffer + DATAGRAM_HEADER_LEN, data, len);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = endpoint.port;
+    addr.sin_addr.s_addr = endpoint.address;
+    // the socket is non-blocking; a full send buffer just loses the datagram, like the network may
+    int sent = (int) sendto(m_socket, buffer, (int) (DATAGRAM_HEADER_LEN + len), 0,
+                            (struct sockaddr *) &addr, sizeof(addr));
+    if (sent < 0) {
+        Messaging::StatsAddOutgoingDrop((int) (DATAGRAM_HEADER_LEN + len));
+    } else {
+        Messaging::StatsAddOutgoing(sent);
+    }
+}
+
+void UdpChannel::ThreadMain() {
+    Logger::Log(LOG_DEBUG, "udp: receive thread started");
+    char buffer[DATAGRAM_HEADER_LEN + RORNET_MAX_MESSAGE_LENGTH];
+    while (!m_stop_requested) {
+        // wake up regularly to notice Stop()
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(m_socket, &readable);
+        struct timeval timeout = {1, 0};
+        if (select((int) m_socket + 1, &readable, nullptr, nullptr, &timeout) <= 0) {
+            continue; // timeout or error
+        }
+
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = (int) recvfrom(m_socket, buffer, sizeof(buffer), 0, (struct sockaddr *) &from, &from_len);
+        if (len < (int) DATAGRAM_HEADER_LEN || from.sin_family != AF_INET) {
+            continue; // error or runt
+        }
+        Messaging::StatsAddIncoming(len);
+
+        RoRnet::UdpHeader udp_header;
+        RoRnet::Header header;
+        memcpy(&udp_header, buffer, sizeof(udp_header));
+        memcpy(&header, buffer + sizeof(udp_header), sizeof(header));
+        if (header.size != len - DATAGRAM_HEADER_LEN) {
+            continue;
+        }
+        char *payload = buffer + DATAGRAM_HEADER_LEN;
+
+        Sequencer *sequencer = nullptr;
+        int uid = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_endpoints.find(udp_header.token);
+            if (found == m_endpoints.end()) {
+                continue;
+            }
+            Endpoint &endpoint = found->second;
+            char from_ip[INET_ADDRSTRLEN] = "";
+            inet_ntop(AF_INET, &from.sin_addr, from_ip, sizeof(from_ip));
+            if (endpoint.peer_ip != from_ip) {
+                Logger::Log(LOG_DEBUG, "udp: datagram of uid %d from foreign address %s", endpoint.uid, from_ip);
+                continue;
+            }
+
+            if (header.command == RoRnet::MSG2_HELLO) {
+                // bind (or re-bind, if a NAT changed the port) and acknowledge
+                if (!endpoint.bound || endpoint.port != from.sin_port) {
+                    Logger::Log(LOG_VERBOSE, "udp: uid %d bound to %s:%d", endpoint.uid, from_ip, ntohs(from.sin_port));
+                }
+                endpoint.bound = true;
+                endpoint.address = from.sin_addr.s_addr;
+                endpoint.port = from.sin_port;
+                this->SendDatagram(endpoint, udp_header.token, ++endpoint.send_sequence, RoRnet::MSG2_HELLO, 0, 0, 0, nullptr);
+                continue;
+            }
+
+            if (!endpoint.bound || endpoint.address != from.sin_addr.s_addr || endpoint.port != from.sin_port ||
+                header.command != RoRnet::MSG2_STREAM_DATA_DISCARDABLE) {
+                continue; // everything else belongs on TCP
+            }
+            auto newest = endpoint.recv_sequence.find(header.streamid);
+            if (newest != endpoint.recv_sequence.end() && IsStale(udp_header.sequence, newest->second)) {
+                Messaging::StatsAddIncomingDrop(len);
+                continue;
+            }
+            endpoint.recv_sequence[header.streamid] = udp_header.sequence;
+            sequencer = endpoint.sequencer;
+            uid = endpoint.uid;
+        }
+
+        // the sequencer ignores uids which left in the meantime
+        header.source = uid;
+        if (Capture::IsActive()) {
+            Capture::Record(sequencer->GetConfig().index, uid, header, payload);
+        }
+        sequencer->queueMessage(uid, header.command, header.streamid, payload, header.size);
+    }
+    Logger::Log(LOG_DEBUG, "udp: receive thread stopped");
+}
@@ -0,0 +1,95 @@
+/*
+This file is part of "Rigs of Rods Server" (Relay mode)
+
+Copyright 2007   Pierre-Michel Ricordel
+Copyright 2014+  Rigs of Rods Community
+
+"Rigs of Rods Server" is free software: you can redistribute it
+and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3
+of the License, or (at your option) any later version.
+
+"Rigs of Rods Server" is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the implied
+warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Foobar. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/// @file   udp.h
+/// @brief  UDP side channel for MSG2_STREAM_DATA_DISCARDABLE, see RoRnet::CAP_UDP.
+///
+/// A client which negotiated "udp" finds `udp-port=<port> udp-token=<hex>` in the
+/// sessionoptions of MSG2_WELCOME. It binds its UDP address by sending MSG2_HELLO datagrams
+/// with that token until the server echoes one back. From then on, discardable stream data
+/// travels as datagrams in both directions, so a lost TCP segment no longer holds up vehicle
+/// updates; everything else stays on TCP. Each datagram is a RoRnet::UdpHeader followed by
+/// one RoRnet::Header and its data. Datagrams are only accepted from the IP address of the
+/// TCP connection, and a datagram older than the newest one received for its stream is dropped.
+/// The data of a stream stays on TCP until its MSG2_STREAM_REGISTER is written to the client,
+/// see Broadcaster::IsHoldingUdp().
+
+#pragma once
+
+#include "prerequisites.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+typedef SOCKET UdpSocket;
+#define INVALID_UDP_SOCKET INVALID_SOCKET
+#else
+typedef int UdpSocket;
+#define INVALID_UDP_SOCKET (-1)
+#endif // _WIN32
+
+class UdpChannel {
+public:
+    static const unsigned int MAX_PAYLOAD = 1200; //!< Larger messages stay on TCP, to avoid IP fragmentation
+
+    UdpChannel();
+    ~UdpChannel();
+
+    bool Start(unsigned int port);
+    void Stop();
+
+    unsigned int GetPort() const { return m_port; }
+
+    uint64_t AddClient(Sequencer *sequencer, int uid, const std::string &peer_ip); //!< Returns the token
+    void RemoveClient(uint64_t token);
+
+    /// False if the client has not bound its address yet or the message is too large; send over TCP then.
+    bool Send(uint64_t token, int type, int uid, unsigned int streamid, unsigned int len, const char *data);
+
+private:
+    struct Endpoint {
+        Sequencer*   sequencer = nullptr;
+        int          uid = 0;
+        std::string  peer_ip;
+        bool         bound = false;
+        uint32_t     address = 0;       //!< Network byte order
+        uint16_t     port = 0;          //!< Network byte order
+        uint32_t     send_sequence = 0;
+        std::map<unsigned int, uint32_t> recv_sequence; //!< Newest received, by streamid
+    };
+
+    void ThreadMain();
+    void SendDatagram(const Endpoint &endpoint, uint64_t token, uint32_t sequence, int type, int uid,
+                      unsigned int streamid, unsigned int len, const char *data);
+
+    UdpSocket                    m_socket = INVALID_UDP_SOCKET; //!< Non-blocking
+    unsigned int                 m_port = 0;
+    std::thread                  m_thread;
+    std::atomic<bool>            m_stop_requested;
+
+    std::mutex                   m_mutex; //!< Protects: m_endpoints
+    std::map<uint64_t, Endpoint> m_endpoints;
+};
@@ -118,6 +118,7 @@ int UserAuth::readConfig(const char *authFile) {
 }
 
 int UserAuth::setUserAuth(int flags, std::string user_nick, std::string token) {
+    std::lock_guard<std::mutex> lock(local_auth_mutex);
     user_auth_pair_t p;
     p.first = flags;
     p.second = user_nick;
@@ -181,6 +182,7 @@ int UserAuth::resolve(std::string user_token, std::string &user_nick, int client
     }
 
     //then check for overrides in the authorizations file (server admins, etc)
+    std::lock_guard<std::mutex> lock(local_auth_mutex);
     if (local_auth.find(user_token) != local_auth.end()) {
         // local auth hit!
         // the stored nickname can be empty if no nickname is specified.
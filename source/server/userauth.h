@@ -24,6 +24,7 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "UnicodeStrings.h"
 
 #include <map>
+#include <mutex>
 
 typedef std::pair<int, std::string> user_auth_pair_t;
 
@@ -43,5 +44,6 @@ private:
     int readConfig(const char *authFile);
 
     std::map<std::string, user_auth_pair_t> local_auth;
+    std::mutex local_auth_mutex; //!< One instance serves all sessions of the process
 };
 
@@ -21,6 +21,8 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 #include "utils.h"
 
 #include "logger.h"
+#include "rornet.h"
+
 #include <string>
 #include <vector>
 #include <fstream>
@@ -123,6 +125,60 @@ namespace Utils {
         return !all_spaces;
     }
 
+    std::map<std::string, std::string> ParseSessionOptions(const char *options, size_t max_len)
+    {
+        std::map<std::string, std::string> result;
+        std::vector<std::string> pairs;
+        tokenize(std::string(options, strnlen(options, max_len)), pairs, " ,;");
+        for (const std::string &pair: pairs)
+        {
+            size_t eq_pos = pair.find('=');
+            if (eq_pos == std::string::npos)
+                result[pair] = ""; // Plain flag
+            else
+                result[pair.substr(0, eq_pos)] = pair.substr(eq_pos + 1);
+        }
+        return result;
+    }
+
+    // Everything the server can negotiate, see RoRnet::Capability
+    static const std::map<std::string, uint32_t> CAPABILITY_NAMES = {
+        { "bundle", RoRnet::CAP_BUNDLE },
+        { "delta",  RoRnet::CAP_DELTA },
+        { "udp",    RoRnet::CAP_UDP },
+#ifdef WITH_ZSTD
+        { "zstd",   RoRnet::CAP_COMPRESS },
+#endif // WITH_ZSTD
+    };
+
+    uint32_t ParseCapabilities(const std::string &list)
+    {
+        uint32_t caps = RoRnet::CAP_NONE;
+        std::vector<std::string> names;
+        tokenize(list, names, "+");
+        for (const std::string &name: names)
+        {
+            auto found = CAPABILITY_NAMES.find(name);
+            if (found != CAPABILITY_NAMES.end())
+                caps |= found->second;
+        }
+        return caps;
+    }
+
+    std::string FormatCapabilities(uint32_t caps)
+    {
+        std::string list;
+        for (const auto &entry: CAPABILITY_NAMES)
+        {
+            if ((caps & entry.second) == 0)
+                continue;
+            if (!list.empty())
+                list += "+";
+            list += entry.first;
+        }
+        return list;
+    }
+
 } // namespace Utils
 
 using namespace std;
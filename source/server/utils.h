@@ -22,6 +22,8 @@ along with Foobar. If not, see <http://www.gnu.org/licenses/>.
 
 #include "UnicodeStrings.h"
 
+#include <cstdint>
+#include <map>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -40,6 +42,13 @@ namespace Utils {
     // For checking STREAM_REGISTER messages
     bool isValidVehicleFileName(std::string name);
 
+    // Reads `key=value` pairs from RoRnet::UserInfo::sessionoptions (separated by spaces, commas or semicolons)
+    std::map<std::string, std::string> ParseSessionOptions(const char *options, size_t max_len);
+
+    // RoRnet::Capability flags as `name+name` lists, unknown names are ignored
+    uint32_t ParseCapabilities(const std::string &list);
+    std::string FormatCapabilities(uint32_t caps);
+
 
 } // namespace Utils
 